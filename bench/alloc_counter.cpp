@@ -0,0 +1,71 @@
+// operator new / delete の置き換え (alloc_counter.h)
+// 解放のときに大きさがわかるように、確保したブロックの先頭に大きさを置く
+#include <stdlib.h>
+#include <new>
+#include "alloc_counter.h"
+
+
+static const size_t HEADER_SIZE = alignof(max_align_t);
+
+static bool counting = false;
+static AllocStats stats;
+static ptrdiff_t live_delta = 0; // 数え始めてから増えた使用中のバイト数 (数え始める前のブロックの解放で負になりうる)
+
+
+void alloc_counter_start() {
+    stats = AllocStats();
+    live_delta = 0;
+    counting = true;
+}
+
+
+AllocStats alloc_counter_stop() {
+    counting = false;
+    return stats;
+}
+
+
+void *operator new(size_t size) {
+    void *block = malloc(HEADER_SIZE + size);
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    *(size_t *)block = size;
+    if (counting) {
+        stats.allocations++;
+        stats.bytes += size;
+        live_delta += (ptrdiff_t)size;
+        if (live_delta > (ptrdiff_t)stats.peak_bytes) {
+            stats.peak_bytes = (size_t)live_delta;
+        }
+    }
+    return (char *)block + HEADER_SIZE;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    if (p == nullptr) {
+        return;
+    }
+    void *block = (char *)p - HEADER_SIZE;
+    size_t size = *(size_t *)block;
+    if (counting) {
+        live_delta -= (ptrdiff_t)size;
+    }
+    free(block);
+}
+
+void operator delete[](void *p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    operator delete(p);
+}
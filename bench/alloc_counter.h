@@ -0,0 +1,16 @@
+// operator new / delete を置き換えて、測っている間のヒープの使い方を数える
+// (alloc_counter.cpp を実行ファイルに1つだけリンクする)
+#pragma once
+
+#include <stddef.h>
+
+
+struct AllocStats {
+    size_t allocations; // operator new の回数
+    size_t bytes; // 確保したバイト数の合計
+    size_t peak_bytes; // 始めたときから増えた、使用中のバイト数の最大
+};
+
+
+void alloc_counter_start();
+AllocStats alloc_counter_stop();
@@ -0,0 +1,113 @@
+// 8 ビットの軸を持つゲームパッドのレポートの Parse の、軸1つあたりの時間
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で axis_bench としてビルドされる
+//
+// ボタン 16 個と 8 ビットの軸 1-9 個 (X, Y, Z, Rx, Ry, Rz, Slider, Dial, Wheel) のレポートを
+// GamepadConfig でマッピングし、軸の数と符号 (0..255 / -128..127) ごとに JSON を1行出力する
+//   baseline_ns  ベースライン (tests/baseline) の Parse の時間
+//   ns           今のパーサの Parse の時間
+// 最後の行 (axes が "slope") は軸1個と9個の差を8で割った、軸1つ増えるごとの時間
+// 時間はホストのもので、RP2040 のサイクル数ではない
+#include <stdio.h>
+#include <stdint.h>
+#include <random>
+#include <vector>
+#include "hid_report_parser.h"
+#include "bench.h"
+#include "corpus.h"
+#include "descriptor_builder.h"
+#include "baseline_hid.h"
+
+
+const int REPEATS = 5;
+const int ITERATIONS = 1000000;
+const int MAX_AXES = hid::USAGE_WHEEL - hid::USAGE_X + 1;
+const int BUTTONS = 16;
+const int REPORTS = 16;
+
+
+static std::vector<uint8_t> make_descriptor(int axes, bool is_signed) {
+    DescriptorBuilder d;
+    d.usage_page(hid::PAGE_GENERIC_DESKTOP).usage(hid::USAGE_GAMEPAD).collection(hid::COLLECTION_TYPE_APPLICATION)
+        .usage_page(hid::PAGE_BUTTON).usage_range(1, BUTTONS).logical_range(0, 1)
+        .report_size(1).report_count(BUTTONS).input(0x02)
+        .usage_page(hid::PAGE_GENERIC_DESKTOP);
+    for (int i = 0; i < axes; i++) {
+        d.usage(hid::USAGE_X + i);
+    }
+    d.logical_range(is_signed ? -128 : 0, is_signed ? 127 : 255)
+        .report_size(8).report_count(axes).input(0x02)
+        .end_collection();
+    return d.bytes;
+}
+
+
+template <class HID>
+struct AxisCase {
+    CorpusTargets<HID> targets;
+    typename HID::Parser parser;
+
+    int init(const std::vector<uint8_t> &descriptor) {
+        return parser.Init(targets.root("gamepad"), descriptor.data(), descriptor.size());
+    }
+
+    double measure(const std::vector<std::vector<uint8_t>> &reports) {
+        return measure_min_ns(REPEATS, ITERATIONS, [&](int i) {
+            const std::vector<uint8_t> &report = reports[i % REPORTS];
+            keep(parser.Parse(report.data(), report.size()));
+        });
+    }
+};
+
+
+struct AxisResult {
+    double baseline_ns;
+    double ns;
+};
+
+
+static bool run(int axes, bool is_signed, AxisResult &out) {
+    std::vector<uint8_t> descriptor = make_descriptor(axes, is_signed);
+    AxisCase<BaselineHid> base;
+    AxisCase<CorpusHid> current;
+    int base_result = base.init(descriptor);
+    int result = current.init(descriptor);
+    if (base_result != hid_baseline::ERR_SUCCESS || result != hid::ERR_SUCCESS) {
+        fprintf(stderr, "Error: %d axes: Init returned %d (baseline %d)\n", axes, result, base_result);
+        return false;
+    }
+
+    // スティックを動かしたようなランダムなレポート
+    std::mt19937 rng(axes);
+    std::vector<std::vector<uint8_t>> reports(REPORTS, std::vector<uint8_t>(BUTTONS / 8 + axes));
+    for (std::vector<uint8_t> &report : reports) {
+        for (uint8_t &byte : report) {
+            byte = (uint8_t)rng();
+        }
+    }
+
+    out.baseline_ns = base.measure(reports);
+    out.ns = current.measure(reports);
+    printf(
+        "{\"signed\":%s,\"axes\":%d,\"baseline_ns\":%.1f,\"ns\":%.1f}\n",
+        is_signed ? "true" : "false", axes, out.baseline_ns, out.ns
+    );
+    return true;
+}
+
+
+int main() {
+    bool ok = true;
+    for (bool is_signed : { false, true }) {
+        AxisResult results[MAX_AXES + 1] = {};
+        for (int axes = 1; axes <= MAX_AXES; axes++) {
+            ok = run(axes, is_signed, results[axes]) && ok;
+        }
+        printf(
+            "{\"signed\":%s,\"axes\":\"slope\",\"baseline_ns_per_axis\":%.2f,\"ns_per_axis\":%.2f}\n",
+            is_signed ? "true" : "false",
+            (results[MAX_AXES].baseline_ns - results[1].baseline_ns) / (MAX_AXES - 1),
+            (results[MAX_AXES].ns - results[1].ns) / (MAX_AXES - 1)
+        );
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+// ホスト用ベンチマークの共通の道具
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+
+// 最適化で消されないように、値を使ったことにする
+static inline void keep(int value) {
+    asm volatile("" : : "r"(value) : "memory");
+}
+
+static inline void keep(const void *data) {
+    asm volatile("" : : "r"(data) : "memory");
+}
+
+
+// fn(i) を iterations 回呼んだときの1回あたりの時間 (ns)
+template <class FN>
+static double measure_ns(int iterations, FN fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+
+// measure_ns を repeats 回繰り返したうちの最小値 (他のプロセスに邪魔された回を捨てる)
+template <class FN>
+static double measure_min_ns(int repeats, int iterations, FN fn) {
+    double best = measure_ns(iterations, fn);
+    for (int i = 1; i < repeats; i++) {
+        best = std::min(best, measure_ns(iterations, fn));
+    }
+    return best;
+}
+
+
+// 0.0-1.0 の位置の値 (samples は並べ替える)
+template <class T>
+static T percentile(std::vector<T> &samples, double p) {
+    if (samples.empty()) {
+        return T();
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t index = (size_t)(p * (samples.size() - 1) + 0.5);
+    return samples[std::min(index, samples.size() - 1)];
+}
@@ -0,0 +1,141 @@
+// ボタンのビットフィールド1つだけのレポートの Parse の時間 (ビットフィールドのコピーのカーネル)
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で2つの実行ファイルとしてビルドされる
+//   bitcopy_bench           HRP_WORD_AT_A_TIME_BIT_COPY の既定の値 (ホストでは語単位のコピー)
+//   bitcopy_bytewise_bench  HRP_WORD_AT_A_TIME_BIT_COPY=0 (Cortex-M0+ と同じ、揃った 32 ビットの語単位のコピー)
+// kernel は word / aligned_word (HRP_ALIGNED_WORD_BIT_COPY) / bytewise のどれが使われたか
+//
+// 8 ビットから HRP_MAX_REPORT_COUNT (0x3000) ビットまでのビットフィールドを、レポートと出力先の
+// ビットの位置の組み合わせ3通りで測り、1行に1つ JSON を出力する
+//   aligned     レポートも出力先もバイト境界から始まる (BITS_BYTES)
+//   same_phase  レポートと出力先がバイトの中の同じビットから始まる (BITS_SAME_PHASE)
+//   shifted     バイトの中の位置が違う (BITS_SHIFTED)
+// baseline_ns はベースライン (tests/baseline) の同じレポートの Parse の時間。時間はホストのもの
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <random>
+#include <vector>
+#include "hid_report_parser.h"
+#include "bench.h"
+#include "corpus.h"
+#include "descriptor_builder.h"
+#include "baseline_hid.h"
+
+
+const int REPEATS = 5;
+const uint32_t MAX_BITS = HRP_MAX_REPORT_COUNT;
+static const uint32_t BIT_COUNTS[] = { 8, 16, 64, 256, 1024, 2000, 4096, MAX_BITS };
+
+struct Layout {
+    const char *name;
+    uint32_t report_padding; // レポートのビットフィールドの前の使わないビット
+    uint16_t first_config_usage; // 出力先のビット 0 の usage (ボタン n は出力先のビット n - first_config_usage に入る)
+};
+
+static const Layout LAYOUTS[] = {
+    { "aligned", 8, 1 },
+    { "same_phase", 1, 0 },
+    { "shifted", 3, 1 },
+};
+
+
+static std::vector<uint8_t> make_descriptor(const Layout &layout, uint32_t bits) {
+    DescriptorBuilder d;
+    d.usage_page(hid::PAGE_GENERIC_DESKTOP).usage(hid::USAGE_GAMEPAD).collection(hid::COLLECTION_TYPE_APPLICATION)
+        .padding(layout.report_padding)
+        .usage_page(hid::PAGE_BUTTON).usage_range(1, bits).logical_range(0, 1)
+        .report_size(1).report_count(bits).input(0x02)
+        .padding((8 - (layout.report_padding + bits) % 8) % 8)
+        .end_collection();
+    return d.bytes;
+}
+
+
+// ボタンを usage の順にビットフィールドに入れるだけの設定
+template <class HID>
+struct BitCopyTarget {
+    typename HID::template BitField<MAX_BITS + 8> bits {};
+    decltype(bits.Ref()) bits_ref = bits.Ref();
+    typename HID::BoolFields buttons;
+    typename HID::Collection root;
+
+    typename HID::Collection *init(const Layout &layout, uint32_t bit_count) {
+        buttons.target = &bits_ref;
+        buttons.usages = { { hid::PAGE_BUTTON, layout.first_config_usage, (uint16_t)bit_count } };
+        root.bools = { &buttons };
+        return &root;
+    }
+};
+
+
+template <class HID>
+struct BitCopyCase {
+    BitCopyTarget<HID> target;
+    typename HID::Parser parser;
+
+    int init(const Layout &layout, uint32_t bits, const std::vector<uint8_t> &descriptor) {
+        return parser.Init(target.init(layout, bits), descriptor.data(), descriptor.size());
+    }
+
+    double measure(const std::vector<std::vector<uint8_t>> &reports, int iterations) {
+        return measure_min_ns(REPEATS, iterations, [&](int i) {
+            const std::vector<uint8_t> &report = reports[i & 1];
+            keep(parser.Parse(report.data(), report.size()));
+        });
+    }
+};
+
+
+static bool run(const Layout &layout, uint32_t bits, std::mt19937 &rng) {
+    std::vector<uint8_t> descriptor = make_descriptor(layout, bits);
+    BitCopyCase<BaselineHid> base;
+    BitCopyCase<CorpusHid> current;
+    int base_result = base.init(layout, bits, descriptor);
+    int result = current.init(layout, bits, descriptor);
+    if (base_result != hid_baseline::ERR_SUCCESS || result != hid::ERR_SUCCESS) {
+        fprintf(stderr, "Error: %s/%u: Init returned %d (baseline %d)\n", layout.name, bits, result, base_result);
+        return false;
+    }
+
+    // ランダムなボタンの状態のレポート2つを交互に与える
+    size_t report_size = (layout.report_padding + bits + 7) / 8;
+    std::vector<std::vector<uint8_t>> reports(2, std::vector<uint8_t>(report_size));
+    for (std::vector<uint8_t> &report : reports) {
+        for (uint8_t &byte : report) {
+            byte = (uint8_t)rng();
+        }
+    }
+
+    // 2つのパーサの出力が同じか
+    for (const std::vector<uint8_t> &report : reports) {
+        base_result = base.parser.Parse(report.data(), report.size());
+        result = current.parser.Parse(report.data(), report.size());
+        if (base_result != result || memcmp(base.target.bits.bytes, current.target.bits.bytes, sizeof(current.target.bits.bytes)) != 0) {
+            fprintf(stderr, "Error: %s/%u: the output differs from the baseline\n", layout.name, bits);
+            return false;
+        }
+    }
+
+    int iterations = (int)std::max<uint32_t>(1000, 20000000 / (bits + 64));
+    double baseline_ns = base.measure(reports, iterations);
+    double ns = current.measure(reports, iterations);
+    printf(
+        "{\"kernel\":\"%s\",\"layout\":\"%s\",\"bits\":%u,\"report_bytes\":%zu,"
+        "\"baseline_ns\":%.1f,\"ns\":%.1f,\"speedup\":%.2f}\n",
+        HRP_WORD_AT_A_TIME_BIT_COPY ? "word" : HRP_ALIGNED_WORD_BIT_COPY ? "aligned_word" : "bytewise", layout.name, bits, report_size,
+        baseline_ns, ns, baseline_ns / ns
+    );
+    return true;
+}
+
+
+int main() {
+    std::mt19937 rng(1);
+    bool ok = true;
+    for (const Layout &layout : LAYOUTS) {
+        for (uint32_t bits : BIT_COUNTS) {
+            ok = run(layout, bits, rng) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+// bench/corpus のレポートディスクリプタのコーパスを読む (ベンチマークとテストで共用)
+//
+// ファイルの書式 (1行に1項目)
+//   # コメント (ディスクリプタの出どころを書いておく)
+//   config gamepad|biggamepad|mouse|keyboard|mmkeyboard   マッピングの設定 (hid_report_parser.h の *Config)
+//   descriptor 05 01 09 05 ...                             ディスクリプタ (複数行ならつなげる)
+//   report 00 01 02 ...                                    入力レポート (レポート ID があれば先頭に含める)
+// 実機のディスクリプタは Linux なら /sys/class/hidraw/hidrawN/device/report_descriptor
+// から読める (usbhid-dump でもよい)。レポートは /dev/hidrawN を読めば取れる
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "hid_report_parser.h"
+
+
+struct CorpusEntry {
+    std::string name;
+    std::string config;
+    std::vector<uint8_t> descriptor;
+    std::vector<std::vector<uint8_t>> reports;
+};
+
+
+static inline bool corpus_parse_hex(std::istringstream &line, std::vector<uint8_t> &out) {
+    std::string token;
+    while (line >> token) {
+        char *end;
+        unsigned long value = strtoul(token.c_str(), &end, 16);
+        if (*end != '\0' || value > 0xFF) {
+            return false;
+        }
+        out.push_back((uint8_t)value);
+    }
+    return true;
+}
+
+
+static inline bool load_corpus_entry(const std::filesystem::path &path, CorpusEntry &entry) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Error: cannot open %s\n", path.c_str());
+        return false;
+    }
+    entry.name = path.stem().string();
+
+    std::string text;
+    int line_number = 0;
+    while (std::getline(file, text)) {
+        line_number++;
+        std::istringstream line(text);
+        std::string key;
+        if (!(line >> key) || key[0] == '#') {
+            continue;
+        }
+
+        bool ok = true;
+        if (key == "config") {
+            ok = (bool)(line >> entry.config);
+        }
+        else if (key == "descriptor") {
+            ok = corpus_parse_hex(line, entry.descriptor);
+        }
+        else if (key == "report") {
+            entry.reports.emplace_back();
+            ok = corpus_parse_hex(line, entry.reports.back()) && !entry.reports.back().empty();
+        }
+        else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: %s:%d: invalid line\n", path.c_str(), line_number);
+            return false;
+        }
+    }
+
+    if (entry.config.empty() || entry.descriptor.empty() || entry.reports.empty()) {
+        fprintf(stderr, "Error: %s: config, descriptor and report are required\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+// dir の *.txt を名前順にすべて読む
+static inline bool load_corpus(const std::filesystem::path &dir, std::vector<CorpusEntry> &entries) {
+    std::vector<std::filesystem::path> paths;
+    std::error_code error;
+    for (const auto &file : std::filesystem::directory_iterator(dir, error)) {
+        if (file.path().extension() == ".txt") {
+            paths.push_back(file.path());
+        }
+    }
+    if (error) {
+        fprintf(stderr, "Error: cannot read %s: %s\n", dir.c_str(), error.message().c_str());
+        return false;
+    }
+    if (paths.empty()) {
+        fprintf(stderr, "Error: no *.txt in %s\n", dir.c_str());
+        return false;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    for (const std::filesystem::path &path : paths) {
+        entries.emplace_back();
+        if (!load_corpus_entry(path, entries.back())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// パーサの型をまとめたもの。ベースライン (tests/baseline) の同じ名前の型と差し替えて
+// 同じコードで両方を動かせるようにする
+struct CorpusHid {
+    template <size_t BIT_SIZE> using BitField = hid::BitField<BIT_SIZE>;
+    template <size_t SIZE> using Int32Array = hid::Int32Array<SIZE>;
+    using Collection = hid::Collection;
+    using Int32Fields = hid::Int32Fields;
+    using BoolFields = hid::BoolFields;
+    using BoolVector = hid::BoolVector;
+    using GamepadConfig = hid::GamepadConfig;
+    using BigGamepadConfig = hid::BigGamepadConfig;
+    using MouseConfig = hid::MouseConfig;
+    using KeyboardConfig = hid::KeyboardConfig;
+    using MultimediaKeyboardConfig = hid::MultimediaKeyboardConfig;
+    using Parser = hid::SelectiveInputReportParser;
+};
+
+
+// 設定ごとの出力先
+template <class HID = CorpusHid>
+struct CorpusTargets {
+    typename HID::template BitField<256> bools {};
+    typename HID::template BitField<256> bools2 {};
+    typename HID::template Int32Array<32> ints {};
+    decltype(bools.Ref()) bools_ref = bools.Ref();
+    decltype(bools2.Ref()) bools2_ref = bools2.Ref();
+    decltype(ints.Ref()) ints_ref = ints.Ref();
+
+    typename HID::GamepadConfig gamepad;
+    typename HID::BigGamepadConfig biggamepad;
+    typename HID::MouseConfig mouse;
+    typename HID::KeyboardConfig keyboard;
+    typename HID::MultimediaKeyboardConfig mmkeyboard;
+
+    typename HID::Collection *root(const std::string &config) {
+        if (config == "gamepad") {
+            return gamepad.Init(&bools_ref, &ints_ref);
+        }
+        if (config == "biggamepad") {
+            return biggamepad.Init(&bools_ref, &ints_ref);
+        }
+        if (config == "mouse") {
+            return mouse.Init(&bools_ref, &ints_ref, true);
+        }
+        if (config == "keyboard") {
+            return keyboard.Init(&bools_ref);
+        }
+        if (config == "mmkeyboard") {
+            return mmkeyboard.Init(&bools_ref, &bools2_ref);
+        }
+        return nullptr;
+    }
+};
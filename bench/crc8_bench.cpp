@@ -0,0 +1,45 @@
+// CRC-8 の表引き (crc8.h) と元の1ビットずつの実装 (tests/crc8_reference.h) の比較
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で crc8_bench (256 バイトの表) と
+// crc8_nibble_bench (CRC8_USE_NIBBLE_TABLE=1、16 バイトの表) としてビルドされる
+//
+// データ長ごとに1行、1回あたりの時間と1バイトあたりの時間を出力する
+//   9 バイト: 状態のデータ (GAMEPAD_STATE_SIZE)、15 バイト: 拡張キーフレームのデータ、
+//   32 バイト: 最大のフレームのデータ (ヘッダ付きのエッジフレーム)
+#include <stdio.h>
+#include <stdint.h>
+#include <random>
+#include <vector>
+#include "crc8.h"
+#include "crc8_reference.h"
+#include "bench.h"
+
+
+const int REPEATS = 5;
+const int TOTAL_BYTES = 50000000; // データ長ごとに計算するバイト数
+
+
+int main() {
+    printf("CRC8_USE_NIBBLE_TABLE=%d table_bytes=%zu\n", CRC8_USE_NIBBLE_TABLE, sizeof(CRC8_TABLE.values));
+    printf("%8s %14s %14s %14s %14s %8s\n", "bytes", "bitwise ns", "table ns", "bitwise ns/B", "table ns/B", "speedup");
+
+    std::mt19937 rng(1);
+    for (size_t len : { 1, 9, 15, 32, 64, 256, 4096 }) {
+        std::vector<uint8_t> data(len);
+        for (uint8_t &byte : data) {
+            byte = (uint8_t)rng();
+        }
+        int iterations = TOTAL_BYTES / (int)len;
+
+        double bitwise_ns = measure_min_ns(REPEATS, iterations, [&](int i) {
+            data[0] = (uint8_t)i; // 入力を毎回変える
+            keep(reference_crc8(data.data(), len));
+        });
+        double table_ns = measure_min_ns(REPEATS, iterations, [&](int i) {
+            data[0] = (uint8_t)i;
+            keep(crc8(data.data(), len));
+        });
+        printf("%8zu %14.1f %14.1f %14.3f %14.3f %7.1fx\n",
+            len, bitwise_ns, table_ns, bitwise_ns / len, table_ns / len, bitwise_ns / table_ns);
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+// レポートディスクリプタのコーパスを使ったパーサのホスト用ベンチマーク
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で descriptor_bench としてビルドされる
+//
+//   descriptor_bench [コーパスのディレクトリ]
+//
+// ディレクトリ中の *.txt を名前順に読み、デバイスごとに JSON を1行出力する
+//   descriptor_parse_ns          DescriptorParser::Parse (何もしない EventHandler) の時間
+//   init_heap_ns                 SelectiveInputReportParser::Init (ヒープ) の時間
+//   init_heap_allocations        その間の operator new の回数
+//   init_heap_alloc_bytes        その間に確保したバイト数の合計
+//   init_heap_peak_bytes         GetMemoryUsage().peak (ヒープ)
+//   init_arena_ns                Init (ファームウェアと同じ 16KB のアリーナ) の時間
+//   init_arena_peak_bytes        GetMemoryUsage().peak (アリーナ、必要なアリーナの大きさ)
+//   steady_bytes                 GetMemoryUsage().steady (Init 後も持ち続ける抽出プログラム)
+//   lazy_steady_bytes            Init(lazy=true) の steady (Decode の索引と ParseLazy のレポートのコピーを含む)
+//   parse_ns_per_report          Parse の1レポートあたりの時間 (コーパスのレポートを順に繰り返す)
+//   parse_changes_ns_per_report  ParseChanges の1レポートあたりの時間
+//   zones                        -DHRP_PROFILE_ZONES=ON のときだけ。パーサのゾーンごとの呼び出し回数と
+//                                1回あたりの時間 (上の測定すべての合計。ゾーンの計測の分だけ上の時間も増える)
+//
+// コーパスのファイルの書式は bench/corpus.h を参照
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <filesystem>
+#include <vector>
+#include "hid_report_parser.h"
+#include "alloc_counter.h"
+#include "bench.h"
+#include "corpus.h"
+
+
+const int DESCRIPTOR_PARSE_ITERATIONS = 200000;
+const int INIT_ITERATIONS = 5000;
+const int REPORT_ITERATIONS = 2000000;
+const size_t PARSER_ARENA_SIZE = 16 * 1024; // main.cpp と同じ
+
+
+// フィールドの数を数えるだけの EventHandler
+struct FieldCounter : public hid::DescriptorParser::EventHandler {
+    int fields = 0;
+
+protected:
+    int Field(const hid::DescriptorParser::FieldParams &) override {
+        fields++;
+        return 0;
+    }
+};
+
+
+static bool run(const CorpusEntry &entry) {
+    CorpusTargets<> targets;
+    hid::Collection *root = targets.root(entry.config);
+    if (root == nullptr) {
+        fprintf(stderr, "Error: %s: unknown config '%s'\n", entry.name.c_str(), entry.config.c_str());
+        return false;
+    }
+    const uint8_t *desc = entry.descriptor.data();
+    size_t desc_len = entry.descriptor.size();
+
+#if HRP_PROFILE_ZONES_ENABLED
+    hid::ResetProfileZones();
+#endif
+
+    hid::DescriptorParser descriptor_parser;
+    FieldCounter counter;
+    int result = descriptor_parser.Parse(desc, desc_len, &counter);
+    if (result != hid::ERR_SUCCESS) {
+        fprintf(stderr, "Error: %s: DescriptorParser::Parse returned %d\n", entry.name.c_str(), result);
+        return false;
+    }
+    hid::DescriptorParser::EventHandler null_handler;
+    double descriptor_parse_ns = measure_ns(DESCRIPTOR_PARSE_ITERATIONS, [&](int) {
+        keep(descriptor_parser.Parse(desc, desc_len, &null_handler));
+    });
+
+    hid::SelectiveInputReportParser parser;
+
+    // ヒープ: 1回目で確保の回数を数え、残りで時間を測る
+    alloc_counter_start();
+    result = parser.Init(root, desc, desc_len);
+    AllocStats alloc = alloc_counter_stop();
+    if (result != hid::ERR_SUCCESS) {
+        fprintf(stderr, "Error: %s: Init returned %d\n", entry.name.c_str(), result);
+        return false;
+    }
+    size_t heap_peak = parser.GetMemoryUsage().peak;
+    double init_heap_ns = measure_ns(INIT_ITERATIONS, [&](int) {
+        keep(parser.Init(root, desc, desc_len));
+    });
+
+    static hid::StaticArena<PARSER_ARENA_SIZE> arena;
+    double init_arena_ns = measure_ns(INIT_ITERATIONS, [&](int) {
+        keep(parser.Init(root, desc, desc_len, &arena));
+    });
+    result = parser.Init(root, desc, desc_len, &arena);
+    if (result != hid::ERR_SUCCESS) {
+        fprintf(stderr, "Error: %s: Init with arena returned %d\n", entry.name.c_str(), result);
+        return false;
+    }
+    hid::SelectiveInputReportParser::MemoryUsage usage = parser.GetMemoryUsage();
+    hid::SelectiveInputReportParser lazy_parser;
+    keep(lazy_parser.Init(root, desc, desc_len, nullptr, true));
+    size_t lazy_steady = lazy_parser.GetMemoryUsage().steady;
+
+    const std::vector<std::vector<uint8_t>> &reports = entry.reports;
+    int accepted = 0;
+    for (const std::vector<uint8_t> &report : reports) {
+        if (parser.Parse(report.data(), report.size()) == hid::ERR_SUCCESS) {
+            accepted++;
+        }
+    }
+    double parse_ns = measure_ns(REPORT_ITERATIONS, [&](int i) {
+        const std::vector<uint8_t> &report = reports[i % reports.size()];
+        keep(parser.Parse(report.data(), report.size()));
+    });
+    double parse_changes_ns = measure_ns(REPORT_ITERATIONS, [&](int i) {
+        const std::vector<uint8_t> &report = reports[i % reports.size()];
+        keep(parser.ParseChanges(report.data(), report.size()));
+    });
+
+    printf(
+        "{\"device\":\"%s\",\"config\":\"%s\",\"descriptor_bytes\":%zu,\"fields\":%d,"
+        "\"descriptor_parse_ns\":%.1f,"
+        "\"init_heap_ns\":%.1f,\"init_heap_allocations\":%zu,\"init_heap_alloc_bytes\":%zu,\"init_heap_peak_bytes\":%zu,"
+        "\"init_arena_ns\":%.1f,\"init_arena_peak_bytes\":%zu,\"steady_bytes\":%zu,\"lazy_steady_bytes\":%zu,"
+        "\"reports\":%zu,\"reports_accepted\":%d,"
+        "\"parse_ns_per_report\":%.1f,\"parse_changes_ns_per_report\":%.1f",
+        entry.name.c_str(), entry.config.c_str(), desc_len, counter.fields,
+        descriptor_parse_ns,
+        init_heap_ns, alloc.allocations, alloc.bytes, heap_peak,
+        init_arena_ns, usage.peak, usage.steady, lazy_steady,
+        reports.size(), accepted,
+        parse_ns, parse_changes_ns
+    );
+#if HRP_PROFILE_ZONES_ENABLED
+    printf(",\"zones\":{");
+    for (size_t i = 0; i < (size_t)hid::ProfileZone::count; i++) {
+        const hid::ProfileZoneStats &stats = hid::GetProfileZoneStats((hid::ProfileZone)i);
+        printf(
+            "%s\"%s\":{\"calls\":%u,\"ns_per_call\":%.1f}", i == 0 ? "" : ",",
+            hid::GetProfileZoneName((hid::ProfileZone)i), stats.calls,
+            stats.calls == 0 ? 0.0 : (double)stats.total_ns / stats.calls
+        );
+    }
+    printf("}");
+#endif
+    printf("}\n");
+    return true;
+}
+
+
+int main(int argc, char **argv) {
+    std::filesystem::path dir = argc > 1 ? argv[1] : DESCRIPTOR_CORPUS_DIR;
+
+    std::vector<CorpusEntry> entries;
+    if (!load_corpus(dir, entries)) {
+        return 1;
+    }
+
+    bool ok = true;
+    for (const CorpusEntry &entry : entries) {
+        ok = run(entry) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+// ベンチマーク用のレポートディスクリプタを組み立てる
+// (コーパスにない大きさや並びのフィールドを1つずつ変えて測るため)
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+
+struct DescriptorBuilder {
+    std::vector<uint8_t> bytes;
+
+    // short item。prefix は tag と type (サイズのビットは 0)、値は符号なしで一番短いサイズにする
+    DescriptorBuilder &item(uint8_t prefix, uint32_t value) {
+        int size = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : 4;
+        return put(prefix, value, size);
+    }
+
+    // LOGICAL_MINIMUM などの符号付きの値
+    DescriptorBuilder &signed_item(uint8_t prefix, int32_t value) {
+        int size = value >= -0x80 && value <= 0x7F ? 1 : value >= -0x8000 && value <= 0x7FFF ? 2 : 4;
+        return put(prefix, (uint32_t)value, size);
+    }
+
+    DescriptorBuilder &usage_page(uint16_t page) { return item(0x04, page); }
+    DescriptorBuilder &usage(uint16_t usage) { return item(0x08, usage); }
+    DescriptorBuilder &usage_range(uint16_t min, uint16_t max) { return item(0x18, min).item(0x28, max); }
+    DescriptorBuilder &logical_range(int32_t min, int32_t max) { return signed_item(0x14, min).signed_item(0x24, max); }
+    DescriptorBuilder &report_size(uint32_t bits) { return item(0x74, bits); }
+    DescriptorBuilder &report_count(uint32_t count) { return item(0x94, count); }
+    DescriptorBuilder &input(uint32_t flags) { return item(0x80, flags); }
+    DescriptorBuilder &collection(uint8_t type) { return item(0xA0, type); }
+    DescriptorBuilder &end_collection() { bytes.push_back(0xC0); return *this; }
+
+    // 使わないビット (Input Constant)
+    DescriptorBuilder &padding(uint32_t bits) {
+        return bits == 0 ? *this : report_size(1).report_count(bits).input(0x01);
+    }
+
+private:
+    DescriptorBuilder &put(uint8_t prefix, uint32_t value, int size) {
+        bytes.push_back(prefix | (size == 4 ? 3 : size));
+        for (int i = 0; i < size; i++) {
+            bytes.push_back((uint8_t)(value >> (i * 8)));
+        }
+        return *this;
+    }
+};
@@ -0,0 +1,98 @@
+// Doorbell の通知から待っている側が起きるまでの時間 (HostDoorbell、ホストのスレッド間)
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で doorbell_bench としてビルドされる
+//
+// 通知する側のスレッドが 200-1000µs のランダムな間隔で ring() し、待つ側のスレッドが
+// wait_until() から戻るまでの時間を集める。比較のため、Doorbell を使わずに一定間隔で
+// フラグを見に行く場合 (core1 が UART_MIN_FRAME_GAP_US ごとに見に行くのと同じ 1000µs) も測る
+//   doorbell  ring() から wait_until() が戻るまで
+//   poll      フラグを立ててから、1000µs ごとに見に行く側が気付くまで
+// 結果はホストのスレッドの切り替えの遅れそのもの (RP2040 の FIFO + WFE ならずっと短い) で、
+// 比べられるのは「待っている側が通知ですぐ起きるか、次の見回りまで待つか」の違い
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include "doorbell_host.h"
+#include "bench.h"
+
+
+const int SAMPLES = 2000;
+const uint32_t MIN_INTERVAL_US = 200;
+const uint32_t MAX_INTERVAL_US = 1000;
+const uint32_t POLL_INTERVAL_US = 1000;
+
+
+static void print_result(const char *name, std::vector<uint64_t> &samples) {
+    uint64_t p50 = percentile(samples, 0.50);
+    uint64_t p90 = percentile(samples, 0.90);
+    uint64_t p99 = percentile(samples, 0.99);
+    uint64_t max = percentile(samples, 1.0);
+    printf("%-10s n=%zu p50=%llu p90=%llu p99=%llu max=%llu (us)\n", name, samples.size(),
+        (unsigned long long)p50, (unsigned long long)p90, (unsigned long long)p99, (unsigned long long)max);
+}
+
+
+// 通知する側: ランダムな間隔で signal() を SAMPLES 回呼ぶ
+// 待つ側が気付く前に次の通知が来ると、通知は1回にまとまる (サンプルはその分少なくなる)
+template <class SIGNAL>
+static void ring_randomly(std::atomic<uint64_t> &ring_us, std::atomic<bool> &done, SIGNAL signal) {
+    std::mt19937 rng(1);
+    for (int i = 0; i < SAMPLES; i++) {
+        uint32_t interval_us = MIN_INTERVAL_US + rng() % (MAX_INTERVAL_US - MIN_INTERVAL_US);
+        std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+        ring_us.store(HostDoorbell::host_time_us());
+        signal();
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(MAX_INTERVAL_US * 2));
+    done.store(true);
+}
+
+
+static std::vector<uint64_t> measure_doorbell() {
+    HostDoorbell doorbell;
+    std::atomic<uint64_t> ring_us { 0 };
+    std::atomic<bool> done { false };
+    std::vector<uint64_t> samples;
+    std::thread ringer([&] { ring_randomly(ring_us, done, [&] { doorbell.ring(); }); });
+
+    while (!done.load()) {
+        if (doorbell.wait_until(HostDoorbell::host_time_us() + MAX_INTERVAL_US * 2)) {
+            samples.push_back(HostDoorbell::host_time_us() - ring_us.load());
+        }
+    }
+    ringer.join();
+    return samples;
+}
+
+
+static std::vector<uint64_t> measure_poll() {
+    std::atomic<bool> flag { false };
+    std::atomic<uint64_t> ring_us { 0 };
+    std::atomic<bool> done { false };
+    std::vector<uint64_t> samples;
+    std::thread ringer([&] { ring_randomly(ring_us, done, [&] { flag.store(true); }); });
+
+    uint64_t next_us = HostDoorbell::host_time_us();
+    while (!done.load()) {
+        next_us += POLL_INTERVAL_US;
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::microseconds(next_us)));
+        if (flag.exchange(false)) {
+            samples.push_back(HostDoorbell::host_time_us() - ring_us.load());
+        }
+    }
+    ringer.join();
+    return samples;
+}
+
+
+int main() {
+    printf("ring interval %u-%u us, poll interval %u us\n", MIN_INTERVAL_US, MAX_INTERVAL_US, POLL_INTERVAL_US);
+    std::vector<uint64_t> doorbell = measure_doorbell();
+    print_result("doorbell", doorbell);
+    std::vector<uint64_t> poll = measure_poll();
+    print_result("poll", poll);
+    return 0;
+}
@@ -0,0 +1,98 @@
+// フレームのエンコーダのホスト用ベンチマーク
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で frame_codec_bench としてビルドされる
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include "crc8.h"
+#include "sbtp.h"
+#include "cobs.h"
+#include "gamepad_frame.h"
+
+
+const int ITERATIONS = 10000000;
+
+
+// 最適化で消されないように、出力を使ったことにする
+static void keep(const uint8_t *data) {
+    asm volatile("" : : "r"(data) : "memory");
+}
+
+
+template <class FN>
+static void run(const char *name, const uint8_t *data, FN encode) {
+    uint8_t frame[64];
+    uint8_t input[GAMEPAD_STATE_SIZE];
+    memcpy(input, data, GAMEPAD_STATE_SIZE);
+    size_t bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        input[0] = data[0] ^ (i & 1); // 入力を毎回変える
+        bytes += encode(frame, input);
+        keep(frame);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf(
+        "%-24s %8.1f ns/frame %8.2f Mframes/s %8.1f MB/s %6.2f bytes/frame\n",
+        name,
+        seconds / ITERATIONS * 1e9,
+        ITERATIONS / seconds / 1e6,
+        bytes / seconds / 1e6,
+        (double)bytes / ITERATIONS
+    );
+}
+
+
+static void run_all(const char *payload_name, const uint8_t *data) {
+    printf("payload: %s\n", payload_name);
+
+    run("crc8", data, [](uint8_t *frame, const uint8_t *input) {
+        frame[0] = crc8(input, GAMEPAD_STATE_SIZE);
+        return (size_t)GAMEPAD_STATE_SIZE;
+    });
+    run("sbtp", data, [](uint8_t *frame, const uint8_t *input) {
+        return sbtp_encode(frame, input, GAMEPAD_STATE_SIZE);
+    });
+    run("cobs", data, [](uint8_t *frame, const uint8_t *input) {
+        return cobs_encode(frame, input, GAMEPAD_STATE_SIZE);
+    });
+
+    static GamepadFrameEncoder delta_encoder(32);
+    run("sbtp delta", data, [](uint8_t *frame, const uint8_t *input) {
+        return delta_encoder.encode<SbtpEncoder>(frame, input, false);
+    });
+
+    static GamepadFrameHeader header = { 0, 0 };
+    static GamepadFrameEncoder extended_encoder(1);
+    run("sbtp extended", data, [](uint8_t *frame, const uint8_t *input) {
+        header.sequence++;
+        header.timestamp_us += 1000;
+        return extended_encoder.encode<SbtpEncoder>(frame, input, false, &header);
+    });
+}
+
+
+int main() {
+    printf("CRC8_USE_NIBBLE_TABLE=%d iterations=%d\n", CRC8_USE_NIBBLE_TABLE, ITERATIONS);
+
+    std::mt19937 random(1);
+    uint8_t data[GAMEPAD_STATE_SIZE];
+    for (uint8_t i = 0; i < GAMEPAD_STATE_SIZE; i++) {
+        data[i] = random();
+    }
+    run_all("random", data);
+
+    // SBTP では全バイトがエスケープされる
+    memset(data, SBTP_HEADER_BYTE, sizeof(data));
+    run_all("all 0x55", data);
+
+    // COBS ではすべてのバイトがブロックの区切りになる
+    memset(data, 0, sizeof(data));
+    run_all("all 0x00", data);
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+// USB レポートのトレース (sim/traces) を使った、フレームの大きさの比較
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で frame_size_bench としてビルドされる
+//
+//   frame_size_bench [トレースのディレクトリ]
+//
+// トレースのレポートをファームウェアと同じように解析して状態 (GAMEPAD_STATE_SIZE バイト) にし、
+// 変化があった状態ごとに1フレーム送るとしたときの1フレームあたりのバイト数 (フレーム全体) を
+// エンコードの方法ごとに比べる。トレースごとに JSON を1行出力する
+//   full            キーフレームだけ (ファームウェアの既定)
+//   delta           差分フレーム (キーフレームの間隔は main.cpp の UART_KEYFRAME_INTERVAL と同じ 32)
+//   extended        拡張フレーム (ヘッダ付き) のキーフレームだけ
+//   extended_delta  拡張フレームの差分フレーム
+// それぞれ SBTP と COBS で数え、ratio は full (同じフレーミング) に対する大きさ
+// 送ったフレームは受信側の参考実装 (GamepadFrameDecoder) で元の状態に戻るかも確かめる
+//
+// 実際のファームウェアは最小間隔より速い変化をまとめ、変化がなくてもキープアライブを送るので、
+// 送るフレームの数と中身はこれと同じではない。また sim/traces のトレースは実機で録ったものではなく
+// 合成したものなので、結果は実際のゲームパッドの入力の変化の仕方を表していない
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "hid_report_parser.h"
+#include "sbtp.h"
+#include "cobs.h"
+#include "gamepad_frame.h"
+#include "sim.h"
+
+
+const uint8_t KEYFRAME_INTERVAL = 32; // main.cpp の UART_KEYFRAME_INTERVAL
+const uint8_t HAT_UP = 0; // main.cpp の DPAD_UP など (時計回り)
+const uint8_t HAT_UP_LEFT = 7;
+
+
+// main.cpp の tuh_hid_report_received_cb() と core1_main() と同じ並びで状態を作る
+struct GamepadStateMapper {
+    hid::SelectiveInputReportParser parser;
+    hid::GamepadConfig config;
+    hid::BitField<hid::GamepadConfig::NUM_BUTTONS> buttons {};
+    hid::Int32Array<hid::GamepadConfig::NUM_AXES> axes {};
+    decltype(buttons.Ref()) buttons_ref = buttons.Ref();
+    decltype(axes.Ref()) axes_ref = axes.Ref();
+
+    int init(const std::vector<uint8_t> &descriptor) {
+        return parser.Init(config.Init(&buttons_ref, &axes_ref), descriptor.data(), descriptor.size());
+    }
+
+    // 変化がなければ false
+    bool parse(const std::vector<uint8_t> &report, uint8_t *state) {
+        if (parser.ParseChanges(report.data(), report.size()) != hid::ERR_SUCCESS) {
+            return false;
+        }
+        uint32_t raw_buttons = buttons.Flags<uint32_t>(0);
+        uint8_t hat = axes[hid::GamepadConfig::HAT_SWITCH];
+        uint8_t dpad = 0;
+        if (hat <= HAT_UP_LEFT) {
+            bool up = hat == HAT_UP || hat == 1 || hat == 7;
+            bool down = hat >= 3 && hat <= 5;
+            bool left = hat >= 5 && hat <= 7;
+            bool right = hat >= 1 && hat <= 3;
+            dpad = (up ? 0b0001 : 0) | (down ? 0b0010 : 0) | (left ? 0b0100 : 0) | (right ? 0b1000 : 0);
+        }
+        state[0] = (uint8_t)(axes[hid::GamepadConfig::X] - 128);
+        state[1] = (uint8_t)(axes[hid::GamepadConfig::Y] - 128);
+        state[2] = (uint8_t)(axes[hid::GamepadConfig::Z] - 128);
+        state[3] = (uint8_t)(axes[hid::GamepadConfig::RZ] - 128);
+        state[4] = (raw_buttons & 0xFF00) >> 8;
+        state[5] = raw_buttons & 0x00FF;
+        state[6] = (uint8_t)axes[hid::GamepadConfig::RX];
+        state[7] = (uint8_t)axes[hid::GamepadConfig::RY];
+        state[8] = dpad;
+        return true;
+    }
+};
+
+
+// 1つのエンコードの方法で全部の状態を送ったときの合計
+struct EncodingTotal {
+    const char *name;
+    uint8_t keyframe_interval;
+    bool extended;
+    size_t sbtp_bytes = 0;
+    size_t cobs_bytes = 0;
+    size_t frames = 0;
+    size_t decode_errors = 0;
+    GamepadFrameEncoder sbtp_encoder;
+    GamepadFrameEncoder cobs_encoder;
+    GamepadFrameDecoder decoder;
+    SbtpDecoder sbtp_decoder;
+
+    EncodingTotal(const char *name, uint8_t keyframe_interval, bool extended)
+        : name(name), keyframe_interval(keyframe_interval), extended(extended),
+          sbtp_encoder(keyframe_interval), cobs_encoder(keyframe_interval), decoder(extended) {}
+
+    void add(const uint8_t *state, const GamepadFrameHeader &header) {
+        const GamepadFrameHeader *h = extended ? &header : nullptr;
+        uint8_t frame[sbtp_max_frame_size(GAMEPAD_MAX_FRAME_DATA_SIZE)];
+        size_t sbtp_len = sbtp_encoder.encode<SbtpEncoder>(frame, state, false, h);
+        sbtp_bytes += sbtp_len;
+
+        // SBTP のフレームを受信側と同じように戻す
+        bool restored = false;
+        for (size_t i = 0; i < sbtp_len; i++) {
+            if (sbtp_decoder.put(frame[i]) == SBTP_DECODE_FRAME) {
+                restored = decoder.apply(sbtp_decoder.data, sbtp_decoder.data_len)
+                    && memcmp(decoder.state, state, GAMEPAD_STATE_SIZE) == 0;
+            }
+        }
+        if (!restored) {
+            decode_errors++;
+        }
+
+        uint8_t cobs_frame[cobs_max_frame_size(GAMEPAD_MAX_FRAME_DATA_SIZE)];
+        cobs_bytes += cobs_encoder.encode<CobsEncoder>(cobs_frame, state, false, h);
+        frames++;
+    }
+};
+
+
+static bool run(const std::filesystem::path &path) {
+    SimTrace trace;
+    if (!sim_load_trace(path.c_str(), trace)) {
+        return false;
+    }
+    std::string name = path.stem().string();
+
+    GamepadStateMapper mapper;
+    int result = mapper.init(trace.descriptor);
+    if (result != hid::ERR_SUCCESS) {
+        fprintf(stderr, "Error: %s: Init returned %d (PS3 traces are not supported)\n", name.c_str(), result);
+        return false;
+    }
+
+    std::vector<EncodingTotal> totals;
+    totals.emplace_back("full", 1, false);
+    totals.emplace_back("delta", KEYFRAME_INTERVAL, false);
+    totals.emplace_back("extended", 1, true);
+    totals.emplace_back("extended_delta", KEYFRAME_INTERVAL, true);
+
+    size_t reports = 0;
+    GamepadFrameHeader header = { 0, 0 };
+    for (const SimTraceEvent &event : trace.events) {
+        if (event.kind != SimTraceEvent::REPORT) {
+            continue;
+        }
+        reports++;
+        uint8_t state[GAMEPAD_STATE_SIZE];
+        if (!mapper.parse(event.report, state)) {
+            continue;
+        }
+        header.timestamp_us = (uint32_t)event.time_us;
+        for (EncodingTotal &total : totals) {
+            total.add(state, header);
+        }
+        header.sequence++;
+    }
+
+    const EncodingTotal &full = totals[0];
+    bool ok = true;
+    printf("{\"trace\":\"%s\",\"reports\":%zu,\"frames\":%zu", name.c_str(), reports, full.frames);
+    for (const EncodingTotal &total : totals) {
+        double frames = std::max<size_t>(total.frames, 1);
+        printf(
+            ",\"%s\":{\"sbtp_bytes_per_frame\":%.2f,\"sbtp_ratio\":%.3f,"
+            "\"cobs_bytes_per_frame\":%.2f,\"cobs_ratio\":%.3f,\"decode_errors\":%zu}",
+            total.name,
+            total.sbtp_bytes / frames, (double)total.sbtp_bytes / std::max<size_t>(full.sbtp_bytes, 1),
+            total.cobs_bytes / frames, (double)total.cobs_bytes / std::max<size_t>(full.cobs_bytes, 1),
+            total.decode_errors
+        );
+        ok = ok && total.decode_errors == 0;
+    }
+    printf("}\n");
+    return ok;
+}
+
+
+int main(int argc, char **argv) {
+    std::filesystem::path dir = argc > 1 ? argv[1] : SIM_TRACE_DIR;
+
+    std::vector<std::filesystem::path> paths;
+    std::error_code error;
+    for (const auto &file : std::filesystem::directory_iterator(dir, error)) {
+        if (file.path().extension() == ".txt") {
+            paths.push_back(file.path());
+        }
+    }
+    if (error || paths.empty()) {
+        fprintf(stderr, "Error: no traces in %s\n", dir.c_str());
+        return 1;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    bool ok = true;
+    for (const std::filesystem::path &path : paths) {
+        ok = run(path) && ok;
+    }
+    return ok ? 0 : 1;
+}
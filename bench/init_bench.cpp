@@ -0,0 +1,164 @@
+// SelectiveInputReportParser::Init の時間とヒープの使い方: ベースライン (tests/baseline) と今のパーサを比べる
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で init_bench としてビルドされる
+//
+//   init_bench [コーパスのディレクトリ]
+//
+// bench/corpus のデバイスと、ここで組み立てる大きなディスクリプタ2つを、マッピングできる設定
+// すべてで Init し、デバイスと設定の組ごとに JSON を1行出力する
+//   baseline_ns / baseline_allocations / baseline_peak_bytes
+//       ベースラインの Init の時間、operator new の回数、使用中のヒープの増え方の最大
+//       (ベースラインは設定の UsageRange を usage 1つずつに展開してマップに入れる)
+//   heap_ns / heap_allocations / heap_peak_bytes
+//       今のパーサのアリーナなしの Init の同じ値
+//   arena_ns / arena_heap_allocations / arena_peak_bytes
+//       ファームウェアと同じ 16KB のアリーナを渡した Init の時間、その間の operator new の回数、
+//       GetMemoryUsage().peak (必要なアリーナの大きさ)
+//       ファームウェアと同じように、設定は先に PrepareConfig で mapped / properties のベクタを確保しておく
+//   steady_bytes  GetMemoryUsage().steady (Init 後も持ち続ける抽出プログラム)
+// ヒープの値はどちらも1回目の Init (新しいパーサのオブジェクト) のもので、
+// baseline と heap は設定の mapped / properties のベクタの確保も含む。時間はホストのもの
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "hid_report_parser.h"
+#include "alloc_counter.h"
+#include "bench.h"
+#include "corpus.h"
+#include "descriptor_builder.h"
+#include "baseline_hid.h"
+
+
+const int REPEATS = 3;
+const int ITERATIONS = 2000;
+const size_t PARSER_ARENA_SIZE = 16 * 1024; // main.cpp と同じ
+
+static const char *const CONFIGS[] = { "gamepad", "biggamepad", "mouse", "keyboard", "mmkeyboard" };
+
+
+// キーボードの usage すべてのビットマップ (0x00-0xFF) と、
+// 10ビットの consumer control の配列 (0x000-0x3FF) を持つキーボード
+static CorpusEntry full_keyboard() {
+    DescriptorBuilder d;
+    d.usage_page(hid::PAGE_GENERIC_DESKTOP).usage(hid::USAGE_KEYBOARD).collection(hid::COLLECTION_TYPE_APPLICATION)
+        .item(0x84, 1) // REPORT_ID
+        .usage_page(hid::PAGE_KEYBOARD).usage_range(0x00, 0xFF).logical_range(0, 1)
+        .report_size(1).report_count(0x100).input(0x02)
+        .end_collection();
+    d.usage_page(hid::PAGE_CONSUMER).usage(hid::USAGE_CONSUMER_CONTROL).collection(hid::COLLECTION_TYPE_APPLICATION)
+        .item(0x84, 2)
+        .usage_range(0x000, 0x3FF).logical_range(0, 0x3FF)
+        .report_size(10).report_count(4).input(0x00)
+        .end_collection();
+    return { "full_keyboard", "mmkeyboard", d.bytes, {} };
+}
+
+
+// ボタン 64 個と、軸ごとに別の Input の 16 ビットの軸 18 個
+static CorpusEntry big_gamepad() {
+    DescriptorBuilder d;
+    d.usage_page(hid::PAGE_GENERIC_DESKTOP).usage(hid::USAGE_GAMEPAD).collection(hid::COLLECTION_TYPE_APPLICATION)
+        .usage_page(hid::PAGE_BUTTON).usage_range(1, 64).logical_range(0, 1)
+        .report_size(1).report_count(64).input(0x02)
+        .usage_page(hid::PAGE_GENERIC_DESKTOP).logical_range(-32768, 32767).report_size(16).report_count(1);
+    for (int i = 0; i < 2; i++) {
+        for (uint16_t usage = hid::USAGE_X; usage <= hid::USAGE_WHEEL; usage++) {
+            d.usage(usage).input(0x02);
+        }
+    }
+    d.end_collection();
+    return { "big_gamepad", "biggamepad", d.bytes, {} };
+}
+
+
+static void run(const CorpusEntry &entry, const char *config) {
+    const uint8_t *desc = entry.descriptor.data();
+    size_t desc_len = entry.descriptor.size();
+
+    // 1回目: ヒープの使い方を数える
+    AllocStats base_alloc;
+    {
+        CorpusTargets<BaselineHid> targets;
+        BaselineHid::Parser parser;
+        alloc_counter_start();
+        int result = parser.Init(targets.root(config), desc, desc_len);
+        base_alloc = alloc_counter_stop();
+        if (result != hid_baseline::ERR_SUCCESS) {
+            return;
+        }
+    }
+    AllocStats heap_alloc;
+    hid::SelectiveInputReportParser::MemoryUsage heap_usage;
+    {
+        CorpusTargets<> targets;
+        hid::SelectiveInputReportParser parser;
+        alloc_counter_start();
+        int result = parser.Init(targets.root(config), desc, desc_len);
+        heap_alloc = alloc_counter_stop();
+        if (result != hid::ERR_SUCCESS) {
+            fprintf(stderr, "Error: %s/%s: Init returned %d, baseline succeeded\n", entry.name.c_str(), config, result);
+            return;
+        }
+        heap_usage = parser.GetMemoryUsage();
+    }
+    static hid::StaticArena<PARSER_ARENA_SIZE> arena;
+    AllocStats arena_alloc;
+    hid::SelectiveInputReportParser::MemoryUsage arena_usage;
+    int arena_result;
+    {
+        CorpusTargets<> targets;
+        hid::SelectiveInputReportParser parser;
+        hid::SelectiveInputReportParser::PrepareConfig(targets.root(config));
+        alloc_counter_start();
+        arena_result = parser.Init(targets.root(config), desc, desc_len, &arena);
+        arena_alloc = alloc_counter_stop();
+        arena_usage = parser.GetMemoryUsage();
+    }
+
+    // 時間
+    CorpusTargets<BaselineHid> base_targets;
+    BaselineHid::Parser base_parser;
+    hid_baseline::Collection *base_root = base_targets.root(config);
+    double baseline_ns = measure_min_ns(REPEATS, ITERATIONS, [&](int) {
+        keep(base_parser.Init(base_root, desc, desc_len));
+    });
+    CorpusTargets<> targets;
+    hid::SelectiveInputReportParser parser;
+    hid::Collection *root = targets.root(config);
+    double heap_ns = measure_min_ns(REPEATS, ITERATIONS, [&](int) {
+        keep(parser.Init(root, desc, desc_len));
+    });
+    double arena_ns = measure_min_ns(REPEATS, ITERATIONS, [&](int) {
+        keep(parser.Init(root, desc, desc_len, &arena));
+    });
+
+    printf(
+        "{\"device\":\"%s\",\"config\":\"%s\",\"descriptor_bytes\":%zu,"
+        "\"baseline_ns\":%.0f,\"baseline_allocations\":%zu,\"baseline_peak_bytes\":%zu,"
+        "\"heap_ns\":%.0f,\"heap_allocations\":%zu,\"heap_peak_bytes\":%zu,"
+        "\"arena_result\":%d,\"arena_ns\":%.0f,\"arena_heap_allocations\":%zu,\"arena_peak_bytes\":%zu,"
+        "\"steady_bytes\":%zu}\n",
+        entry.name.c_str(), config, desc_len,
+        baseline_ns, base_alloc.allocations, base_alloc.peak_bytes,
+        heap_ns, heap_alloc.allocations, heap_alloc.peak_bytes,
+        arena_result, arena_ns, arena_alloc.allocations, arena_usage.peak,
+        heap_usage.steady
+    );
+}
+
+
+int main(int argc, char **argv) {
+    std::vector<CorpusEntry> entries;
+    if (!load_corpus(argc > 1 ? argv[1] : DESCRIPTOR_CORPUS_DIR, entries)) {
+        return 1;
+    }
+    entries.push_back(full_keyboard());
+    entries.push_back(big_gamepad());
+
+    for (const CorpusEntry &entry : entries) {
+        for (const char *config : CONFIGS) {
+            run(entry, config);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+// レポートごとの Parse の時間: ベースライン (tests/baseline、ReportMapper のマップを
+// レポートのたびにたどるパーサ) と今のパーサ (Init で作った抽出プログラムを実行する) を比べる
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で parse_bench としてビルドされる
+//
+//   parse_bench [コーパスのディレクトリ]
+//
+// bench/corpus のデバイスごとに、コーパスに書かれた設定でマッピングし、コーパスのレポート1つごとに
+// JSON を1行出力する
+//   baseline_ns  ベースラインの Parse の1回あたりの時間
+//   compiled_ns  今のパーサの Parse の1回あたりの時間
+//   speedup      baseline_ns / compiled_ns
+//   lazy_all_ns  ParseLazy と、マッピングされた変数すべての Decode の時間
+//   lazy_one_ns  ParseLazy と、最初にマッピングされた変数1つだけの Decode の時間
+// 同じレポートを繰り返し与えるので、分岐予測とキャッシュが効いた状態の時間になる
+// 時間はホストのもので、RP2040 (Cortex-M0+) での時間ではない
+#include <stdio.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include "hid_report_parser.h"
+#include "bench.h"
+#include "corpus.h"
+#include "baseline_hid.h"
+
+
+const int REPEATS = 5;
+const int ITERATIONS = 200000;
+
+
+static bool run(const CorpusEntry &entry) {
+    CorpusTargets<BaselineHid> base_targets;
+    CorpusTargets<> targets;
+    BaselineHid::Parser base_parser;
+    hid::SelectiveInputReportParser parser;
+
+    const uint8_t *desc = entry.descriptor.data();
+    size_t desc_len = entry.descriptor.size();
+    int base_result = base_parser.Init(base_targets.root(entry.config), desc, desc_len);
+    int result = parser.Init(targets.root(entry.config), desc, desc_len, nullptr, true);
+    if (base_result != hid_baseline::ERR_SUCCESS || result != hid::ERR_SUCCESS) {
+        fprintf(stderr, "Error: %s: Init returned %d (baseline %d)\n", entry.name.c_str(), result, base_result);
+        return false;
+    }
+
+    // マッピングされた変数 (Decode が ERR_INVALID_PARAMETERS を返さないもの)
+    std::vector<std::pair<hid::IInt32Target *, size_t>> mapped_ints;
+    std::vector<std::pair<hid::IBoolTarget *, size_t>> mapped_bools;
+    for (size_t i = 0; i < decltype(targets.ints)::SIZE; i++) {
+        if (parser.Decode(&targets.ints_ref, i) != hid::ERR_INVALID_PARAMETERS) {
+            mapped_ints.push_back({ &targets.ints_ref, i });
+        }
+    }
+    for (hid::IBoolTarget *bools : { (hid::IBoolTarget *)&targets.bools_ref, (hid::IBoolTarget *)&targets.bools2_ref }) {
+        for (size_t i = 0; i < decltype(targets.bools)::BIT_SIZE; i++) {
+            if (parser.Decode(bools, i) != hid::ERR_INVALID_PARAMETERS) {
+                mapped_bools.push_back({ bools, i });
+            }
+        }
+    }
+
+    for (size_t i = 0; i < entry.reports.size(); i++) {
+        const std::vector<uint8_t> &report = entry.reports[i];
+        double baseline_ns = measure_min_ns(REPEATS, ITERATIONS, [&](int) {
+            keep(base_parser.Parse(report.data(), report.size()));
+        });
+        double compiled_ns = measure_min_ns(REPEATS, ITERATIONS, [&](int) {
+            keep(parser.Parse(report.data(), report.size()));
+        });
+        double lazy_all_ns = measure_min_ns(REPEATS, ITERATIONS, [&](int) {
+            keep(parser.ParseLazy(report.data(), report.size()));
+            for (const auto &variable : mapped_ints) {
+                keep(parser.Decode(variable.first, variable.second));
+            }
+            for (const auto &variable : mapped_bools) {
+                keep(parser.Decode(variable.first, variable.second));
+            }
+        });
+        double lazy_one_ns = measure_min_ns(REPEATS, ITERATIONS, [&](int) {
+            keep(parser.ParseLazy(report.data(), report.size()));
+            if (!mapped_ints.empty()) {
+                keep(parser.Decode(mapped_ints[0].first, mapped_ints[0].second));
+            }
+            else {
+                keep(parser.Decode(mapped_bools[0].first, mapped_bools[0].second));
+            }
+        });
+        printf(
+            "{\"device\":\"%s\",\"config\":\"%s\",\"report\":%zu,\"report_bytes\":%zu,\"result\":%d,"
+            "\"baseline_ns\":%.1f,\"compiled_ns\":%.1f,\"speedup\":%.2f,"
+            "\"mapped_variables\":%zu,\"lazy_all_ns\":%.1f,\"lazy_one_ns\":%.1f}\n",
+            entry.name.c_str(), entry.config.c_str(), i, report.size(), parser.Parse(report.data(), report.size()),
+            baseline_ns, compiled_ns, baseline_ns / compiled_ns,
+            mapped_ints.size() + mapped_bools.size(), lazy_all_ns, lazy_one_ns
+        );
+    }
+    return true;
+}
+
+
+int main(int argc, char **argv) {
+    std::vector<CorpusEntry> entries;
+    if (!load_corpus(argc > 1 ? argv[1] : DESCRIPTOR_CORPUS_DIR, entries)) {
+        return 1;
+    }
+
+    bool ok = true;
+    for (const CorpusEntry &entry : entries) {
+        ok = run(entry) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+// UartTxQueue のホスト用ベンチマーク (HostUartTxBackend で送信を模擬する)
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で uart_tx_bench としてビルドされる
+//
+// ファームウェアと同じ UartTxQueue<2, 40> に 13 バイトのフレーム (SBTP の状態フレーム) を積み、
+// 1フレームあたりの時間と 1 秒あたりのフレーム数を出力する
+//   commit+finish   reserve() に書いて commit() し、すぐ送り終える (捨てるものがない場合)
+//   submit+finish   submit() でコピーして積み、すぐ送り終える
+//   burst4          4 フレーム積んでから送り終える (2 スロットなので 2 フレームはポリシーに従って捨てる)
+// HostUartTxBackend は std::mutex でロックし、送られたバイト列を std::vector に記録するので、
+// 割り込みを止めるだけのファームウェアより重い。ポリシーの違いと、ロックと記録の分を除いた
+// キューそのものの時間 (null backend) を比べるためのもの
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "uart_tx.h"
+#include "uart_tx_host.h"
+#include "bench.h"
+
+
+const int REPEATS = 5;
+const int ITERATIONS = 2000000;
+const size_t FRAME_SIZE = 13;
+
+
+// ロックも記録もせず、start() されたらすぐ送り終えたことにできるバックエンド
+class NullUartTxBackend : public UartTxBackend {
+public:
+    void start(const uint8_t *data, size_t) override {
+        keep(data);
+        _busy = true;
+    }
+    uint32_t lock() override { return 0; }
+    void unlock(uint32_t) override {}
+    bool is_busy() const { return _busy; }
+
+    void finish() {
+        if (!_busy) {
+            return;
+        }
+        _busy = false;
+        notify_complete();
+    }
+
+private:
+    bool _busy = false;
+};
+
+
+template <class BACKEND>
+static void run(const char *backend_name, UartTxPolicy policy) {
+    BACKEND backend;
+    UartTxQueue<2, 40> queue(&backend, policy);
+    uint8_t frame[FRAME_SIZE];
+    memset(frame, 0x11, sizeof(frame));
+
+    auto finish_all = [&]() {
+        while (backend.is_busy()) {
+            backend.finish();
+        }
+    };
+    // 記録したバイト列が大きくなりすぎないように、ときどき捨てる
+    auto trim = [&](int i) {
+        if constexpr (std::is_same<BACKEND, HostUartTxBackend>::value) {
+            if ((i & 0xFFF) == 0) {
+                backend.bytes.clear();
+                backend.frame_lens.clear();
+            }
+        }
+    };
+
+    double commit_ns = measure_min_ns(REPEATS, ITERATIONS, [&](int i) {
+        uint8_t *slot = queue.reserve();
+        memcpy(slot, frame, FRAME_SIZE);
+        slot[0] = (uint8_t)i;
+        queue.commit(FRAME_SIZE, i);
+        finish_all();
+        trim(i);
+    });
+    double submit_ns = measure_min_ns(REPEATS, ITERATIONS, [&](int i) {
+        frame[0] = (uint8_t)i;
+        queue.submit(frame, FRAME_SIZE);
+        finish_all();
+        trim(i);
+    });
+    UartTxStats before = queue.stats();
+    double burst_ns = measure_min_ns(REPEATS, ITERATIONS / 4, [&](int i) {
+        for (int j = 0; j < 4; j++) {
+            uint8_t *slot = queue.reserve();
+            memcpy(slot, frame, FRAME_SIZE);
+            queue.commit(FRAME_SIZE, i);
+        }
+        finish_all();
+        trim(i);
+    }) / 4;
+    UartTxStats after = queue.stats();
+
+    printf("%-8s %-12s %12.1f %12.1f %12.1f %10.2f %12.2f\n",
+        backend_name, policy == UART_TX_DROP_OLDEST ? "drop_oldest" : "coalesce",
+        commit_ns, submit_ns, burst_ns,
+        (double)(after.dropped - before.dropped) / (after.committed - before.committed),
+        1e3 / commit_ns);
+}
+
+
+int main() {
+    printf("UartTxQueue<2, 40>, %zu-byte frames, ns/frame\n", FRAME_SIZE);
+    printf("%-8s %-12s %12s %12s %12s %10s %12s\n",
+        "backend", "policy", "commit+fin", "submit+fin", "burst4", "dropped", "Mframes/s");
+    run<HostUartTxBackend>("host", UART_TX_DROP_OLDEST);
+    run<HostUartTxBackend>("host", UART_TX_COALESCE);
+    run<NullUartTxBackend>("null", UART_TX_DROP_OLDEST);
+    run<NullUartTxBackend>("null", UART_TX_COALESCE);
+    return 0;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "crc8.h"
+
+
+// COBS フレーム (SBTP の代わりに使える)
+//   COBS([データ長] [データ...] [CRC-8]) [0x00]
+// COBS で 0x00 を取り除くので、0x00 がフレームの区切りになる
+// 増えるのは 254 バイトごとに 1 バイトだけなので、フレーム長の上限がデータ長だけで決まる
+// CRC はデータ長とデータから計算する
+
+const uint8_t COBS_DELIMITER_BYTE = 0x00;
+
+
+// data_len バイトのデータを送るのに必要な最大フレーム長
+constexpr size_t cobs_max_frame_size(size_t data_len) {
+    return (data_len + 2) + (data_len + 2) / 254 + 1 + 1;
+}
+
+
+// 出力先に直接1パスでフレームを書く (使い方は SbtpEncoder と同じ)
+// 0x00 が来るか 254 バイトたまるたびに、ブロックの先頭のコードバイトを後から埋める
+// out には cobs_max_frame_size(data_len) バイトの空きが必要
+struct CobsEncoder {
+    uint8_t *out;
+    uint8_t *code_byte;
+    uint8_t *cursor;
+    uint8_t code;
+    uint8_t crc;
+
+    CobsEncoder(uint8_t *out, uint8_t data_len)
+        : out(out), code_byte(out), cursor(out + 1), code(1), crc(CRC8_INITIAL_VALUE) {
+        put(data_len);
+    }
+
+    void put(uint8_t byte) {
+        crc = crc8_update(crc, byte);
+        put_raw(byte);
+    }
+
+    // CRC と区切りを書き、フレーム長を返す
+    size_t finish() {
+        put_raw(crc8_final(crc));
+        *code_byte = code;
+        *cursor++ = COBS_DELIMITER_BYTE;
+        return cursor - out;
+    }
+
+private:
+    void put_raw(uint8_t byte) {
+        if (byte != 0) {
+            *cursor++ = byte;
+            code++;
+            if (code != 0xFF) {
+                return;
+            }
+        }
+        *code_byte = code;
+        code_byte = cursor++;
+        code = 1;
+    }
+};
+
+
+static inline size_t cobs_encode(uint8_t *out, const uint8_t *data, uint8_t len) {
+    CobsEncoder encoder(out, len);
+    for (uint8_t i = 0; i < len; i++) {
+        encoder.put(data[i]);
+    }
+    return encoder.finish();
+}
+
+
+const uint8_t COBS_MAX_DATA_SIZE = 32; // CobsDecoder が受け取れる最大データ長
+
+enum CobsDecodeResult {
+    COBS_DECODE_NONE, // フレームの途中
+    COBS_DECODE_FRAME, // data にフレームのデータがそろった
+    COBS_DECODE_ERROR, // 壊れたフレームを捨てた
+};
+
+
+// 受信したバイト列から1バイトずつフレームを取り出す (受信側の参考実装)
+struct CobsDecoder {
+    uint8_t data[COBS_MAX_DATA_SIZE];
+    uint8_t data_len = 0;
+    uint8_t buffer[cobs_max_frame_size(COBS_MAX_DATA_SIZE)];
+    size_t buffer_len = 0;
+    bool overflow = false;
+
+    CobsDecodeResult put(uint8_t byte) {
+        if (byte != COBS_DELIMITER_BYTE) {
+            if (buffer_len < sizeof(buffer)) {
+                buffer[buffer_len] = byte;
+                buffer_len++;
+            }
+            else {
+                overflow = true;
+            }
+            return COBS_DECODE_NONE;
+        }
+
+        bool ok = !overflow && buffer_len > 0 && decode();
+        buffer_len = 0;
+        overflow = false;
+        return ok ? COBS_DECODE_FRAME : COBS_DECODE_ERROR;
+    }
+
+private:
+    // buffer をその場で復元し、データ長と CRC を確かめる
+    bool decode() {
+        size_t read = 0;
+        size_t write = 0;
+        while (read < buffer_len) {
+            uint8_t code = buffer[read];
+            read++;
+            if (read + code - 1 > buffer_len) {
+                return false;
+            }
+            for (uint8_t i = 1; i < code; i++) {
+                buffer[write] = buffer[read];
+                write++;
+                read++;
+            }
+            if (code != 0xFF && read < buffer_len) {
+                buffer[write] = 0;
+                write++;
+            }
+        }
+
+        if (write < 2 || buffer[0] > COBS_MAX_DATA_SIZE || write != (size_t)buffer[0] + 2) {
+            return false;
+        }
+        if (crc8(buffer, write - 1) != buffer[write - 1]) {
+            return false;
+        }
+        data_len = buffer[0];
+        memcpy(data, buffer + 1, data_len);
+        return true;
+    }
+};
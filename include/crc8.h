@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// SBTP の CRC-8 (多項式 0xD5, 初期値 0xFF, 最終 XOR 0xFF, MSB ファースト)
+// 1 バイトずつ crc8_update() に渡せばフレームを書きながら計算できる
+//   uint8_t crc = CRC8_INITIAL_VALUE;
+//   crc = crc8_update(crc, byte); ...
+//   uint8_t result = crc8_final(crc);
+
+// 1 にすると 256 バイトの表の代わりに 16 バイトの表を使う (フラッシュを節約できるが遅くなる)
+#ifndef CRC8_USE_NIBBLE_TABLE
+#define CRC8_USE_NIBBLE_TABLE 0
+#endif
+
+const uint8_t CRC8_GENERATE_POLYNOMIAL = 0xD5;
+const uint8_t CRC8_INITIAL_VALUE = 0xFF;
+const uint8_t CRC8_FINAL_XOR = 0xFF;
+
+
+// crc の上位 bits ビットを1ビットずつ処理する (表の生成用)
+constexpr uint8_t crc8_shift_bits(uint8_t crc, uint8_t bits) {
+    for (uint8_t j = 0; j < bits; j++) {
+        if ((crc & 0x80) != 0) {
+            crc = (crc << 1) ^ CRC8_GENERATE_POLYNOMIAL;
+        }
+        else {
+            crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+
+template <size_t N>
+struct Crc8Table {
+    uint8_t values[N];
+};
+
+
+// values[i] = 上位ビットが i のときに残りに XOR する値
+template <size_t N, uint8_t BITS>
+constexpr Crc8Table<N> crc8_make_table() {
+    Crc8Table<N> table = {};
+    for (size_t i = 0; i < N; i++) {
+        table.values[i] = crc8_shift_bits((uint8_t)(i << (8 - BITS)), BITS);
+    }
+    return table;
+}
+
+
+#if CRC8_USE_NIBBLE_TABLE
+
+inline constexpr Crc8Table<16> CRC8_TABLE = crc8_make_table<16, 4>();
+
+static inline uint8_t crc8_update(uint8_t crc, uint8_t byte) {
+    crc ^= byte;
+    crc = (uint8_t)(crc << 4) ^ CRC8_TABLE.values[crc >> 4];
+    crc = (uint8_t)(crc << 4) ^ CRC8_TABLE.values[crc >> 4];
+    return crc;
+}
+
+#else
+
+inline constexpr Crc8Table<256> CRC8_TABLE = crc8_make_table<256, 8>();
+
+static inline uint8_t crc8_update(uint8_t crc, uint8_t byte) {
+    return CRC8_TABLE.values[crc ^ byte];
+}
+
+#endif
+
+
+static inline uint8_t crc8_update(uint8_t crc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = crc8_update(crc, data[i]);
+    }
+    return crc;
+}
+
+
+static inline uint8_t crc8_final(uint8_t crc) {
+    return crc ^ CRC8_FINAL_XOR;
+}
+
+
+static inline uint8_t crc8(const uint8_t *data, size_t len) {
+    return crc8_final(crc8_update(CRC8_INITIAL_VALUE, data, len));
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+
+// 別のコア (スレッド) に「新しい状態を公開した」と知らせる
+// ring() は知らせる側、wait_until() は待つ側がそれぞれ1つだけ呼ぶ
+// 受け取る前に何度 ring() しても、通知は1回にまとまる
+class Doorbell {
+public:
+    virtual void ring() = 0;
+    // 通知が来るか deadline_us (time_us_64() と同じ時計) になるまで待つ
+    // 通知を受け取ったら true
+    virtual bool wait_until(uint64_t deadline_us) = 0;
+};
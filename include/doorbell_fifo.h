@@ -0,0 +1,37 @@
+#pragma once
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "doorbell.h"
+
+
+// SIO の FIFO を使ったコア間の通知
+// 待つ側は FIFO を受け取るか時間になるまで WFE で眠る
+// multicore_lockout など FIFO を使う他の機能とは一緒に使えない
+class FifoDoorbell : public Doorbell {
+public:
+    void ring() override {
+        // FIFO がいっぱいなら相手がまだ受け取っていない通知があるので、積まなくてよい
+        if (multicore_fifo_wready()) {
+            multicore_fifo_push_blocking(RING_VALUE);
+        }
+    }
+
+    bool wait_until(uint64_t deadline_us) override {
+        bool rang = multicore_fifo_rvalid();
+        uint64_t now_us = time_us_64();
+        if (!rang && deadline_us > now_us) {
+            uint32_t value;
+            rang = multicore_fifo_pop_timeout_us(deadline_us - now_us, &value);
+        }
+        // 待っている間にたまった通知はまとめて捨てる
+        if (multicore_fifo_rvalid()) {
+            multicore_fifo_drain();
+            rang = true;
+        }
+        return rang;
+    }
+
+private:
+    static const uint32_t RING_VALUE = 1;
+};
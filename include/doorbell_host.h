@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "doorbell.h"
+
+
+// ホストのスレッド間で Doorbell を動かすための実装
+// 時刻は steady_clock の µs (host_time_us()) で数える
+class HostDoorbell : public Doorbell {
+public:
+    static uint64_t host_time_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void ring() override {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _rang = true;
+        }
+        _condition.notify_one();
+    }
+
+    bool wait_until(uint64_t deadline_us) override {
+        std::chrono::steady_clock::time_point deadline{std::chrono::microseconds(deadline_us)};
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait_until(lock, deadline, [this] { return _rang; });
+        bool rang = _rang;
+        _rang = false;
+        return rang;
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _rang = false;
+};
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+
+// ゲームパッドの状態を送るフレームのデータ部
+//
+// キーフレーム (データ長 9): 全フィールド
+//   [左X] [左Y] [右X] [右Y] [ボタン上位] [ボタン下位] [左トリガー] [右トリガー] [十字キー]
+// 差分フレーム (データ長 1〜8): 前のフレームから変わったフィールドだけ
+//   [変化ビットマップ] [変わったフィールド...]
+//   ビットマップの bit i がフィールド i (ボタンは2バイトで1フィールド)
+// エッジフレーム (データ長 11〜26): ボタンと十字キーの変化を順番に並べたもの
+//   [左X] [左Y] [右X] [右Y] [左トリガー] [右トリガー] [変化...]
+//   変化は1つ 5 バイト: [経過時間 (2 バイト)] [反転したボタン上位] [反転したボタン下位] [反転した十字キー]
+//   受信側は前の状態のボタンと十字キーに、変化のビットを順に XOR して途中の状態をすべて復元する
+//   経過時間はその変化から最後の変化までの時間 (µs, リトルエンディアン, 0xFFFF で頭打ち)
+//   スティックとトリガーは最後の変化の時点の値
+//
+// 差分がキーフレーム以上の長さになるときはキーフレームを送り、エッジフレームはキーフレームより長いので、データ長で区別できる
+// 受信側はキーフレームを受け取るまで差分フレームとエッジフレームを使えない
+//
+// 拡張フレームでは上のデータの前にヘッダを付ける (拡張フレームを使うかは送受信で合わせておく)
+//   [シーケンス番号 (2 バイト)] [タイムスタンプ (4 バイト)]
+//   シーケンス番号はフレームごとに 1 ずつ増える
+//   タイムスタンプはその状態の USB レポートを受け取った時刻 (µs, 送信側の時計)
+//   エッジフレームでは最後の変化の USB レポートを受け取った時刻
+//   どちらもリトルエンディアンで、桁あふれしたら 0 に戻る
+
+const uint8_t GAMEPAD_STATE_SIZE = 9;
+const uint8_t GAMEPAD_FIELD_COUNT = 8;
+// フィールド i は状態の [GAMEPAD_FIELD_OFFSETS[i], GAMEPAD_FIELD_OFFSETS[i + 1])
+const uint8_t GAMEPAD_FIELD_OFFSETS[GAMEPAD_FIELD_COUNT + 1] = { 0, 1, 2, 3, 4, 6, 7, 8, 9 };
+const uint8_t GAMEPAD_FRAME_HEADER_SIZE = 6;
+// エッジフレームのスティックとトリガー (状態のバイト 0〜3, 6, 7)
+const uint8_t GAMEPAD_EDGE_AXES_SIZE = 6;
+const uint8_t GAMEPAD_EDGE_AXES_OFFSETS[GAMEPAD_EDGE_AXES_SIZE] = { 0, 1, 2, 3, 6, 7 };
+const uint8_t GAMEPAD_EDGE_ENTRY_SIZE = 5;
+// SbtpDecoder と CobsDecoder が受け取れる 32 バイトに、拡張フレームのヘッダを付けても収まる数
+const uint8_t GAMEPAD_EDGE_FRAME_MAX_ENTRIES = 4;
+const uint16_t GAMEPAD_EDGE_MAX_AGE_US = 0xFFFF;
+const uint8_t GAMEPAD_MAX_FRAME_DATA_SIZE =
+    GAMEPAD_FRAME_HEADER_SIZE + GAMEPAD_EDGE_AXES_SIZE + GAMEPAD_EDGE_FRAME_MAX_ENTRIES * GAMEPAD_EDGE_ENTRY_SIZE;
+
+
+struct GamepadFrameHeader {
+    uint16_t sequence;
+    uint32_t timestamp_us;
+};
+
+
+// エッジフレームの変化の1つ
+struct GamepadEdge {
+    uint16_t age_us; // この変化から最後の変化までの時間
+    uint8_t state[GAMEPAD_STATE_SIZE]; // 変化した後の状態
+};
+
+
+// キーフレーム、差分フレーム、エッジフレームを作る
+// FRAME_ENCODER は SbtpEncoder と同じ形 (コンストラクタにデータ長、put(), finish())
+struct GamepadFrameEncoder {
+    uint8_t last[GAMEPAD_STATE_SIZE]; // 最後に送った状態
+    uint8_t keyframe_interval; // この数のフレームごとにキーフレームを送る (1 なら常にキーフレーム)
+    uint8_t frames_since_keyframe;
+    bool has_keyframe;
+
+    GamepadFrameEncoder(uint8_t keyframe_interval)
+        : last(), keyframe_interval(keyframe_interval), frames_since_keyframe(0), has_keyframe(false) {}
+
+    // 次のフレームをキーフレームにする (受信側が差分を取りこぼしたとき)
+    void reset() {
+        has_keyframe = false;
+    }
+
+    // header を渡すと拡張フレームになる
+    template <class FRAME_ENCODER>
+    size_t encode(uint8_t *out, const uint8_t *state, bool force_keyframe, const GamepadFrameHeader *header = nullptr) {
+        uint8_t bitmap = 0;
+        uint8_t delta_len = 1;
+        for (uint8_t i = 0; i < GAMEPAD_FIELD_COUNT; i++) {
+            uint8_t offset = GAMEPAD_FIELD_OFFSETS[i];
+            uint8_t size = GAMEPAD_FIELD_OFFSETS[i + 1] - offset;
+            if (memcmp(state + offset, last + offset, size) != 0) {
+                bitmap |= 1 << i;
+                delta_len += size;
+            }
+        }
+
+        bool keyframe = force_keyframe || !has_keyframe || delta_len >= GAMEPAD_STATE_SIZE
+            || frames_since_keyframe + 1 >= keyframe_interval;
+        memcpy(last, state, GAMEPAD_STATE_SIZE);
+        uint8_t header_len = header ? GAMEPAD_FRAME_HEADER_SIZE : 0;
+
+        if (keyframe) {
+            has_keyframe = true;
+            frames_since_keyframe = 0;
+            FRAME_ENCODER encoder(out, header_len + GAMEPAD_STATE_SIZE);
+            put_header(encoder, header);
+            for (uint8_t i = 0; i < GAMEPAD_STATE_SIZE; i++) {
+                encoder.put(state[i]);
+            }
+            return encoder.finish();
+        }
+
+        frames_since_keyframe++;
+        FRAME_ENCODER encoder(out, header_len + delta_len);
+        put_header(encoder, header);
+        encoder.put(bitmap);
+        for (uint8_t i = 0; i < GAMEPAD_FIELD_COUNT; i++) {
+            if (bitmap & (1 << i)) {
+                for (uint8_t j = GAMEPAD_FIELD_OFFSETS[i]; j < GAMEPAD_FIELD_OFFSETS[i + 1]; j++) {
+                    encoder.put(state[j]);
+                }
+            }
+        }
+        return encoder.finish();
+    }
+
+    // edges (1〜GAMEPAD_EDGE_FRAME_MAX_ENTRIES 個) をエッジフレームにする
+    // 最初の変化は最後に送った状態からの変化になるので、先にキーフレームを送っておく (has_keyframe)
+    // スティックとトリガーは最後の変化のものだけを送る
+    template <class FRAME_ENCODER>
+    size_t encode_edges(uint8_t *out, const GamepadEdge *edges, uint8_t count, const GamepadFrameHeader *header = nullptr) {
+        uint8_t header_len = header ? GAMEPAD_FRAME_HEADER_SIZE : 0;
+        const uint8_t *last_state = edges[count - 1].state;
+
+        frames_since_keyframe++;
+        FRAME_ENCODER encoder(out, header_len + GAMEPAD_EDGE_AXES_SIZE + count * GAMEPAD_EDGE_ENTRY_SIZE);
+        put_header(encoder, header);
+        for (uint8_t i = 0; i < GAMEPAD_EDGE_AXES_SIZE; i++) {
+            encoder.put(last_state[GAMEPAD_EDGE_AXES_OFFSETS[i]]);
+        }
+        const uint8_t *previous = last;
+        for (uint8_t i = 0; i < count; i++) {
+            const uint8_t *state = edges[i].state;
+            encoder.put(edges[i].age_us & 0xFF);
+            encoder.put(edges[i].age_us >> 8);
+            encoder.put(state[4] ^ previous[4]);
+            encoder.put(state[5] ^ previous[5]);
+            encoder.put(state[8] ^ previous[8]);
+            previous = state;
+        }
+        memcpy(last, last_state, GAMEPAD_STATE_SIZE);
+        return encoder.finish();
+    }
+
+private:
+    template <class FRAME_ENCODER>
+    static void put_header(FRAME_ENCODER &encoder, const GamepadFrameHeader *header) {
+        if (header == nullptr) {
+            return;
+        }
+        encoder.put(header->sequence & 0xFF);
+        encoder.put(header->sequence >> 8);
+        for (uint8_t i = 0; i < 4; i++) {
+            encoder.put((header->timestamp_us >> (8 * i)) & 0xFF);
+        }
+    }
+};
+
+
+// フレームのデータ部から状態を復元する (受信側の参考実装)
+struct GamepadFrameDecoder {
+    uint8_t state[GAMEPAD_STATE_SIZE];
+    bool synced; // キーフレームを受け取った後なら true
+    bool extended; // 拡張フレームを受け取る
+    bool has_header;
+    GamepadFrameHeader header; // 最後に受け取った拡張フレームのヘッダ
+    // 最後に受け取ったエッジフレームの変化と、途中の状態 (エッジフレームでなければ 0 個)
+    // 途中の状態のスティックとトリガーは、フレームが運んだ最後の変化の時点の値
+    GamepadEdge edges[GAMEPAD_EDGE_FRAME_MAX_ENTRIES];
+    uint8_t edge_count;
+
+    GamepadFrameDecoder(bool extended = false)
+        : state(), synced(false), extended(extended), has_header(false), header(), edges(), edge_count(0) {}
+
+    // 壊れたフレームを捨てた後は差分の基準がずれているかもしれない
+    void reset() {
+        synced = false;
+    }
+
+    // 状態を更新できたら true
+    bool apply(const uint8_t *data, uint8_t len) {
+        if (extended) {
+            if (len < GAMEPAD_FRAME_HEADER_SIZE) {
+                return false;
+            }
+            uint16_t sequence = data[0] | (data[1] << 8);
+            // 飛んだフレームが差分だったかもしれないので、次のキーフレームまで差分を使わない
+            if (has_header && (uint16_t)(sequence - header.sequence) != 1) {
+                synced = false;
+            }
+            header.sequence = sequence;
+            header.timestamp_us = (uint32_t)data[2] | ((uint32_t)data[3] << 8) | ((uint32_t)data[4] << 16) | ((uint32_t)data[5] << 24);
+            has_header = true;
+            data += GAMEPAD_FRAME_HEADER_SIZE;
+            len -= GAMEPAD_FRAME_HEADER_SIZE;
+        }
+
+        edge_count = 0;
+        if (len > GAMEPAD_STATE_SIZE) {
+            return apply_edges(data, len);
+        }
+        if (len == GAMEPAD_STATE_SIZE) {
+            memcpy(state, data, GAMEPAD_STATE_SIZE);
+            synced = true;
+            return true;
+        }
+        if (!synced || len == 0) {
+            return false;
+        }
+
+        uint8_t bitmap = data[0];
+        uint8_t cursor = 1;
+        for (uint8_t i = 0; i < GAMEPAD_FIELD_COUNT; i++) {
+            if (bitmap & (1 << i)) {
+                uint8_t offset = GAMEPAD_FIELD_OFFSETS[i];
+                uint8_t size = GAMEPAD_FIELD_OFFSETS[i + 1] - offset;
+                if (cursor + size > len) {
+                    synced = false;
+                    return false;
+                }
+                memcpy(state + offset, data + cursor, size);
+                cursor += size;
+            }
+        }
+        if (cursor != len) {
+            synced = false;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool apply_edges(const uint8_t *data, uint8_t len) {
+        if (!synced) {
+            return false;
+        }
+        uint8_t count = (len - GAMEPAD_EDGE_AXES_SIZE) / GAMEPAD_EDGE_ENTRY_SIZE;
+        if (count == 0 || count > GAMEPAD_EDGE_FRAME_MAX_ENTRIES
+            || GAMEPAD_EDGE_AXES_SIZE + count * GAMEPAD_EDGE_ENTRY_SIZE != len) {
+            synced = false;
+            return false;
+        }
+
+        for (uint8_t i = 0; i < GAMEPAD_EDGE_AXES_SIZE; i++) {
+            state[GAMEPAD_EDGE_AXES_OFFSETS[i]] = data[i];
+        }
+        const uint8_t *entry = data + GAMEPAD_EDGE_AXES_SIZE;
+        for (uint8_t i = 0; i < count; i++) {
+            state[4] ^= entry[2];
+            state[5] ^= entry[3];
+            state[8] ^= entry[4];
+            edges[i].age_us = entry[0] | (entry[1] << 8);
+            memcpy(edges[i].state, state, GAMEPAD_STATE_SIZE);
+            entry += GAMEPAD_EDGE_ENTRY_SIZE;
+        }
+        edge_count = count;
+        return true;
+    }
+};
+
+
+// 拡張フレームのヘッダから欠落と遅延を数える (受信側の参考実装)
+// 送信側と受信側の時計はそろっていないので、遅延はそれまでに観測した最小値からの増分になる
+// 両方が同じ時計なら absolute_latency_us() がそのまま遅延になる
+// キープアライブなど前と同じタイムスタンプのフレームは遅延に数えない
+struct GamepadLinkMonitor {
+    uint32_t frames = 0; // 受け取ったフレーム数
+    uint32_t lost = 0; // シーケンス番号が飛んだ分のフレーム数
+    uint32_t latency_frames = 0; // 遅延を数えたフレーム数
+    uint16_t last_sequence = 0;
+    uint32_t last_timestamp_us = 0;
+    uint32_t base_offset_us = 0; // 最初のフレームの (受信時刻 - タイムスタンプ)
+    int32_t min_offset_us = 0; // base_offset_us からの差の最小値
+    int32_t last_offset_us = 0;
+    uint64_t total_latency_us = 0;
+    uint32_t max_latency_us = 0;
+
+    // received_us は受信側の時計で見たフレームの受信時刻
+    void on_frame(const GamepadFrameHeader &header, uint64_t received_us) {
+        bool is_new_state = frames == 0 || header.timestamp_us != last_timestamp_us;
+        uint32_t offset_us = (uint32_t)received_us - header.timestamp_us;
+        if (frames == 0) {
+            base_offset_us = offset_us;
+        }
+        else {
+            lost += (uint16_t)(header.sequence - last_sequence - 1);
+        }
+        last_sequence = header.sequence;
+        last_timestamp_us = header.timestamp_us;
+        frames++;
+
+        if (!is_new_state) {
+            return;
+        }
+        last_offset_us = (int32_t)(offset_us - base_offset_us);
+        if (last_offset_us < min_offset_us) {
+            min_offset_us = last_offset_us;
+        }
+        uint32_t latency_us = latency_since_min_us();
+        latency_frames++;
+        total_latency_us += latency_us;
+        if (latency_us > max_latency_us) {
+            max_latency_us = latency_us;
+        }
+    }
+
+    // 最後に数えたフレームの遅延 (観測した最小値からの増分)
+    uint32_t latency_since_min_us() const {
+        return last_offset_us - min_offset_us;
+    }
+
+    // 最後に数えたフレームの遅延 (送信側と受信側が同じ時計のとき)
+    uint32_t absolute_latency_us() const {
+        return base_offset_us + last_offset_us;
+    }
+
+    double loss_rate() const {
+        return frames + lost == 0 ? 0.0 : (double)lost / (frames + lost);
+    }
+
+    double average_latency_us() const {
+        return latency_frames == 0 ? 0.0 : (double)total_latency_us / latency_frames;
+    }
+};
@@ -2,6 +2,14 @@
 // SPDX-FileCopyrightText:  2022 Istvan Pasztor
 #include "hid_report_parser.h"
 
+#if HRP_PROFILE_ZONES_ENABLED
+#  if defined(PICO_ON_DEVICE) && PICO_ON_DEVICE
+#    include "hardware/timer.h"
+#  else
+#    include <chrono>
+#  endif
+#endif
+
 
 namespace hid {
 
@@ -33,17 +41,78 @@ namespace hid {
 		"ERR_NOTHING_CHANGED",                      // -23
 		"ERR_INVALID_REPORT_SIZE",                  // -24
 		"ERR_UNDEFINED_USAGE_PAGE",                 // -25
+		"ERR_ARENA_TOO_SMALL",                      // -26
+		"ERR_LAZY_DECODING_DISABLED",               // -27
 	};
-	static_assert(26 == sizeof(STR_ERROR)/sizeof(STR_ERROR[0]), "wrong array size");
+	static_assert(28 == sizeof(STR_ERROR)/sizeof(STR_ERROR[0]), "wrong array size");
 
 
 	const char* str_error(int error_code, const char* default_str) {
-		if (error_code > 0 || error_code < -25)
+		if (error_code > 0 || error_code < -27)
 			return default_str;
 		return STR_ERROR[-error_code];
 	}
 
 
+#if HRP_PROFILE_ZONES_ENABLED
+	static const char* PROFILE_ZONE_NAMES[] = {
+		"init",
+		"resize_vectors",
+		"descriptor_parse",
+		"find_field_usages",
+		"match_config_ranges",
+		"compile",
+		"install",
+		"parse_report",
+		"var_field",
+		"array_field",
+	};
+	static_assert((size_t)ProfileZone::count == sizeof(PROFILE_ZONE_NAMES)/sizeof(PROFILE_ZONE_NAMES[0]), "wrong array size");
+
+	static ProfileZoneStats s_profile_zones[(size_t)ProfileZone::count];
+
+	const ProfileZoneStats& GetProfileZoneStats(ProfileZone zone) {
+		return s_profile_zones[(size_t)zone];
+	}
+
+	const char* GetProfileZoneName(ProfileZone zone) {
+		return PROFILE_ZONE_NAMES[(size_t)zone];
+	}
+
+	void ResetProfileZones() {
+		memset(s_profile_zones, 0, sizeof(s_profile_zones));
+	}
+
+	static inline uint64_t ProfileClockNs() {
+#  if defined(PICO_ON_DEVICE) && PICO_ON_DEVICE
+		return time_us_64() * 1000;
+#  else
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#  endif
+	}
+
+	// Adds the time between its construction and destruction to a zone.
+	class ProfileZoneScope {
+	public:
+		explicit ProfileZoneScope(ProfileZone zone) : _stats(s_profile_zones[(size_t)zone]), _start_ns(ProfileClockNs()) {}
+		~ProfileZoneScope() {
+			_stats.total_ns += ProfileClockNs() - _start_ns;
+			_stats.calls++;
+		}
+		ProfileZoneScope(const ProfileZoneScope&) = delete;
+		ProfileZoneScope& operator=(const ProfileZoneScope&) = delete;
+	private:
+		ProfileZoneStats& _stats;
+		uint64_t _start_ns;
+	};
+
+#  define HRP_PROFILE_ZONE(zone) ProfileZoneScope _profile_zone_scope(ProfileZone::zone)
+#else
+#  define HRP_PROFILE_ZONE(zone)
+#endif
+
+
 namespace {
 
 
@@ -189,6 +258,7 @@ namespace {
 
 
 	int DescriptorParser::Parse(const void* descriptor, size_t descriptor_size, EventHandler* handler) {
+		HRP_PROFILE_ZONE(descriptor_parse);
 		Reset();
 
 		auto p = (const uint8_t*)descriptor;
@@ -598,29 +668,669 @@ namespace {
 		return true;
 	}
 
-	int SelectiveInputReportParser::Init(Collection* input_fields, const void* descriptor, size_t descriptor_size) {
+	static void ClearBits(uint8_t* bits, size_t first_bit, size_t length) {
+		if (length <= 2) {
+			for (size_t i = first_bit, e = first_bit + length; i < e; ++i)
+				bits[i >> 3] &= ~(1 << (i & 7));
+			return;
+		}
+
+		size_t idx = first_bit >> 3;
+		size_t bits_left = length;
+
+		uint8_t first_byte_shift = (uint8_t)(first_bit & 7);
+		if (first_byte_shift) {
+			uint8_t bits_in_first_byte = (uint8_t)_hrp_min((size_t)(8 - first_byte_shift), bits_left);
+			bits_left -= bits_in_first_byte;
+			bits[idx++] &= ~((((uint8_t)1 << bits_in_first_byte) - 1) << first_byte_shift);
+		}
+
+		size_t whole_bytes = bits_left >> 3;
+		if (whole_bytes)
+			memset(&bits[idx], 0, whole_bytes);
+
+		uint8_t bits_in_last_byte = bits_left & 7;
+		if (bits_in_last_byte)
+			bits[idx+whole_bytes] &= ~(((uint8_t)1 << bits_in_last_byte) - 1);
+	}
+
+	// The number of bitfield bytes the [first_bit, first_bit+length) range touches.
+	static size_t BitRangeBytes(size_t first_bit, size_t length) {
+		return ((first_bit + length + 7) >> 3) - (first_bit >> 3);
+	}
+
+	// The bits of the [first_bit, first_bit+length) range within the specified byte.
+	static uint8_t BitRangeByteMask(size_t first_bit, size_t length, size_t byte_index) {
+		size_t lo = _hrp_max(first_bit, byte_index * 8) - byte_index * 8;
+		size_t hi = _hrp_min(first_bit + length, byte_index * 8 + 8) - byte_index * 8;
+		return (uint8_t)((((unsigned)1 << hi) - 1) & ~(((unsigned)1 << lo) - 1));
+	}
+
+	static constexpr size_t ARENA_ALIGNMENT = alignof(max_align_t);
+
+	static constexpr size_t AlignUp(size_t v, size_t alignment) {
+		return (v + alignment - 1) & ~(alignment - 1);
+	}
+
+	struct SelectiveInputReportParser::InitMemory {
+		// nullptr if the Init call doesn't use an arena
+		Arena* arena;
+		// bytes currently allocated from the heap by InitAlloc
+		size_t heap_bytes;
+		// the size of the compiled program once Install has allocated it
+		size_t program_bytes;
+		size_t peak;
+		// true if an allocation didn't fit into the arena
+		bool arena_overflow;
+	};
+
+	// The header of a temporary allocation that didn't fit into the arena.
+	// It keeps the offset the allocation would have in a large enough arena.
+	struct ArenaSpill {
+		size_t offset;
+	};
+
+	static constexpr size_t ARENA_SPILL_HEADER = AlignUp(sizeof(ArenaSpill), ARENA_ALIGNMENT);
+
+	void SelectiveInputReportParser::UpdateInitPeak(InitMemory& im) {
+		// With an arena Arena::_bottom is the bump pointer of a large enough
+		// arena (see InitAlloc) so the peak is the arena size Init needs.
+		size_t current = im.program_bytes + (im.arena ? im.arena->_bottom : im.heap_bytes);
+		if (current > im.peak)
+			im.peak = current;
+	}
+
+	void* SelectiveInputReportParser::InitAlloc(InitMemory& im, size_t size) {
+		if (!im.arena) {
+			im.heap_bytes += size;
+			UpdateInitPeak(im);
+			return ::operator new(size);
+		}
+
+		Arena& a = *im.arena;
+		size_t aligned = AlignUp(size, ARENA_ALIGNMENT);
+		if (!im.arena_overflow && aligned <= a._size - a._top - a._bottom) {
+			void* p = a._buffer + a._bottom;
+			a._bottom += aligned;
+			UpdateInitPeak(im);
+			return p;
+		}
+
+		// Init will fail with ERR_ARENA_TOO_SMALL but it has to run to the
+		// end to find out how much memory the descriptor needs. From here on
+		// _bottom goes on as if the arena were large enough: every spilled
+		// allocation gets the offset it would have there and InitFree gives
+		// it back under the same last-in-first-out rule as the arena, so the
+		// peak isn't lowered by frees the arena couldn't do.
+		im.arena_overflow = true;
+		im.heap_bytes += aligned;
+		uint8_t* block = (uint8_t*)::operator new(ARENA_SPILL_HEADER + aligned);
+		((ArenaSpill*)block)->offset = a._bottom;
+		a._bottom += aligned;
+		UpdateInitPeak(im);
+		return block + ARENA_SPILL_HEADER;
+	}
+
+	void SelectiveInputReportParser::InitFree(InitMemory& im, void* p, size_t size) {
+		if (!im.arena) {
+			im.heap_bytes -= size;
+			::operator delete(p);
+			return;
+		}
+
+		Arena& a = *im.arena;
+		size_t aligned = AlignUp(size, ARENA_ALIGNMENT);
+		uintptr_t q = (uintptr_t)p;
+		if (q >= (uintptr_t)a._buffer && q < (uintptr_t)(a._buffer + a._size)) {
+			// Only the last allocation can be given back to the arena. The
+			// rest of the temporary memory is released when Init returns.
+			if (q + aligned == (uintptr_t)(a._buffer + a._bottom))
+				a._bottom -= aligned;
+			return;
+		}
+		uint8_t* block = (uint8_t*)p - ARENA_SPILL_HEADER;
+		if (((ArenaSpill*)block)->offset + aligned == a._bottom)
+			a._bottom -= aligned;
+		im.heap_bytes -= aligned;
+		::operator delete(block);
+	}
+
+	// The compiled extraction program while it is being built by Compile.
+	// Install copies it into a single memory block.
+	struct SelectiveInputReportParser::Program {
+		explicit Program(InitMemory* m) :
+			memory(m), reports(m), ops(m), resets(m), array_fields(m), array_ranges(m), lookups(m),
+			decode_targets(m), decode_entries(m) {}
+
+		InitMemory* memory;
+		init_vector<CompiledReport> reports;
+		init_vector<ExtractOp> ops;
+		init_vector<ResetRange> resets;
+		init_vector<ArrayField> array_fields;
+		init_vector<ArrayRange> array_ranges;
+		init_vector<uint16_t> lookups;
+		init_vector<DecodeTarget> decode_targets;
+		init_vector<uint32_t> decode_entries;
+		// the largest snapshot needed by an array field (see ParseArrayField)
+		size_t snapshot_size = 0;
+		// the total size of the report copies retained by ParseLazy
+		size_t retained_size = 0;
+	};
+
+	int SelectiveInputReportParser::Init(Collection* input_fields, const void* descriptor, size_t descriptor_size, Arena* arena, bool lazy) {
+		HRP_PROFILE_ZONE(init);
 		Reset();
+		_memory_usage.peak = 0;
 		if (!input_fields || !descriptor || !descriptor_size)
 			return ERR_INVALID_PARAMETERS;
 
-		DescriptorMapper m(&_mapping, input_fields);
-		int res = m.MapFields(descriptor, descriptor_size);
-		if (res) {
+		InitMemory memory = { arena, 0, 0, 0, false };
+		int res = InitProgram(memory, input_fields, descriptor, descriptor_size, arena, lazy);
+		// The temporary allocations have been released by InitProgram.
+		assert(memory.heap_bytes == 0);
+		if (arena)
+			arena->_bottom = 0;
+		if (!res && memory.arena_overflow)
+			res = ERR_ARENA_TOO_SMALL;
+		_memory_usage.peak = memory.peak;
+
+		if (res)
 			Reset();
-			return res;
+		return res;
+	}
+
+	int SelectiveInputReportParser::InitProgram(InitMemory& memory, Collection* input_fields, const void* descriptor, size_t descriptor_size, Arena* arena, bool lazy) {
+		mapping_t mapping(&memory);
+		changed_bits_t changed_bits(&memory);
+		int res;
+		{
+			// Destroying the DescriptorMapper before Compile releases its
+			// temporary data structures early when Init uses the heap.
+			DescriptorMapper m(&memory, &mapping, &changed_bits, input_fields);
+			res = m.MapFields(descriptor, descriptor_size);
 		}
+		if (res)
+			return res;
 
-		if (_mapping.empty())
+		if (mapping.empty())
 			return ERR_COULD_NOT_MAP_ANY_USAGES;
 
-		_have_report_ids = _mapping.find(0) == _mapping.end();
+		_have_report_ids = mapping.find(0) == mapping.end();
+		Program prog(&memory);
+		Compile(mapping, changed_bits, lazy, prog);
+		if (!Install(prog, arena))
+			return ERR_ARENA_TOO_SMALL;
 		return 0;
 	}
 
+	void SelectiveInputReportParser::Reset() {
+		if (_arena)
+			_arena->_top = 0;
+		else
+			::operator delete(_program);
+		_program = nullptr;
+		_arena = nullptr;
+		_reports = nullptr;
+		_num_reports = 0;
+		_ops = nullptr;
+		_resets = nullptr;
+		_array_fields = nullptr;
+		_array_ranges = nullptr;
+		_array_lookups = nullptr;
+		_array_snapshot = nullptr;
+		_retained = nullptr;
+		_retain_counter = 0;
+		_decode_targets = nullptr;
+		_num_decode_targets = 0;
+		_decode_entries = nullptr;
+		memset(_report_index, 0, sizeof(_report_index));
+		_memory_usage.steady = 0;
+	}
+
+	void SelectiveInputReportParser::Compile(const mapping_t& mapping, const changed_bits_t& changed_bits, bool lazy, Program& prog) {
+		HRP_PROFILE_ZONE(compile);
+		for (auto const& it : mapping) {
+			prog.reports.push_back({});
+			_report_index[it.first] = (uint8_t)prog.reports.size();
+			CompiledReport& cr = prog.reports.back();
+			cr.bit_size = it.second.bit_size;
+			cr.first_op = (uint32_t)prog.ops.size();
+			if (lazy) {
+				cr.retained_offset = (uint32_t)prog.retained_size;
+				prog.retained_size += (cr.bit_size + 7) >> 3;
+			}
+
+			for (const ReportFieldMapping& fm : it.second.fields) {
+				if (fm.variable) {
+					AppendVarFieldOps(prog, fm, changed_bits);
+					continue;
+				}
+				ExtractOp op = {};
+				op.kind = ExtractOp::ARRAY;
+				op.relative = fm.relative;
+				op.offset = (uint32_t)prog.array_fields.size();
+				prog.ops.push_back(op);
+				AppendArrayField(prog, fm, changed_bits);
+			}
+
+			cr.num_ops = (uint32_t)prog.ops.size() - cr.first_op;
+			for (size_t i = cr.first_op; i < prog.ops.size(); ++i)
+				prog.ops[i].report = (uint8_t)(prog.reports.size() - 1);
+		}
+
+		// A report resets the relative fields of all other report_ids because
+		// they won't be updated by this report and "no change" means zero
+		// value in case of a relative field. The lists of ranges to zero are
+		// computed here so Parse doesn't have to look for relative fields.
+		init_vector<init_vector<ResetRange>> relative_ranges(prog.reports.size(), init_vector<ResetRange>(prog.memory), prog.memory);
+		for (size_t i = 0; i < prog.reports.size(); ++i)
+			AppendRelativeResetRanges(prog, prog.reports[i], relative_ranges[i]);
+
+		for (size_t i = 0; i < prog.reports.size(); ++i) {
+			CompiledReport& cr = prog.reports[i];
+			cr.first_reset = (uint32_t)prog.resets.size();
+			for (size_t k = 0; k < prog.reports.size(); ++k) {
+				if (k != i)
+					prog.resets.insert(prog.resets.end(), relative_ranges[k].begin(), relative_ranges[k].end());
+			}
+			cr.num_resets = (uint32_t)prog.resets.size() - cr.first_reset;
+		}
+
+		if (lazy)
+			BuildDecodeIndex(prog);
+	}
+
+	template <typename F>
+	void SelectiveInputReportParser::ForEachVariableRange(const Program& prog, const ExtractOp& op, F f) {
+		switch (op.kind) {
+		case ExtractOp::INT32:
+			f(op.dest.int32 - op.dest_bit, false, op.dest_bit, op.length);
+			break;
+		case ExtractOp::INT32_TO_BOOL:
+			f(op.dest.bits, true, op.dest_bit, 1);
+			break;
+		case ExtractOp::BITS_BYTES:
+		case ExtractOp::BITS_SAME_PHASE:
+		case ExtractOp::BITS_SHIFTED:
+			f(op.dest.bits, true, op.dest_bit, op.length);
+			break;
+		case ExtractOp::ARRAY:
+		{
+			const ArrayField& af = prog.array_fields[op.offset];
+			const ArrayRange* ar = prog.array_ranges.data() + af.first_range;
+			for (const ArrayRange* e = ar + af.num_ranges; ar < e; ++ar) {
+				if (ar->int32s)
+					f(ar->int32s, false, ar->val_min, ar->length);
+				else
+					f(ar->bits, true, ar->val_min, ar->length);
+			}
+			break;
+		}
+		}
+	}
+
+	void SelectiveInputReportParser::BuildDecodeIndex(Program& prog) {
+		init_vector<DecodeTarget>& targets = prog.decode_targets;
+		auto find_target = [&targets](const void* data, bool bits) -> DecodeTarget* {
+			for (DecodeTarget& t : targets) {
+				if (t.data == data && t.bits == bits)
+					return &t;
+			}
+			return nullptr;
+		};
+
+		// The targets and the range of their mapped variable indexes.
+		for (const ExtractOp& op : prog.ops) {
+			ForEachVariableRange(prog, op, [&](const void* data, bool bits, uint32_t first, uint32_t length) {
+				DecodeTarget* t = find_target(data, bits);
+				if (!t) {
+					targets.push_back({ data, bits, first, length, 0, 0 });
+					return;
+				}
+				uint32_t end = _hrp_max(t->first_index + t->num_indexes, first + length);
+				t->first_index = _hrp_min(t->first_index, first);
+				t->num_indexes = end - t->first_index;
+			});
+		}
+
+		// The number of ops per variable decides the number of slots.
+		size_t num_variables = 0;
+		for (DecodeTarget& t : targets) {
+			t.first_entry = (uint32_t)num_variables;
+			num_variables += t.num_indexes;
+		}
+		{
+			init_vector<uint32_t> counts(num_variables, 0, prog.memory);
+			for (const ExtractOp& op : prog.ops) {
+				ForEachVariableRange(prog, op, [&](const void* data, bool bits, uint32_t first, uint32_t length) {
+					DecodeTarget* t = find_target(data, bits);
+					uint32_t* c = counts.data() + t->first_entry + (first - t->first_index);
+					for (uint32_t i = 0; i < length; ++i) {
+						if (++c[i] > t->slots)
+							t->slots = c[i];
+					}
+				});
+			}
+		}
+
+		size_t num_entries = 0;
+		for (DecodeTarget& t : targets) {
+			t.first_entry = (uint32_t)num_entries;
+			num_entries += (size_t)t.num_indexes * t.slots;
+		}
+		prog.decode_entries.assign(num_entries, 0);
+
+		// Ops are visited in report order so the slots of a variable are too.
+		for (size_t k = 0; k < prog.ops.size(); ++k) {
+			ForEachVariableRange(prog, prog.ops[k], [&](const void* data, bool bits, uint32_t first, uint32_t length) {
+				DecodeTarget* t = find_target(data, bits);
+				uint32_t* entry = prog.decode_entries.data() + t->first_entry + (size_t)(first - t->first_index) * t->slots;
+				for (uint32_t i = 0; i < length; ++i, entry += t->slots) {
+					uint32_t slot = 0;
+					while (entry[slot])
+						++slot;
+					entry[slot] = (uint32_t)k + 1;
+				}
+			});
+		}
+	}
+
+	template <typename T>
+	static size_t ReserveBlockItems(size_t& block_size, size_t count) {
+		block_size = AlignUp(block_size, alignof(T));
+		size_t offset = block_size;
+		block_size += sizeof(T) * count;
+		return offset;
+	}
+
+	template <typename T, typename V>
+	static T* CopyToBlock(uint8_t* block, size_t offset, const V& items) {
+		T* p = (T*)(block + offset);
+		if (!items.empty())
+			memcpy(p, items.data(), sizeof(T) * items.size());
+		return p;
+	}
+
+	bool SelectiveInputReportParser::Install(const Program& prog, Arena* arena) {
+		HRP_PROFILE_ZONE(install);
+		size_t size = 0;
+		size_t reports_offset = ReserveBlockItems<CompiledReport>(size, prog.reports.size());
+		size_t ops_offset = ReserveBlockItems<ExtractOp>(size, prog.ops.size());
+		size_t resets_offset = ReserveBlockItems<ResetRange>(size, prog.resets.size());
+		size_t array_fields_offset = ReserveBlockItems<ArrayField>(size, prog.array_fields.size());
+		size_t array_ranges_offset = ReserveBlockItems<ArrayRange>(size, prog.array_ranges.size());
+		size_t lookups_offset = ReserveBlockItems<uint16_t>(size, prog.lookups.size());
+		size_t snapshot_offset = ReserveBlockItems<uint8_t>(size, prog.snapshot_size);
+		size_t retained_offset = ReserveBlockItems<uint8_t>(size, prog.retained_size);
+		size_t decode_targets_offset = ReserveBlockItems<DecodeTarget>(size, prog.decode_targets.size());
+		size_t decode_entries_offset = ReserveBlockItems<uint32_t>(size, prog.decode_entries.size());
+		size = AlignUp(size, ARENA_ALIGNMENT);
+
+		prog.memory->program_bytes = size;
+		UpdateInitPeak(*prog.memory);
+
+		uint8_t* block;
+		if (arena) {
+			// After an overflow _bottom can be past the end of the arena.
+			if (prog.memory->arena_overflow || size > arena->_size - arena->_bottom)
+				return false;
+			arena->_top = size;
+			block = arena->_buffer + arena->_size - size;
+		}
+		else {
+			block = (uint8_t*)::operator new(size);
+		}
+
+		_program = block;
+		_arena = arena;
+		_reports = CopyToBlock<CompiledReport>(block, reports_offset, prog.reports);
+		_num_reports = (uint32_t)prog.reports.size();
+		_ops = CopyToBlock<ExtractOp>(block, ops_offset, prog.ops);
+		_resets = CopyToBlock<ResetRange>(block, resets_offset, prog.resets);
+		_array_fields = CopyToBlock<ArrayField>(block, array_fields_offset, prog.array_fields);
+		_array_ranges = CopyToBlock<ArrayRange>(block, array_ranges_offset, prog.array_ranges);
+		_array_lookups = CopyToBlock<uint16_t>(block, lookups_offset, prog.lookups);
+		_array_snapshot = block + snapshot_offset;
+		_retained = prog.retained_size ? block + retained_offset : nullptr;
+		_decode_targets = CopyToBlock<DecodeTarget>(block, decode_targets_offset, prog.decode_targets);
+		_num_decode_targets = (uint32_t)prog.decode_targets.size();
+		_decode_entries = CopyToBlock<uint32_t>(block, decode_entries_offset, prog.decode_entries);
+		_memory_usage.steady = size;
+		return true;
+	}
+
+	void SelectiveInputReportParser::AppendRelativeResetRanges(const Program& prog, const CompiledReport& cr, init_vector<ResetRange>& ranges) {
+		const ExtractOp* op = prog.ops.data() + cr.first_op;
+		for (const ExtractOp* e = op + cr.num_ops; op < e; ++op) {
+			if (!op->relative)
+				continue;
+
+			switch (op->kind) {
+			case ExtractOp::INT32:
+				AppendResetRange(ranges, { op->dest.int32, nullptr, 0, op->length });
+				break;
+			case ExtractOp::INT32_TO_BOOL:
+				AppendResetRange(ranges, { nullptr, op->dest.bits, op->dest_bit, 1 });
+				break;
+			case ExtractOp::BITS_BYTES:
+			case ExtractOp::BITS_SAME_PHASE:
+			case ExtractOp::BITS_SHIFTED:
+				AppendResetRange(ranges, { nullptr, op->dest.bits, op->dest_bit, op->length });
+				break;
+			case ExtractOp::ARRAY:
+			{
+				const ArrayField& af = prog.array_fields[op->offset];
+				const ArrayRange* ar = prog.array_ranges.data() + af.first_range;
+				for (const ArrayRange* ae = ar + af.num_ranges; ar < ae; ++ar) {
+					if (ar->int32s)
+						AppendResetRange(ranges, { &ar->int32s[ar->val_min], nullptr, 0, ar->length });
+					else
+						AppendResetRange(ranges, { nullptr, ar->bits, ar->val_min, ar->length });
+				}
+				break;
+			}
+			}
+		}
+	}
+
+	void SelectiveInputReportParser::AppendResetRange(init_vector<ResetRange>& ranges, const ResetRange& r) {
+		// Merging with the previous range if the two are adjacent. The
+		// relative axes of a mouse (X/Y/wheel) usually end up in one range.
+		if (!ranges.empty()) {
+			ResetRange& prev = ranges.back();
+			if (r.int32s) {
+				if (prev.int32s && prev.int32s + prev.length == r.int32s) {
+					prev.length += r.length;
+					return;
+				}
+			}
+			else if (!prev.int32s && prev.bits == r.bits && prev.first_bit + prev.length == r.first_bit) {
+				prev.length += r.length;
+				return;
+			}
+		}
+		ranges.push_back(r);
+	}
+
+	void SelectiveInputReportParser::AppendArrayField(Program& prog, const ReportFieldMapping& fm, const changed_bits_t& changed_bits) {
+		ArrayField af = {};
+		af.bit_offset = fm.bit_offset;
+		af.report_size = fm.report_size;
+		af.report_count = fm.report_count;
+		af.logical_min = fm.logical_min;
+		af.logical_max = fm.logical_max;
+		af.relative = fm.relative;
+		af.first_usage_is_zero = fm.first_usage_is_zero;
+		af.byte_aligned = fm.byte_aligned;
+		af.first_range = (uint32_t)prog.array_ranges.size();
+
+		size_t snapshot_size = 0;
+		for (auto const& it : fm.mappings.int32_values) {
+			uint8_t* changed = FindChangedBits(changed_bits, it.first);
+			for (const UsageIndexRange& r : it.second) {
+				prog.array_ranges.push_back({ it.first, nullptr, changed, (uint32_t)r.desc_min, (uint32_t)r.val_min, (uint32_t)r.length });
+				snapshot_size += sizeof(int32_t) * r.length;
+			}
+		}
+		for (auto const& it : fm.mappings.bool_values) {
+			uint8_t* changed = FindChangedBits(changed_bits, it.first);
+			for (const UsageIndexRange& r : it.second) {
+				prog.array_ranges.push_back({ nullptr, it.first, changed, (uint32_t)r.desc_min, (uint32_t)r.val_min, (uint32_t)r.length });
+				snapshot_size += BitRangeBytes(r.val_min, r.length);
+			}
+		}
+
+		af.num_ranges = (uint32_t)prog.array_ranges.size() - af.first_range;
+		prog.snapshot_size = _hrp_max(prog.snapshot_size, snapshot_size);
+		BuildArrayLookup(prog, af);
+		prog.array_fields.push_back(af);
+	}
+
+	void SelectiveInputReportParser::BuildArrayLookup(Program& prog, ArrayField& af) {
+		const ArrayRange* ranges = prog.array_ranges.data() + af.first_range;
+
+		// The table can point to only one target variable array.
+		for (uint32_t i = 0; i < af.num_ranges; ++i) {
+			if (ranges[i].int32s != ranges[0].int32s || ranges[i].bits != ranges[0].bits)
+				return;
+			if (ranges[i].val_min + ranges[i].length >= 0xffff)
+				return;
+		}
+
+		uint32_t num_items = (uint32_t)af.logical_max - (uint32_t)af.logical_min + 1;
+		if (!af.num_ranges || num_items == 0 || num_items > HRP_MAX_ARRAY_LOOKUP_TABLE_SIZE)
+			return;
+
+		af.first_lookup = (uint32_t)prog.lookups.size();
+		af.lookup_size = num_items;
+		af.lookup_int32s = ranges[0].int32s;
+		af.lookup_bits = ranges[0].bits;
+		prog.lookups.resize(prog.lookups.size() + num_items, 0);
+
+		uint16_t* lookup = prog.lookups.data() + af.first_lookup;
+		for (uint32_t i = 0; i < af.num_ranges; ++i) {
+			const ArrayRange& r = ranges[i];
+			for (size_t k = 0; k < r.length && r.desc_min + k < num_items; ++k)
+				lookup[r.desc_min + k] = (uint16_t)(r.val_min + k + 1);
+		}
+	}
+
+	uint8_t* SelectiveInputReportParser::FindChangedBits(const changed_bits_t& changed_bits, const void* target) {
+		auto it = changed_bits.find(target);
+		return it == changed_bits.end() ? nullptr : it->second;
+	}
+
+	void SelectiveInputReportParser::AppendVarFieldOps(Program& prog, const ReportFieldMapping& fm, const changed_bits_t& changed_bits) {
+		ExtractOp op = {};
+		op.signed_ = fm.signed_;
+		op.relative = fm.relative;
+		op.logical_min = fm.logical_min;
+		op.logical_max = fm.logical_max;
+
+		// IInt32Target
+
+		op.kind = ExtractOp::INT32;
+		op.byte_aligned = fm.byte_aligned;
+		// offset and stride are in bytes if byte_aligned, otherwise in bits
+		uint32_t offset, stride;
+		if (fm.byte_aligned) {
+			// integer fields are often byte-aligned in HID descriptors
+			stride = fm.report_size >> 3;
+			offset = fm.bit_offset >> 3;
+			op.size = (uint8_t)_hrp_min(stride, (uint32_t)4);
+		}
+		else {
+			stride = fm.report_size;
+			offset = fm.bit_offset;
+			op.size = (uint8_t)_hrp_min(fm.report_size, (uint32_t)32);
+		}
+		op.extract = ExtractOp::SelectInt32Extractor(op);
+		// A usage range of a multi-count field (like the 8-bit X/Y/Z/Rz axes
+		// of a gamepad in one main item) becomes a single op that extracts
+		// the consecutive items into consecutive variables. Items wider than
+		// 32 bits get one op each because ExtractInt32 steps by op.size.
+		uint32_t run = stride == op.size ? UINT32_MAX : 1;
+		for (auto const& it : fm.mappings.int32_values) {
+			op.changed = FindChangedBits(changed_bits, it.first);
+			for (const UsageIndexRange& r : it.second) {
+				size_t n;
+				for (size_t i = 0; i < r.length; i += n) {
+					n = _hrp_min(r.length - i, (size_t)run);
+					op.offset = offset + (uint32_t)(r.desc_min + i) * stride;
+					op.dest.int32 = &it.first[r.val_min + i];
+					op.dest_bit = (uint32_t)(r.val_min + i);
+					op.length = (uint32_t)n;
+					prog.ops.push_back(op);
+				}
+			}
+		}
+
+		// IBoolTarget
+
+		op.byte_aligned = false;
+		op.extract = nullptr;
+		op.length = 0;
+		if (fm.report_size == 1) {
+			// As a 1-bit integer the value of 1 can be interpreted as either
+			// 1 or -1 so logical_max can be anything but zero. In practice
+			// logical_min and logical_max will be 0 and 1 respectively 99.99%
+			// of the time. Anything else is likely to be a pathological case.
+			if (fm.logical_min > 0 || fm.logical_max == 0)
+				return;
+			op.size = 1;
+			for (auto const& it : fm.mappings.bool_values) {
+				op.changed = FindChangedBits(changed_bits, it.first);
+				for (const UsageIndexRange& r : it.second) {
+					op.offset = fm.bit_offset + (uint32_t)r.desc_min;
+					op.dest.bits = it.first;
+					op.dest_bit = (uint32_t)r.val_min;
+					op.length = (uint32_t)r.length;
+					if ((op.offset & 7) != (op.dest_bit & 7))
+						op.kind = ExtractOp::BITS_SHIFTED;
+					else if ((op.offset & 7) || (op.length & 7))
+						op.kind = ExtractOp::BITS_SAME_PHASE;
+					else
+						op.kind = ExtractOp::BITS_BYTES;
+					prog.ops.push_back(op);
+				}
+			}
+		}
+		else {
+			// This branch maps integer fields of the reports onto bool fields
+			// of the application. No one should do this in practice.
+			op.kind = ExtractOp::INT32_TO_BOOL;
+			op.size = (uint8_t)_hrp_min(fm.report_size, (uint32_t)32);
+			for (auto const& it : fm.mappings.bool_values) {
+				op.changed = FindChangedBits(changed_bits, it.first);
+				for (const UsageIndexRange& r : it.second) {
+					for (size_t i = 0; i < r.length; ++i) {
+						op.offset = fm.bit_offset + (uint32_t)(r.desc_min + i) * fm.report_size;
+						op.dest.bits = it.first;
+						op.dest_bit = (uint32_t)(r.val_min + i);
+						prog.ops.push_back(op);
+					}
+				}
+			}
+		}
+	}
+
 	int SelectiveInputReportParser::Parse(const void* report, size_t report_size) {
+		bool changed;
+		return ParseReport(report, report_size, changed);
+	}
+
+	int SelectiveInputReportParser::ParseChanges(const void* report, size_t report_size) {
+		bool changed;
+		int res = ParseReport(report, report_size, changed);
+		if (res)
+			return res;
+		return changed ? 0 : ERR_NOTHING_CHANGED;
+	}
+
+	int SelectiveInputReportParser::FindReport(const void* report, size_t report_size, CompiledReport*& cr, const uint8_t*& data) const {
 		if (!report || !report_size)
 			return ERR_INVALID_PARAMETERS;
-		if (_mapping.empty())
+		if (!_num_reports)
 			return ERR_UNINITIALISED_PARSER;
 
 		const uint8_t* r = (const uint8_t*)report;
@@ -631,74 +1341,174 @@ namespace {
 			report_size -= 1;
 		}
 
-		auto it = _mapping.find(report_id);
-		if (it == _mapping.end())
+		// Reports without mapped fields are rejected here before looking at
+		// their size: devices with several report_ids often send reports
+		// we aren't interested in at a high rate.
+		uint8_t index = _report_index[report_id];
+		if (!index)
 			return ERR_NOTHING_CHANGED;
-		ReportMapper& m = it->second;
+		cr = &_reports[index - 1];
 
-		if (report_size * 8 != m.bit_size)
+		if (report_size * 8 != cr->bit_size)
 			return ERR_INVALID_REPORT_SIZE;
 
-		if (_have_report_ids) {
-			for (auto& it : _mapping) {
-				if (it.first == report_id)
-					continue;
-				// Resetting those relative fields that don't belong to this
-				// report_id because they won't be updated by this report and
-				// and "no change" means zero value in case of a relative field.
-				for (ReportFieldMapping& fm : it.second.fields) {
-					if (fm.relative)
-						ReportFieldMapping::ResetFields(fm);
-				}
-			}
+		data = r;
+		return 0;
+	}
+
+	bool SelectiveInputReportParser::ExecuteOp(const ExtractOp& op, const uint8_t* report) const {
+		// The array fields have their own zone in ParseArrayField.
+		if (op.kind == ExtractOp::ARRAY)
+			return ParseArrayField(_array_fields[op.offset], report);
+
+		HRP_PROFILE_ZONE(var_field);
+		switch (op.kind) {
+		case ExtractOp::INT32:
+			return op.extract(op, report);
+		case ExtractOp::INT32_TO_BOOL:
+			return ExtractOp::ExtractInt32ToBool(op, report);
+		case ExtractOp::BITS_BYTES:
+			return ExtractOp::CopyBytes(op, report);
+		case ExtractOp::BITS_SAME_PHASE:
+			return ExtractOp::CopyBits<false>(op, report);
+		case ExtractOp::BITS_SHIFTED:
+			return ExtractOp::CopyBits<true>(op, report);
+		case ExtractOp::ARRAY:
+			break;
 		}
+		return false;
+	}
+
+	int SelectiveInputReportParser::ParseReport(const void* report, size_t report_size, bool& changed) {
+		HRP_PROFILE_ZONE(parse_report);
+		changed = false;
+		CompiledReport* cr;
+		const uint8_t* r;
+		int res = FindReport(report, report_size, cr, r);
+		if (res)
+			return res;
 
-		for (ReportFieldMapping& fm : m.fields) {
-			int res = (fm.variable
-				? ReportFieldMapping::ParseVarFields
-				: ReportFieldMapping::ParseArrayFields)(fm, r);
-			if (res)
-				return res;
+		const ResetRange* rr = _resets + cr->first_reset;
+		for (const ResetRange* e = rr + cr->num_resets; rr < e; ++rr) {
+			if (rr->int32s)
+				memset(rr->int32s, 0, sizeof(int32_t)*rr->length);
+			else
+				ClearBits(rr->bits, rr->first_bit, rr->length);
 		}
 
+		// The resets of relative variables above aren't counted as changes:
+		// zero means "no change" in case of relative variables.
+		const ExtractOp* op = _ops + cr->first_op;
+		for (const ExtractOp* e = op + cr->num_ops; op < e; ++op)
+			changed |= ExecuteOp(*op, r);
+
 		return 0;
 	}
 
-	void SelectiveInputReportParser::ReportFieldMapping::ResetFields(const ReportFieldMapping& m) {
-		for (auto const& it : m.mappings.int32_values) {
-			for (const UsageIndexRange& r : it.second)
-				memset(&it.first[r.val_min], 0, sizeof(int32_t)*r.length);
-		}
+	int SelectiveInputReportParser::ParseLazy(const void* report, size_t report_size) {
+		if (_num_reports && !_retained)
+			return ERR_LAZY_DECODING_DISABLED;
+		CompiledReport* cr;
+		const uint8_t* r;
+		int res = FindReport(report, report_size, cr, r);
+		if (res)
+			return res;
 
-		for (auto const& it : m.mappings.bool_values) {
-			for (const UsageIndexRange& r : it.second) {
-				if (r.length <= 2) {
-					for (size_t i = r.val_min, e = r.val_min + r.length; i < e; ++i)
-						it.first[i >> 3] &= ~(1 << (i & 7));
-				}
-				else {
-					size_t idx = r.val_min >> 3;
-					size_t bits_left = r.length;
-
-					uint8_t first_byte_shift = (uint8_t)(r.val_min & 7);
-					if (first_byte_shift) {
-						uint8_t bits_in_first_byte = (uint8_t)_hrp_min((size_t)(8 - first_byte_shift), bits_left);
-						bits_left -= bits_in_first_byte;
-						it.first[idx++] &= ~((((uint8_t)1 << bits_in_first_byte) - 1) << first_byte_shift);
-					}
+		memcpy(_retained + cr->retained_offset, r, cr->bit_size >> 3);
+		if (++_retain_counter == 0)
+			_retain_counter = 1;
+		cr->retained_stamp = _retain_counter;
+		return 0;
+	}
+
+	int SelectiveInputReportParser::Decode(IInt32Target* target, size_t index) {
+		if (!target)
+			return ERR_INVALID_PARAMETERS;
+		return DecodeVariable(target->Data(), nullptr, index);
+	}
 
-					size_t whole_bytes = bits_left >> 3;
-					if (whole_bytes)
-						memset(&it.first[idx], 0, whole_bytes);
+	int SelectiveInputReportParser::Decode(IBoolTarget* target, size_t index) {
+		if (!target)
+			return ERR_INVALID_PARAMETERS;
+		return DecodeVariable(nullptr, target->Data(), index);
+	}
 
-					uint8_t bits_in_last_byte = bits_left & 7;
-					if (bits_in_last_byte)
-						it.first[idx+whole_bytes] &= ~(((uint8_t)1 << bits_in_last_byte) - 1);
-				}
+	const uint32_t* SelectiveInputReportParser::FindDecodeEntries(const int32_t* int32s, const uint8_t* bits, size_t index, uint32_t& slots) const {
+		const void* data = int32s ? (const void*)int32s : bits;
+		for (uint32_t i = 0; i < _num_decode_targets; ++i) {
+			const DecodeTarget& t = _decode_targets[i];
+			if (t.data != data || t.bits != !int32s)
+				continue;
+			if (index < t.first_index || index - t.first_index >= t.num_indexes)
+				return nullptr;
+			slots = t.slots;
+			return _decode_entries + t.first_entry + (index - t.first_index) * t.slots;
+		}
+		return nullptr;
+	}
+
+	int SelectiveInputReportParser::DecodeVariable(int32_t* int32s, uint8_t* bits, size_t index) {
+		if (!_num_reports)
+			return ERR_UNINITIALISED_PARSER;
+		if (!_retained)
+			return ERR_LAZY_DECODING_DISABLED;
+
+		// The variable can be mapped by more than one report_id. The most
+		// recent retained report wins like in case of Parse.
+		uint32_t slots = 0;
+		const uint32_t* entries = FindDecodeEntries(int32s, bits, index, slots);
+		if (!entries || !entries[0])
+			return ERR_INVALID_PARAMETERS;
+
+		const CompiledReport* newest = nullptr;
+		const ExtractOp* op = nullptr;
+		for (uint32_t i = 0; i < slots && entries[i]; ++i) {
+			const ExtractOp* o = _ops + entries[i] - 1;
+			const CompiledReport& cr = _reports[o->report];
+			if (!cr.retained_stamp)
+				continue;
+			// the age calculation is correct even after a wraparound
+			if (!newest || (uint32_t)(_retain_counter - cr.retained_stamp) < (uint32_t)(_retain_counter - newest->retained_stamp)) {
+				newest = &cr;
+				op = o;
 			}
 		}
+
+		if (!newest)
+			return ERR_NOTHING_CHANGED;
+
+		if (op->relative && newest->retained_stamp != _retain_counter) {
+			// Parse would have reset it while processing the most recent report.
+			if (int32s)
+				int32s[index] = 0;
+			else
+				ClearBits(bits, index, 1);
+			return ERR_NOTHING_CHANGED;
+		}
+
+		const uint8_t* report = _retained + newest->retained_offset;
+		bool changed;
+		if (op->kind == ExtractOp::BITS_BYTES || op->kind == ExtractOp::BITS_SAME_PHASE || op->kind == ExtractOp::BITS_SHIFTED) {
+			// only the requested bit of the block
+			changed = ExtractOp::CopyBit(*op, report, index);
+		}
+		else if (op->kind == ExtractOp::INT32) {
+			// only the requested item of the run
+			uint32_t k = (uint32_t)index - op->dest_bit;
+			ExtractOp int32_op = *op;
+			int32_op.offset += k * op->size;
+			int32_op.dest.int32 += k;
+			int32_op.dest_bit = (uint32_t)index;
+			int32_op.length = 1;
+			changed = ExecuteOp(int32_op, report);
+		}
+		else {
+			changed = ExecuteOp(*op, report);
+		}
+		return changed ? 0 : ERR_NOTHING_CHANGED;
 	}
 
+
 	static bool IsOutOfRange(int32_t v, int32_t logical_min, int32_t logical_max) {
 		return v < logical_min || v > logical_max;
 	}
@@ -707,281 +1517,424 @@ namespace {
 		return v < (uint32_t)logical_min || v >(uint32_t)logical_max;
 	}
 
-	// signed int32_t value
-	static void SetInt32Value(int32_t& dest, int32_t v, int32_t logical_min, int32_t logical_max, bool relative) {
-		// From the HID specification:
-		//   If the host or the device receives an out-of-range value then
-		//   the current value for the respective control will not be modified.
-		if (IsOutOfRange(v, logical_min, logical_max)) {
-			if (relative)
-				dest = 0;
-			else
-				dest = v;
+	// Reads a size-bits wide (1-32) unsigned integer starting at the specified
+	// bit offset of the report.
+	static uint32_t ReadBits(const uint8_t* report, size_t bit_offset, size_t size) {
+		uint8_t shift = (uint8_t)(bit_offset & 7);
+		size_t idx = bit_offset >> 3;
+
+		// n is the number of bytes in the report array that contain our report_size-bits long integer
+		// Example: A 10-bit integer may span 2 or 3 bytes. It spans 3 bytes only if the first bit
+		//          starts at the most significant bit of the first byte (in which case shift==7).
+		// An unaligned 32 bit integer spans 5 bytes but the HID specification clearly states that
+		// the maximum span is 4 bytes so 32 bit values can satisfy that only by being byte-aligned.
+		uint8_t n = (uint8_t)((shift + size + 7) >> 3);
+
+		uint32_t v = 0;
+		switch (n) {
+		case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
+		case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
+		case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
+		case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
+		case 1: v |= report[idx] >> shift;
+		}
+
+		// zero'ing the bits above position 'size'
+		return v & (((uint32_t)1 << size) - 1);
+	}
+
+	static void SetChangedBit(uint8_t* changed, size_t index) {
+		if (changed)
+			changed[index >> 3] |= (uint8_t)(1 << (index & 7));
+	}
+
+	// A relative variable (like the X/Y delta of a mouse) changes whenever it
+	// isn't zero. Other variables change only if they receive a new value.
+	static bool TrackInt32Change(int32_t prev, int32_t v, bool relative, uint8_t* changed, size_t index) {
+		if (relative ? v == 0 : v == prev)
+			return false;
+		SetChangedBit(changed, index);
+		return true;
+	}
+
+	// Reads an integer field and sign- or zero-extends it to 32 bits.
+	// BYTES==0: offset and size are in bits, otherwise offset is in bytes.
+	template <uint8_t BYTES, bool SIGNED>
+	static int32_t ReadInt32Field(const uint8_t* report, size_t offset, uint8_t size) {
+		uint32_t v;
+		uint32_t bits;
+		if (BYTES == 0) {
+			v = ReadBits(report, offset, size);
+			bits = size;
 		}
 		else {
-			dest = v;
+			// integer fields are often byte-aligned in HID descriptors
+			const uint8_t* p = report + offset;
+			v = p[0];
+			if (BYTES >= 2) v |= (uint32_t)p[1] << 8;
+			if (BYTES >= 3) v |= (uint32_t)p[2] << 16;
+			if (BYTES >= 4) v |= (uint32_t)p[3] << 24;
+			bits = BYTES * 8;
+		}
+		if (SIGNED && bits < 32) {
+			// https://graphics.stanford.edu/~seander/bithacks.html#VariableSignExtend
+			uint32_t mask = (uint32_t)1 << (bits - 1);
+			v = (v ^ mask) - mask;
+		}
+		return (int32_t)v;
+	}
+
+	template <uint8_t BYTES, bool SIGNED, uint8_t MODE>
+	bool SelectiveInputReportParser::ExtractOp::ExtractInt32(const ExtractOp& op, const uint8_t* report) {
+		bool changed = false;
+		size_t offset = op.offset;
+		for (uint32_t i = 0; i < op.length; ++i, offset += BYTES ? BYTES : op.size) {
+			int32_t v = ReadInt32Field<BYTES, SIGNED>(report, offset, op.size);
+			if (MODE == INT32_RELATIVE_CHECKED) {
+				// From the HID specification:
+				//   If the host or the device receives an out-of-range value then
+				//   the current value for the respective control will not be modified.
+				// Out-of-range absolute values are stored as they are because
+				// applications use them as null values (e.g. a released hat switch)
+				// but a relative value has to be ignored.
+				bool out_of_range = SIGNED ? IsOutOfRange(v, op.logical_min, op.logical_max) :
+					IsOutOfRange((uint32_t)v, op.logical_min, op.logical_max);
+				if (out_of_range)
+					v = 0;
+			}
+
+			int32_t prev = op.dest.int32[i];
+			op.dest.int32[i] = v;
+			changed |= TrackInt32Change(prev, v, MODE != INT32_ABSOLUTE, op.changed, op.dest_bit + i);
+		}
+		return changed;
+	}
+
+	// Returns true if every value of the field is within the logical range.
+	static bool LogicalRangeCoversField(bool signed_, uint32_t bits, int32_t logical_min, int32_t logical_max) {
+		if (signed_) {
+			int64_t half = (int64_t)1 << (bits - 1);
+			return logical_min <= -half && logical_max >= half - 1;
 		}
+		return bits < 32 && logical_min <= 0 && (int64_t)logical_max >= ((int64_t)1 << bits) - 1;
 	}
 
-	// unsigned uint32_t value
-	static void SetInt32Value(int32_t& dest, uint32_t v, int32_t logical_min, int32_t logical_max, bool relative) {
-		// From the HID specification:
-		//   If the host or the device receives an out-of-range value then
-		//   the current value for the respective control will not be modified.
-		if (IsOutOfRange(v, logical_min, logical_max)) {
-			if (relative)
-				dest = 0;
+	SelectiveInputReportParser::ExtractOp::extract_fn SelectiveInputReportParser::ExtractOp::SelectInt32Extractor(const ExtractOp& op) {
+#define HRP_INT32_EXTRACTORS(BYTES, SIGNED) \
+		{ &ExtractInt32<BYTES, SIGNED, INT32_ABSOLUTE>, &ExtractInt32<BYTES, SIGNED, INT32_RELATIVE>, &ExtractInt32<BYTES, SIGNED, INT32_RELATIVE_CHECKED> }
+		static const extract_fn EXTRACTORS[5][2][3] = {
+			{ HRP_INT32_EXTRACTORS(0, false), HRP_INT32_EXTRACTORS(0, true) },
+			{ HRP_INT32_EXTRACTORS(1, false), HRP_INT32_EXTRACTORS(1, true) },
+			{ HRP_INT32_EXTRACTORS(2, false), HRP_INT32_EXTRACTORS(2, true) },
+			{ HRP_INT32_EXTRACTORS(3, false), HRP_INT32_EXTRACTORS(3, true) },
+			{ HRP_INT32_EXTRACTORS(4, false), HRP_INT32_EXTRACTORS(4, true) },
+		};
+#undef HRP_INT32_EXTRACTORS
+
+		uint8_t bytes = op.byte_aligned ? op.size : 0;
+		uint32_t bits = op.byte_aligned ? op.size * 8 : op.size;
+		assert(bytes <= 4 && bits >= 1 && bits <= 32);
+
+		uint8_t mode = INT32_ABSOLUTE;
+		if (op.relative) {
+			// The range check can be skipped if the field can't hold
+			// out-of-range values.
+			if (LogicalRangeCoversField(op.signed_, bits, op.logical_min, op.logical_max))
+				mode = INT32_RELATIVE;
 			else
-				dest = v;
+				mode = INT32_RELATIVE_CHECKED;
+		}
+		return EXTRACTORS[bytes][op.signed_ ? 1 : 0][mode];
+	}
+
+	bool SelectiveInputReportParser::ExtractOp::ExtractInt32ToBool(const ExtractOp& op, const uint8_t* report) {
+		uint32_t v = ReadBits(report, op.offset, op.size);
+
+		bool out_of_range;
+		if (op.signed_) {
+			// sign-extending the op.size-bits wide integer
+			int32_t mask = (uint32_t)1 << (op.size - 1);
+			int32_t sv = (int32_t)((v ^ mask) - mask);
+			out_of_range = IsOutOfRange(sv, op.logical_min, op.logical_max);
 		}
 		else {
-			dest = (int32_t)v;
+			out_of_range = IsOutOfRange(v, op.logical_min, op.logical_max);
 		}
+
+		if (out_of_range)
+			return false;
+
+		uint32_t i = op.dest_bit;
+		bool was_set = 0 != (op.dest.bits[i >> 3] & (1 << (i & 7)));
+		if (v)
+			op.dest.bits[i >> 3] |= 1 << (i & 7);
+		else
+			op.dest.bits[i >> 3] &= ~(1 << (i & 7));
+
+		if (op.relative ? !v : was_set == (v != 0))
+			return false;
+		SetChangedBit(op.changed, i);
+		return true;
 	}
 
-	int SelectiveInputReportParser::ReportFieldMapping::ParseVarFields(const ReportFieldMapping& m, const uint8_t* report) {
+#if HRP_WORD_AT_A_TIME_BIT_COPY
+	// size_t is 32 bits wide on 32-bit MCUs and 64 bits wide on most hosts.
+	typedef size_t bit_copy_word_t;
 
-		// IInt32Target
+	static bit_copy_word_t LoadWord(const uint8_t* p) {
+		bit_copy_word_t w;
+		memcpy(&w, p, sizeof(w));
+		return w;
+	}
 
-		if (m.byte_aligned) {
-			// integer fields are often byte-aligned in HID descriptors
-			size_t offset = m.bit_offset >> 3;
-			size_t size = m.report_size >> 3;
-			if (m.signed_) {
-				for (auto const& it : m.mappings.int32_values) {
-					for (const UsageIndexRange& r : it.second) {
-						for (size_t i=r.val_min,e=r.val_min+r.length,k=offset+r.desc_min*size; i<e; ++i,k+=size) {
-							int32_t v;
-							switch (size) {
-							case 1: v = (int8_t)report[k]; break;
-							case 2: v = (int16_t)((int16_t)report[k] | ((int16_t)report[k+1] << 8)); break;
-							case 3: v = (int32_t)((int16_t)report[k] | ((int16_t)report[k+1] << 8) | ((int32_t)(int8_t)report[k+2] << 16)); break;
-							default: v = (int32_t)((int32_t)report[k] | ((int32_t)report[k+1] << 8) | ((int32_t)report[k+2] << 16) | ((int32_t)report[k+3] << 24)); break;
-							}
-							SetInt32Value(it.first[i], v, m.logical_min, m.logical_max, m.relative);
-						}
-					}
-				}
-			}
-			else { // !m.signed_
-				for (auto const& it : m.mappings.int32_values) {
-					for (const UsageIndexRange& r : it.second) {
-						for (size_t i=r.val_min,e=r.val_min+r.length,k=offset+r.desc_min*size; i<e; ++i,k+=size) {
-							uint32_t v;
-							switch (size) {
-							case 1: v = report[k]; break;
-							case 2: v = report[k] | ((uint16_t)report[k+1] << 8); break;
-							case 3: v = report[k] | ((uint16_t)report[k+1] << 8) | ((uint32_t)report[k+2] << 16); break;
-							default: v = report[k] | ((uint16_t)report[k+1] << 8) | ((uint32_t)report[k+2] << 16) | ((uint32_t)report[k+3] << 24); break;
-							}
-							SetInt32Value(it.first[i], v, m.logical_min, m.logical_max, m.relative);
-						}
-					}
-				}
-			}
-		}
-		else { // !m.byte_aligned
+	static void StoreWord(uint8_t* p, bit_copy_word_t w) {
+		memcpy(p, &w, sizeof(w));
+	}
+#elif HRP_ALIGNED_WORD_BIT_COPY
+	// p has to be 4-byte aligned. The memcpy compiles to a single ldr/str.
+	static uint32_t LoadAlignedWord(const uint8_t* p) {
+		uint32_t w;
+		memcpy(&w, __builtin_assume_aligned(p, 4), sizeof(w));
+		return w;
+	}
 
-			size_t size = m.report_size;
-			size_t limited_size = _hrp_min(size, size_t(32));
+	static void StoreAlignedWord(uint8_t* p, uint32_t w) {
+		memcpy(__builtin_assume_aligned(p, 4), &w, sizeof(w));
+	}
+#endif
 
-			// https://graphics.stanford.edu/~seander/bithacks.html#VariableSignExtend
-			int32_t mask = m.signed_ ? (uint32_t)1 << (limited_size - 1) : 0;
+	// Stores the masked bits of v in *dest and returns the changed bits.
+	static uint8_t MergeByte(uint8_t* dest, uint8_t* changed, uint8_t v, uint8_t mask, bool relative) {
+		uint8_t prev = *dest;
+		*dest = (uint8_t)((prev & ~mask) | v);
+		uint8_t diff = relative ? v : (uint8_t)((prev & mask) ^ v);
+		if (changed)
+			*changed |= diff;
+		return diff;
+	}
 
-			for (auto const& it : m.mappings.int32_values) {
-				for (const UsageIndexRange& r : it.second) {
-					for (size_t i=r.val_min,e=r.val_min+r.length,k=m.bit_offset+r.desc_min*size; i<e; ++i,k+=size) {
-						uint8_t shift = (uint8_t)(k & 7);
-						size_t idx = k >> 3;
-
-						// n is the number of bytes in the report array that contain our report_size-bits long integer
-						// Example: A 10-bit integer may span 2 or 3 bytes. It spans 3 bytes only if the first bit
-						//          starts at the most significant bit of the first byte (in which case shift==7).
-						// An unaligned 32 bit integer spans 5 bytes but the HID specification clearly states that
-						// the maximum span is 4 bytes so 32 bit values can satisfy that only by being byte-aligned.
-						uint8_t n = (uint8_t)((shift + limited_size + 7) >> 3);
-
-						uint32_t v = 0;
-						switch (n) {
-						case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
-						case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
-						case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
-						case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
-						case 1: v |= report[idx] >> shift;
-						}
-
-						// zero'ing the bits above position 'limited_size'
-						v &= ((uint32_t)1 << limited_size) - 1;
-
-						if (m.signed_) {
-							// sign-extending the limited_size-bits wide integer
-							int32_t sv = (int32_t)((v ^ mask) - mask);
-							SetInt32Value(it.first[i], sv, m.logical_min, m.logical_max, m.relative);
-						}
-						else {
-							SetInt32Value(it.first[i], v, m.logical_min, m.logical_max, m.relative);
-						}
+	// Copies the whole bytes [begin, end) of CopyWholeBytes one at a time.
+	template <bool SHIFTED>
+	static bool CopyByteRange(uint8_t* dest, uint8_t* changed, const uint8_t* src, size_t begin, size_t end, uint8_t shift, bool relative) {
+		bool any_changed = false;
+		for (size_t i = begin; i < end; ++i) {
+			uint8_t v = src[i];
+			if (SHIFTED)
+				v = (uint8_t)((v >> shift) | (src[i + 1] << (8 - shift)));
+			uint8_t prev = dest[i];
+			dest[i] = v;
+			uint8_t diff = relative ? v : (uint8_t)(prev ^ v);
+			if (diff) {
+				any_changed = true;
+				if (changed)
+					changed[i] |= diff;
+			}
+		}
+		return any_changed;
+	}
+
+	// Copies num_bytes whole bytes into dest. If SHIFTED is true then each
+	// destination byte is assembled from two adjacent source bytes starting
+	// at bit position 'shift' (1-7) of src[0] so src has num_bytes+1 bytes.
+	// Returns true if at least one destination bit changed.
+	template <bool SHIFTED>
+	static bool CopyWholeBytes(uint8_t* dest, uint8_t* changed, const uint8_t* src, size_t num_bytes, uint8_t shift, bool relative) {
+		bool any_changed = false;
+		size_t i = 0;
+#if HRP_WORD_AT_A_TIME_BIT_COPY
+		static constexpr size_t WORD_BITS = sizeof(bit_copy_word_t) * 8;
+		for (; i + sizeof(bit_copy_word_t) <= num_bytes; i += sizeof(bit_copy_word_t)) {
+			bit_copy_word_t v = LoadWord(src + i);
+			if (SHIFTED)
+				v = (v >> shift) | ((bit_copy_word_t)src[i + sizeof(bit_copy_word_t)] << (WORD_BITS - shift));
+			bit_copy_word_t prev = LoadWord(dest + i);
+			StoreWord(dest + i, v);
+			bit_copy_word_t diff = relative ? v : prev ^ v;
+			if (diff) {
+				any_changed = true;
+				if (changed)
+					StoreWord(changed + i, LoadWord(changed + i) | diff);
+			}
+		}
+#elif HRP_ALIGNED_WORD_BIT_COPY
+		// The head bytes bring dest to a word boundary. The source bits of
+		// a destination word start 'bit' bits into the aligned source word w
+		// and are funnel-shifted out of w and the word after it. The head is
+		// extended by a word if w would start before src and the loop stops
+		// before w reads past the last source byte.
+		i = (size_t)(-(uintptr_t)dest & 3);
+		size_t offset = (size_t)((uintptr_t)(src + i) & 3);
+		if (i < offset)
+			i += 4;
+		if (i + 8 <= num_bytes) {
+			any_changed = CopyByteRange<SHIFTED>(dest, changed, src, 0, i, shift, relative);
+			const uint8_t* src_end = src + num_bytes + (SHIFTED ? 1 : 0);
+			const uint8_t* w = src + i - offset;
+			uint32_t bit = (uint32_t)offset * 8 + shift;
+			for (; i + 4 <= num_bytes && w + (bit ? 8 : 4) <= src_end; i += 4, w += 4) {
+				uint32_t v = LoadAlignedWord(w);
+				if (bit)
+					v = (v >> bit) | (LoadAlignedWord(w + 4) << (32 - bit));
+				uint32_t prev = LoadAlignedWord(dest + i);
+				StoreAlignedWord(dest + i, v);
+				uint32_t diff = relative ? v : prev ^ v;
+				if (diff) {
+					any_changed = true;
+					// changed doesn't have to be aligned like dest
+					if (changed) {
+						for (int b = 0; b < 4; ++b)
+							changed[i + b] |= (uint8_t)(diff >> (b * 8));
 					}
 				}
 			}
 		}
+		else {
+			i = 0;
+		}
+#endif
+		return CopyByteRange<SHIFTED>(dest, changed, src, i, num_bytes, shift, relative) || any_changed;
+	}
 
-		// IBoolTarget
+	bool SelectiveInputReportParser::ExtractOp::CopyBytes(const ExtractOp& op, const uint8_t* report) {
+		// The source and destination are byte-aligned and the length is a
+		// multiple of 8. This is the common case for gamepad buttons and
+		// NKRO keyboard bitfields.
+		uint8_t* dest = op.dest.bits + (op.dest_bit >> 3);
+		const uint8_t* src = report + (op.offset >> 3);
+		size_t num_bytes = op.length >> 3;
+		if (!op.changed && !op.relative) {
+			if (!memcmp(dest, src, num_bytes))
+				return false;
+			memcpy(dest, src, num_bytes);
+			return true;
+		}
+		uint8_t* changed = op.changed ? op.changed + (op.dest_bit >> 3) : nullptr;
+		return CopyWholeBytes<false>(dest, changed, src, num_bytes, 0, op.relative);
+	}
 
-		if (m.report_size == 1) {
-			// This is a bitfield that can be very long: up to HRP_MAX_REPORT_COUNT bits.
-			// A typical example to this is an NKRO gaming keyboard sending 100+
-			// keys but many other gaming- and simulation-related devices send
-			// the state of similarly high number of buttons in large bitfields.
+	bool SelectiveInputReportParser::ExtractOp::CopyBit(const ExtractOp& op, const uint8_t* report, size_t index) {
+		size_t k = op.offset + (index - op.dest_bit);
+		uint8_t mask = (uint8_t)(1 << (index & 7));
+		uint8_t v = (report[k >> 3] >> (k & 7)) & 1 ? mask : 0;
+		uint8_t* c = op.changed ? &op.changed[index >> 3] : nullptr;
+		return 0 != MergeByte(&op.dest.bits[index >> 3], c, v, mask, op.relative);
+	}
 
-			// As a 1-bit integer the value of 1 can be interpreted as either
-			// 1 or -1 so logical_max can be anything but zero. In practice
-			// logical_min and logical_max will be 0 and 1 respectively 99.99%
-			// of the time. Anything else is likely to be a pathological case.
-			if (m.logical_min <= 0 && m.logical_max != 0) {
-				// bit_copy_t must be an unsigned integral type that is at least 16 bits wide.
-				typedef size_t bit_copy_t;  // C99 standard: The bit width of size_t is not less than 16.
-				static_assert(sizeof(bit_copy_t)>=2 && sizeof(bit_copy_t)<=8, "the width of bit_copy_t must be between 16 and 64 bits");
-				static_assert((bit_copy_t)-1 > (bit_copy_t)0, "bit_copy_t must be unsigned");
-				// MAX_BLOCK_SIZE is the maximum number of bits we shift and move
-				// from the source to the destination in a bit_copy_t instance.
-				static constexpr size_t MAX_BLOCK_SIZE = sizeof(bit_copy_t) * 8 - 8;
-
-				for (auto const& it : m.mappings.bool_values) {
-					uint8_t* bits = it.first;
-					for (const UsageIndexRange& r : it.second) {
-						size_t bits_remaining = r.length;
-						for (size_t i=r.val_min,k=m.bit_offset+r.desc_min; bits_remaining; i+=MAX_BLOCK_SIZE,k+=MAX_BLOCK_SIZE) {
-							size_t block_size = _hrp_min(bits_remaining, MAX_BLOCK_SIZE);
-							bits_remaining -= block_size;
-
-							int8_t shift_src = (int8_t)(k & 7);
-							int8_t shift_dest = (int8_t)(i & 7);
-							// positive shift -> left shift
-							// negative shift -> right shift (by -shift number of bits)
-							int8_t shift = shift_dest - shift_src;
-
-							bit_copy_t mask = (((bit_copy_t)1 << block_size) - 1) << shift_dest;
-							bit_copy_t v = 0;
-							{
-								// source
-								size_t idx = k >> 3;
-								uint8_t n = (uint8_t)((shift_src + block_size + 7) >> 3);
-
-								if (shift == 0) {
-									switch (n) {
-									case 8: v |= (bit_copy_t)report[idx+7] << 56;
-									case 7: v |= (bit_copy_t)report[idx+6] << 48;
-									case 6: v |= (bit_copy_t)report[idx+5] << 40;
-									case 5: v |= (bit_copy_t)report[idx+4] << 32;
-									case 4: v |= (bit_copy_t)report[idx+3] << 24;
-									case 3: v |= (bit_copy_t)report[idx+2] << 16;
-									case 2: v |= (bit_copy_t)report[idx+1] << 8;
-									case 1: v |= (bit_copy_t)report[idx];
-									}
-								}
-								else {
-									switch (n) {
-									case 8: v |= (bit_copy_t)report[idx+7] << (56 + shift);
-									case 7: v |= (bit_copy_t)report[idx+6] << (48 + shift);
-									case 6: v |= (bit_copy_t)report[idx+5] << (40 + shift);
-									case 5: v |= (bit_copy_t)report[idx+4] << (32 + shift);
-									case 4: v |= (bit_copy_t)report[idx+3] << (24 + shift);
-									case 3: v |= (bit_copy_t)report[idx+2] << (16 + shift);
-									case 2: v |= (bit_copy_t)report[idx+1] << (8 + shift);
-									case 1: v |= (shift<0) ? ((bit_copy_t)report[idx] >> -shift) : ((bit_copy_t)report[idx] << shift);
-									}
-								}
-
-								v &= mask;
-							}
-
-							{
-								// destination
-								size_t idx = i >> 3;
-								uint8_t n = (uint8_t)((shift_dest + block_size + 7) >> 3);
-								mask = ~mask;
-
-								switch (n) {
-								case 8: bits[idx+7] = (sizeof(bit_copy_t)!=8 && n>8) ? (uint8_t)(v >> 56) : ((bits[idx+7] & (uint8_t)(mask >> 56)) | (uint8_t)(v >> 56));
-								case 7: bits[idx+6] = (sizeof(bit_copy_t)!=7 && n>7) ? (uint8_t)(v >> 48) : ((bits[idx+6] & (uint8_t)(mask >> 48)) | (uint8_t)(v >> 48));
-								case 6: bits[idx+5] = (sizeof(bit_copy_t)!=6 && n>6) ? (uint8_t)(v >> 40) : ((bits[idx+5] & (uint8_t)(mask >> 40)) | (uint8_t)(v >> 40));
-								case 5: bits[idx+4] = (sizeof(bit_copy_t)!=5 && n>5) ? (uint8_t)(v >> 32) : ((bits[idx+4] & (uint8_t)(mask >> 32)) | (uint8_t)(v >> 32));
-								case 4: bits[idx+3] = (sizeof(bit_copy_t)!=4 && n>4) ? (uint8_t)(v >> 24) : ((bits[idx+3] & (uint8_t)(mask >> 24)) | (uint8_t)(v >> 24));
-								case 3: bits[idx+2] = (sizeof(bit_copy_t)!=3 && n>3) ? (uint8_t)(v >> 16) : ((bits[idx+2] & (uint8_t)(mask >> 16)) | (uint8_t)(v >> 16));
-								case 2: bits[idx+1] = (sizeof(bit_copy_t)!=2 && n>2) ? (uint8_t)(v >> 8)  : ((bits[idx+1] & (uint8_t)(mask >> 8))  | (uint8_t)(v >> 8));
-								case 1: bits[idx] = (bits[idx] & (uint8_t)mask) | (uint8_t)v;
-								}
-							}
-						}
-					}
-				}
-			}
+	template <bool SHIFTED>
+	bool SelectiveInputReportParser::ExtractOp::CopyBits(const ExtractOp& op, const uint8_t* report) {
+		// This is a bitfield that can be very long: up to HRP_MAX_REPORT_COUNT bits.
+		// A typical example to this is an NKRO gaming keyboard sending 100+
+		// keys but many other gaming- and simulation-related devices send
+		// the state of similarly high number of buttons in large bitfields.
+		//
+		// The copy is split into a partial head byte that brings the
+		// destination to a byte boundary, whole destination bytes and a
+		// partial tail byte. Only the whole bytes are worth optimizing.
+		size_t k = op.offset;
+		size_t i = op.dest_bit;
+		size_t bits_remaining = op.length;
+		bool changed = false;
+
+		uint8_t head = (uint8_t)((8 - (i & 7)) & 7);
+		if (head) {
+			head = (uint8_t)_hrp_min(bits_remaining, (size_t)head);
+			uint8_t shift = (uint8_t)(i & 7);
+			uint8_t v = (uint8_t)(ReadBits(report, k, head) << shift);
+			uint8_t mask = (uint8_t)((((unsigned)1 << head) - 1) << shift);
+			uint8_t* c = op.changed ? &op.changed[i >> 3] : nullptr;
+			changed |= 0 != MergeByte(&op.dest.bits[i >> 3], c, v, mask, op.relative);
+			k += head;
+			i += head;
+			bits_remaining -= head;
 		}
-		else { // m.report_size > 1
 
-			// This branch maps integer fields of the reports onto bool fields
-			// of the application. No one should do this in practice.
+		size_t num_bytes = bits_remaining >> 3;
+		if (num_bytes) {
+			assert(SHIFTED == ((k & 7) != 0));
+			uint8_t* c = op.changed ? &op.changed[i >> 3] : nullptr;
+			changed |= CopyWholeBytes<SHIFTED>(&op.dest.bits[i >> 3], c, &report[k >> 3], num_bytes, (uint8_t)(k & 7), op.relative);
+			k += num_bytes * 8;
+			i += num_bytes * 8;
+			bits_remaining &= 7;
+		}
 
-			size_t size = m.report_size;
-			size_t limited_size = _hrp_min(size, size_t(32));
+		if (bits_remaining) {
+			uint8_t v = (uint8_t)ReadBits(report, k, bits_remaining);
+			uint8_t mask = (uint8_t)(((unsigned)1 << bits_remaining) - 1);
+			uint8_t* c = op.changed ? &op.changed[i >> 3] : nullptr;
+			changed |= 0 != MergeByte(&op.dest.bits[i >> 3], c, v, mask, op.relative);
+		}
+		return changed;
+	}
 
-			int32_t mask = m.signed_ ? (uint32_t)1 << (limited_size - 1) : 0;
+	bool SelectiveInputReportParser::ParseArrayField(const ArrayField& af, const uint8_t* report) const {
+		HRP_PROFILE_ZONE(array_field);
+		// ParseArrayItems resets all variables and then sets the ones
+		// referenced by the items so the changes are found by comparing the
+		// variables with a snapshot taken before parsing. The snapshot is
+		// small: a keyboard's 6-byte array maps onto a 32-byte bitfield.
+		const ArrayRange* ranges = _array_ranges + af.first_range;
+		const ArrayRange* ranges_end = ranges + af.num_ranges;
+
+		uint8_t* p = _array_snapshot;
+		for (const ArrayRange* ar = ranges; ar < ranges_end; ++ar) {
+			if (ar->int32s) {
+				memcpy(p, &ar->int32s[ar->val_min], sizeof(int32_t) * ar->length);
+				p += sizeof(int32_t) * ar->length;
+			}
+			else {
+				size_t n = BitRangeBytes(ar->val_min, ar->length);
+				memcpy(p, &ar->bits[ar->val_min >> 3], n);
+				p += n;
+			}
+		}
 
-			for (auto const& it : m.mappings.bool_values) {
-				for (const UsageIndexRange& r : it.second) {
-					for (size_t i=r.val_min,e=r.val_min+r.length,k=m.bit_offset+r.desc_min*size; i<e; ++i,k+=size) {
-						uint8_t shift = (uint8_t)(k & 7);
-						size_t idx = k >> 3;
-
-						uint8_t n = (uint8_t)((shift + limited_size + 7) >> 3);
-						uint32_t v = 0;
-						switch (n) {
-						case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
-						case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
-						case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
-						case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
-						case 1: v |= report[idx] >> shift;
-						}
-
-						// zero'ing the bits above position 'limited_size'
-						v &= ((uint32_t)1 << limited_size) - 1;
-
-						bool out_of_range;
-						if (m.signed_) {
-							// sign-extending the limited_size-bits wide integer
-							int32_t sv = (int32_t)((v ^ mask) - mask);
-							out_of_range = IsOutOfRange(sv, m.logical_min, m.logical_max);
-						}
-						else {
-							out_of_range = IsOutOfRange(v, m.logical_min, m.logical_max);
-						}
-
-						if (!out_of_range) {
-							if (v)
-								it.first[i >> 3] |= 1 << (i & 7);
-							else
-								it.first[i >> 3] &= ~(1 << (i & 7));
-						}
+		ParseArrayItems(af, report);
+
+		bool changed = false;
+		p = _array_snapshot;
+		for (const ArrayRange* ar = ranges; ar < ranges_end; ++ar) {
+			if (ar->int32s) {
+				for (size_t i = ar->val_min, e = i + ar->length; i < e; ++i) {
+					int32_t prev;
+					memcpy(&prev, p, sizeof(prev));
+					p += sizeof(prev);
+					changed |= TrackInt32Change(prev, ar->int32s[i], af.relative, ar->changed, i);
+				}
+			}
+			else {
+				for (size_t i = ar->val_min >> 3, e = i + BitRangeBytes(ar->val_min, ar->length); i < e; ++i, ++p) {
+					uint8_t cur = ar->bits[i];
+					uint8_t diff = af.relative ? cur : (uint8_t)(*p ^ cur);
+					diff &= BitRangeByteMask(ar->val_min, ar->length, i);
+					if (diff) {
+						changed = true;
+						if (ar->changed)
+							ar->changed[i] |= diff;
 					}
 				}
 			}
 		}
-
-		return 0;
+		return changed;
 	}
 
-	int SelectiveInputReportParser::ReportFieldMapping::ParseArrayFields(const ReportFieldMapping& m, const uint8_t* report) {
-		// Zeroing out the bitfields and the rest of the function will set only
-		// those bits that are referenced by the integer values found in the array.
-		ResetFields(m);
+	void SelectiveInputReportParser::ParseArrayItems(const ArrayField& af, const uint8_t* report) const {
+		// Zeroing out the variables and the rest of the function will set only
+		// those that are referenced by the integer values found in the array.
+		const ArrayRange* ar = _array_ranges + af.first_range;
+		for (const ArrayRange* e = ar + af.num_ranges; ar < e; ++ar) {
+			if (ar->int32s)
+				memset(&ar->int32s[ar->val_min], 0, sizeof(int32_t) * ar->length);
+			else
+				ClearBits(ar->bits, ar->val_min, ar->length);
+		}
 
-		if (m.byte_aligned) {
+		if (af.byte_aligned) {
 			// integer fields are often byte-aligned in HID descriptors
-			size_t offset = m.bit_offset >> 3;
-			size_t size = m.report_size >> 3;
+			size_t offset = af.bit_offset >> 3;
+			size_t size = af.report_size >> 3;
 
-			for (size_t i=offset,e=offset+m.report_count*size; i<e; i+=size) {
+			for (size_t i=offset,e=offset+af.report_count*size; i<e; i+=size) {
 				uint32_t v;
 				switch (size) {
 				case 1: v = report[i]; break;
@@ -990,73 +1943,61 @@ namespace {
 				default: v = report[i] | ((uint16_t)report[i+1] << 8) | ((uint32_t)report[i+2] << 16) | ((uint32_t)report[i+3] << 24); break;
 				}
 
-				ProcessArrayItem(m, v);
+				ProcessArrayItem(af, v);
 			}
 		}
-		else { // !m.byte_aligned
-			size_t size = m.report_size;
+		else { // !af.byte_aligned
+			size_t size = af.report_size;
 			size_t limited_size = _hrp_min(size, size_t(32));
 
-			for (size_t i=m.bit_offset,e=m.bit_offset+m.report_count*size; i<e; i+=size) {
-				uint8_t shift = (uint8_t)(i & 7);
-				size_t idx = i >> 3;
-
-				// n is the number of bytes in the report array that contain our report_size-bits long integer
-				// Example: A 10-bit integer may span 2 or 3 bytes. It spans 3 bytes only if the first bit
-				//          starts at the most significant bit of the first byte (in which case shift==7).
-				// An unaligned 32 bit integer spans 5 bytes but the HID specification clearly states that
-				// the maximum span is 4 bytes so 32 bit values can satisfy that only by being byte-aligned.
-				uint8_t n = (uint8_t)((shift + limited_size + 7) >> 3);
-
-				uint32_t v = 0;
-				switch (n) {
-				case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
-				case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
-				case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
-				case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
-				case 1: v |= report[idx] >> shift;
-				}
-
-				// zero'ing the bits above position 'limited_size'
-				v &= ((uint32_t)1 << limited_size) - 1;
-
-				ProcessArrayItem(m, v);
+			for (size_t i=af.bit_offset,e=af.bit_offset+af.report_count*size; i<e; i+=size) {
+				uint32_t v = ReadBits(report, i, limited_size);
+				ProcessArrayItem(af, v);
 			}
 		}
-		return 0;
 	}
 
-	void SelectiveInputReportParser::ReportFieldMapping::ProcessArrayItem(const ReportFieldMapping& m, uint32_t item) {
-		if (IsOutOfRange(item, m.logical_min, m.logical_max))
+	void SelectiveInputReportParser::ProcessArrayItem(const ArrayField& af, uint32_t item) const {
+		if (IsOutOfRange(item, af.logical_min, af.logical_max))
 			return;
-		item -= m.logical_min;
-		if (item == 0 && m.first_usage_is_zero)
+		item -= af.logical_min;
+		if (item == 0 && af.first_usage_is_zero)
 			return;
 
-		// I don't know why anyone would use IInt32Target to store bool values
-		// but we provide the implementation for the sake of completeness...
-		for (auto const& it : m.mappings.int32_values) {
-			for (const UsageIndexRange& r : it.second) {
-				if (item >= r.desc_min && item < r.desc_min + r.length) {
-					it.first[r.val_min + item - r.desc_min] = 1;
-					return;
-				}
-			}
+		if (af.lookup_size) {
+			uint32_t idx = _array_lookups[af.first_lookup + item];
+			if (!idx)
+				return;
+			idx--;
+			if (af.lookup_bits)
+				af.lookup_bits[idx >> 3] |= (uint8_t)(1 << (idx & 7));
+			else
+				af.lookup_int32s[idx] = 1;
+			return;
 		}
 
-		for (auto const& it : m.mappings.bool_values) {
-			for (const UsageIndexRange& r : it.second) {
-				if (item >= r.desc_min && item < r.desc_min + r.length) {
-					size_t idx = r.val_min + item - r.desc_min;
-					it.first[idx >> 3] |= (uint8_t)(1 << (idx & 7));
-					return;
-				}
+		// I don't know why anyone would use IInt32Target to store bool values
+		// but we provide the implementation for the sake of completeness...
+		const ArrayRange* ar = _array_ranges + af.first_range;
+		for (const ArrayRange* e = ar + af.num_ranges; ar < e; ++ar) {
+			if (item >= ar->desc_min && item < ar->desc_min + ar->length) {
+				size_t idx = ar->val_min + item - ar->desc_min;
+				if (ar->int32s)
+					ar->int32s[idx] = 1;
+				else
+					ar->bits[idx >> 3] |= (uint8_t)(1 << (idx & 7));
+				return;
 			}
 		}
 	}
 
 	int SelectiveInputReportParser::DescriptorMapper::MapFields(const void* descriptor, size_t descriptor_size) {
-		ResizeVectors(_root);
+		{
+			// ResizeVectors is recursive so its zone is entered here.
+			HRP_PROFILE_ZONE(resize_vectors);
+			SizeConfigVectors(_root);
+			ResizeVectors(_root);
+		}
 
 		DescriptorParser dp;
 		int res = dp.Parse(descriptor, descriptor_size, this);
@@ -1080,19 +2021,45 @@ namespace {
 		return 0;
 	}
 
-	void SelectiveInputReportParser::DescriptorMapper::ResizeVectors(Collection* c) {
+	void SelectiveInputReportParser::PrepareConfig(Collection* input_fields) {
+		if (input_fields)
+			DescriptorMapper::SizeConfigVectors(input_fields);
+	}
+
+	// assign doesn't allocate if the vectors are already large enough
+	// (PrepareConfig or an earlier Init with the same config).
+	void SelectiveInputReportParser::DescriptorMapper::SizeConfigVectors(Collection* c) {
 		for (Int32Fields* f : c->int32s) {
 			size_t n = CountUsages(f->usages.data(), f->usages.size());
 			f->mapped.assign(n, false);
 			f->properties.assign(n, {});
-			if (f->target)
+		}
+		for (BoolFields* f : c->bools)
+			f->mapped.assign(CountUsages(f->usages.data(), f->usages.size()), false);
+		for (Collection* child : c->collections)
+			SizeConfigVectors(child);
+	}
+
+	void SelectiveInputReportParser::DescriptorMapper::ResizeVectors(Collection* c) {
+		for (Int32Fields* f : c->int32s) {
+			size_t n = f->mapped.size();
+			if (f->target) {
 				f->target->Reset(n);
+				if (f->changed) {
+					f->changed->Reset(n);
+					(*_changed_bits)[f->target->Data()] = f->changed->Data();
+				}
+			}
 		}
 		for (BoolFields* f : c->bools) {
-			size_t n = CountUsages(f->usages.data(), f->usages.size());
-			f->mapped.assign(n, false);
-			if (f->target)
+			size_t n = f->mapped.size();
+			if (f->target) {
 				f->target->Reset(n);
+				if (f->changed) {
+					f->changed->Reset(n);
+					(*_changed_bits)[f->target->Data()] = f->changed->Data();
+				}
+			}
 		}
 		for (Collection* child : c->collections)
 			ResizeVectors(child);
@@ -1102,7 +2069,7 @@ namespace {
 		if (fp.report_type != ReportType::input)
 			return 0;
 
-		DescFieldMappings dfm;
+		DescFieldMappings dfm(_memory);
 
 		if (_matched.empty()) {
 			// If the root collection doesn't have type and usages defined
@@ -1119,7 +2086,7 @@ namespace {
 			}
 		}
 		else {
-			std::vector<bool> matched_usage_indexes;
+			init_vector<bool> matched_usage_indexes(_memory);
 			if (fp.flags & FLAG_FIELD_VARIABLE)
 				matched_usage_indexes.resize(fp.globals->report_count);
 			else
@@ -1138,10 +2105,10 @@ namespace {
 			}
 		}
 
-		ReportMapper& rm = (*_mapping)[fp.globals->report_id];
+		ReportMapper& rm = GetReportMapper(fp.globals->report_id);
 
 		if (!dfm.int32_values.empty() || !dfm.bool_values.empty()) {
-			(*_mapping)[fp.globals->report_id].fields.push_back({
+			rm.fields.push_back({
 				std::move(dfm),
 				rm.bit_size,
 				fp.globals->report_size,
@@ -1163,11 +2130,15 @@ namespace {
 	int SelectiveInputReportParser::DescriptorMapper::Padding(ReportType rt, uint8_t report_id, uint32_t bit_size) {
 		if (rt != ReportType::input)
 			return 0;
-		ReportMapper& rm = (*_mapping)[report_id];
+		ReportMapper& rm = GetReportMapper(report_id);
 		rm.bit_size += bit_size;
 		return 0;
 	}
 
+	SelectiveInputReportParser::ReportMapper& SelectiveInputReportParser::DescriptorMapper::GetReportMapper(uint8_t report_id) {
+		return _mapping->try_emplace(report_id, _memory).first->second;
+	}
+
 	int SelectiveInputReportParser::DescriptorMapper::BeginCollection(uint8_t collection_type, uint16_t usage_page, uint16_t usage, uint32_t depth) {
 		_prev_matched_size.push_back(_matched.size());
 		if (_matched.empty()) {
@@ -1236,81 +2207,153 @@ namespace {
 		return num_usages;
 	}
 
-	void SelectiveInputReportParser::DescriptorMapper::AddFieldIndexes(usage_to_field_index& m, size_t field_index, const std::vector<UsageRange>& usages) {
-		size_t index = 0;
-		for (const UsageRange& ur : usages) {
-			uint32_t page32 = (uint32_t)ur.usage_page << 16;
-			uint16_t usage_max = ur.usage_max < ur.usage_min ? ur.usage_min : ur.usage_max;
-			for (uint32_t u = ur.usage_min; u <= usage_max; ++u, ++index)
-				m.insert(usage_to_field_index::value_type(page32 | u, { field_index, index }));
+	template <typename FIELDS>
+	void SelectiveInputReportParser::DescriptorMapper::AddConfigRanges(init_vector<ConfigRange>& ranges, init_vector<bool>& used, const std::vector<FIELDS*>& fields) {
+		for (size_t i = 0, e = fields.size(); i < e; ++i) {
+			uint32_t index = 0;
+			for (const UsageRange& ur : fields[i]->usages) {
+				uint16_t usage_max = ur.usage_max < ur.usage_min ? ur.usage_min : ur.usage_max;
+				ranges.push_back({ (uint32_t)ur.usage_page << 16, ur.usage_min, usage_max, (uint32_t)i, index, (uint32_t)used.size() });
+				uint32_t num_usages = (uint32_t)usage_max - (uint32_t)ur.usage_min + 1;
+				used.resize(used.size() + num_usages);
+				index += num_usages;
+			}
 		}
 	}
 
-	SelectiveInputReportParser::DescriptorMapper::FieldIndexes& SelectiveInputReportParser::DescriptorMapper::GetFieldIndexes(Collection* c) {
-		auto it = _collection_field_indexes.find(c);
-		if (it != _collection_field_indexes.end())
+	SelectiveInputReportParser::DescriptorMapper::ConfigRanges& SelectiveInputReportParser::DescriptorMapper::GetConfigRanges(Collection* c) {
+		auto it = _collection_config_ranges.find(c);
+		if (it != _collection_config_ranges.end())
 			return it->second;
 
-		FieldIndexes fi;
-		for (size_t i = 0, e = c->int32s.size(); i < e; ++i)
-			AddFieldIndexes(fi.int32_indexes, i, c->int32s[i]->usages);
-		for (size_t i = 0, e = c->bools.size(); i < e; ++i)
-			AddFieldIndexes(fi.bool_indexes, i, c->bools[i]->usages);
-
-		return _collection_field_indexes[c] = std::move(fi);
+		ConfigRanges& cr = _collection_config_ranges.try_emplace(c, _memory).first->second;
+		AddConfigRanges(cr.int32s, cr.int32_used, c->int32s);
+		AddConfigRanges(cr.bools, cr.bool_used, c->bools);
+		return cr;
 	}
 
-	bool SelectiveInputReportParser::DescriptorMapper::TestInt32FieldFlags(Collection* c, const FieldIndex& fi, uint16_t flags) {
-		Int32Fields* f = c->int32s[fi.field_index];
-		return (flags & f->mask) == f->flags;
+	// Values of the match arrays used by MatchUsageRange.
+	static constexpr uint16_t USAGE_UNDECIDED = 0;
+	static constexpr uint16_t USAGE_NO_MATCH = 0xffff;
+	// Descriptor usages are matched in blocks of this size to keep the
+	// bookkeeping on the stack.
+	static constexpr uint32_t USAGE_MATCH_BLOCK_SIZE = 32;
+
+	// Intersects the descriptor usages first..last (page32 is the usage page
+	// shifted left by 16) with the config ranges. match[k] belongs to usage
+	// first+k and only USAGE_UNDECIDED items are updated: the first config
+	// range that has an unused usage there decides the outcome. That's a
+	// range index+1 if the field flags match or USAGE_NO_MATCH otherwise.
+	template <typename FIELDS>
+	void SelectiveInputReportParser::DescriptorMapper::MatchConfigRanges(const init_vector<ConfigRange>& ranges, init_vector<bool>& used,
+		const std::vector<FIELDS*>& fields, uint16_t flags, uint32_t page32, uint32_t first, uint32_t last, uint16_t* match) {
+		HRP_PROFILE_ZONE(match_config_ranges);
+		assert(ranges.size() < USAGE_NO_MATCH);
+		for (size_t i = 0, e = ranges.size(); i < e; ++i) {
+			const ConfigRange& r = ranges[i];
+			if (r.page32 != page32 || r.usage_min > last || r.usage_max < first)
+				continue;
+			const FIELDS* f = fields[r.field_index];
+			bool flags_match = (flags & f->mask) == f->flags;
+			uint32_t u = _hrp_max(first, (uint32_t)r.usage_min);
+			uint32_t u_end = _hrp_min(last, (uint32_t)r.usage_max) + 1;
+			for (; u < u_end; ++u) {
+				if (match[u - first] != USAGE_UNDECIDED)
+					continue;
+				size_t used_index = r.first_used + (u - r.usage_min);
+				if (used[used_index])
+					continue;
+				if (flags_match) {
+					match[u - first] = (uint16_t)(i + 1);
+					used[used_index] = true;
+				}
+				else {
+					match[u - first] = USAGE_NO_MATCH;
+				}
+			}
+		}
 	}
 
-	bool SelectiveInputReportParser::DescriptorMapper::TestBoolFieldFlags(Collection* c, const FieldIndex& fi, uint16_t flags) {
-		BoolFields* f = c->bools[fi.field_index];
-		return (flags & f->mask) == f->flags;
-	}
+	int32_t SelectiveInputReportParser::DescriptorMapper::MatchUsageRange(
+		Collection* c, ConfigRanges& cr, const DescriptorParser::FieldParams& fp, DescFieldMappings& dfm,
+		init_vector<bool>* matched_usage_indexes, size_t index, uint32_t page32, uint32_t usage_min, uint32_t count) {
+		// number of usage indexes matched
+		int32_t found = 0;
 
-	class UsageRangesIterator {
-	public:
-		UsageRangesIterator(UsageRange* usage_ranges, uint16_t num_usage_ranges) {
-			assert(num_usage_ranges > 0);
-			_p = usage_ranges;
-			_last = usage_ranges + num_usage_ranges - 1;
-			_page32 = (uint32_t)_p->usage_page << 16;
-			_u = _p->usage_min;
-			_processed_all = false;
-		}
-
-		void Next() {
-			if (_u < _p->usage_max) {
-				_u++;
-				return;
+		for (uint32_t block = 0; block < count; block += USAGE_MATCH_BLOCK_SIZE) {
+			uint32_t n = _hrp_min(count - block, USAGE_MATCH_BLOCK_SIZE);
+			uint32_t first = usage_min + block;
+			uint32_t last = first + n - 1;
+			size_t block_index = index + block;
+
+			// The int32 fields of the config take precedence over the bool fields.
+			uint16_t int32_match[USAGE_MATCH_BLOCK_SIZE];
+			uint16_t bool_match[USAGE_MATCH_BLOCK_SIZE];
+			for (uint32_t k = 0; k < n; ++k) {
+				bool matched = matched_usage_indexes && (*matched_usage_indexes)[block_index + k];
+				int32_match[k] = matched ? USAGE_NO_MATCH : USAGE_UNDECIDED;
 			}
-			if (_p == _last) {
-				_processed_all = true;
-				return;
+			MatchConfigRanges(cr.int32s, cr.int32_used, c->int32s, fp.flags, page32, first, last, int32_match);
+			for (uint32_t k = 0; k < n; ++k) {
+				bool matched = int32_match[k] != USAGE_UNDECIDED && int32_match[k] != USAGE_NO_MATCH;
+				matched = matched || (matched_usage_indexes && (*matched_usage_indexes)[block_index + k]);
+				bool_match[k] = matched ? USAGE_NO_MATCH : USAGE_UNDECIDED;
 			}
-			_p++;
-			_page32 = (uint32_t)_p->usage_page << 16;
-			_u = _p->usage_min;
-		}
+			MatchConfigRanges(cr.bools, cr.bool_used, c->bools, fp.flags, page32, first, last, bool_match);
+
+			// Record the matches in descriptor usage order.
+			for (uint32_t k = 0; k < n; ++k) {
+				size_t desc_index = block_index + k;
+				if (int32_match[k] != USAGE_UNDECIDED && int32_match[k] != USAGE_NO_MATCH) {
+					const ConfigRange& r = cr.int32s[int32_match[k] - 1];
+					size_t usage_index = r.usage_index + (first + k - r.usage_min);
+					//HRP_DEBUGF("%08x %d->i%d.%d %x\n", page32 | (first + k), (int)desc_index, (int)r.field_index, (int)usage_index, (int)(int64_t)c);
+
+					Int32Fields& i32 = *c->int32s[r.field_index];
+					if (i32.target)
+						dfm.AddMapping(i32.target->Data(), desc_index, usage_index);
+					i32.mapped[usage_index] = true;
+
+					Int32Fields::FieldProperties& props = i32.properties[usage_index];
+					props.flags = fp.flags;
+					props.logical_min = fp.globals->logical_min;
+					props.logical_max = fp.globals->logical_max;
+#if HRP_ENABLE_PHYISICAL_UNITS
+					props.physical_min = fp.globals->physical_min;
+					props.physical_max = fp.globals->physical_max;
+					props.unit = fp.globals->unit;
+					props.unit_exponent = fp.globals->unit_exponent;
+#endif
+				}
+				else if (bool_match[k] != USAGE_UNDECIDED && bool_match[k] != USAGE_NO_MATCH) {
+					const ConfigRange& r = cr.bools[bool_match[k] - 1];
+					size_t usage_index = r.usage_index + (first + k - r.usage_min);
+					//HRP_DEBUGF("%08x %d->b%d.%d %x\n", page32 | (first + k), (int)desc_index, (int)r.field_index, (int)usage_index, (int)(int64_t)c);
 
-		uint32_t Usage32() const { return _page32 | (uint32_t)_u; }
-		bool ProcessedAll() const { return _processed_all; }
+					BoolFields& b = *c->bools[r.field_index];
+					if (b.target)
+						dfm.AddMapping(b.target->Data(), desc_index, usage_index);
+					b.mapped[usage_index] = true;
+				}
+				else {
+					continue;
+				}
 
-	private:
-		uint32_t _page32;
-		uint16_t _u;
-		UsageRange* _p;
-		UsageRange* _last;
-		bool _processed_all;
-	};
+				found++;
+				if (matched_usage_indexes)
+					(*matched_usage_indexes)[desc_index] = true;
+			}
+		}
+
+		return found;
+	}
 
 	// Returns the number of found/mapped usage indexes or a negative error code.
 	int32_t SelectiveInputReportParser::DescriptorMapper::FindFieldUsagesInCollection(
 		Collection* c, const DescriptorParser::FieldParams& fp,
-		DescFieldMappings& dfm, std::vector<bool>* matched_usage_indexes) {
-		FieldIndexes& fi = GetFieldIndexes(c);
+		DescFieldMappings& dfm, init_vector<bool>* matched_usage_indexes) {
+		HRP_PROFILE_ZONE(find_field_usages);
+		ConfigRanges& cr = GetConfigRanges(c);
 
 		// In case of an array field we have to iterate through all declared usages.
 		//
@@ -1322,71 +2365,30 @@ namespace {
 		// then the last declared usage is used for the remaining usage indexes
 		// as per HID specification.
 
+		assert(fp.num_usage_ranges > 0);
+		bool var = (fp.flags & FLAG_FIELD_VARIABLE) != 0;
+		size_t num_indexes = HRP_MAX_REPORT_COUNT;
+		if (var)
+			num_indexes = _hrp_min((size_t)fp.globals->report_count, num_indexes);
+
 		// number of usage indexes matched
 		int32_t found = 0;
-
-		UsageRangesIterator ur(fp.usage_ranges, fp.num_usage_ranges);
-
 		// index is the usage_index of the descriptor field
-		for (size_t index=0; index<HRP_MAX_REPORT_COUNT; index++,ur.Next()) {
-			if ((fp.flags & FLAG_FIELD_VARIABLE)) {
-				if (index >= fp.globals->report_count)
-					break;
-			}
-			else if (ur.ProcessedAll()) {
-				// processed all declared usages for the array field
-				break;
-			}
-
-			if (matched_usage_indexes && (*matched_usage_indexes)[index])
-				continue;
-
-			uint32_t usage32 = ur.Usage32();
-
-			auto it = fi.int32_indexes.find(usage32);
-			if (it != fi.int32_indexes.end() && TestInt32FieldFlags(c, it->second, fp.flags)) {
-				//HRP_DEBUGF("%08x %d->i%d.%d %x\n", usage32, (int)index, (int)it->second.field_index, (int)it->second.usage_index, (int)(int64_t)c);
-
-				Int32Fields& i32 = *c->int32s[it->second.field_index];
-				if (i32.target)
-					dfm.AddMapping(i32.target->Data(), index, it->second.usage_index);
-				i32.mapped[it->second.usage_index] = true;
-
-				Int32Fields::FieldProperties& props = i32.properties[it->second.usage_index];
-				props.flags = fp.flags;
-				props.logical_min = fp.globals->logical_min;
-				props.logical_max = fp.globals->logical_max;
-#if HRP_ENABLE_PHYISICAL_UNITS
-				props.physical_min = fp.globals->physical_min;
-				props.physical_max = fp.globals->physical_max;
-				props.unit = fp.globals->unit;
-				props.unit_exponent = fp.globals->unit_exponent;
-#endif
-				found++;
-				if (matched_usage_indexes)
-					(*matched_usage_indexes)[index] = true;
-
-				fi.int32_indexes.erase(it);
-			}
-			else {
-				auto it2 = fi.bool_indexes.find(usage32);
-				if (it2 != fi.bool_indexes.end() && TestBoolFieldFlags(c, it2->second, fp.flags)) {
-					//HRP_DEBUGF("%08x %d->b%d.%d %x\n", usage32, (int)index, (int)it2->second.field_index, (int)it2->second.usage_index, (int)(int64_t)c);
+		size_t index = 0;
 
-					BoolFields& b = *c->bools[it2->second.field_index];
-					if (b.target)
-						dfm.AddMapping(b.target->Data(), index, it2->second.usage_index);
-					b.mapped[it2->second.usage_index] = true;
+		for (uint16_t i = 0; i < fp.num_usage_ranges && index < num_indexes; ++i) {
+			const UsageRange& ur = fp.usage_ranges[i];
+			uint32_t count = ur.usage_max < ur.usage_min ? 1 : (uint32_t)ur.usage_max - (uint32_t)ur.usage_min + 1;
+			count = (uint32_t)_hrp_min((size_t)count, num_indexes - index);
+			found += MatchUsageRange(c, cr, fp, dfm, matched_usage_indexes, index, (uint32_t)ur.usage_page << 16, ur.usage_min, count);
+			index += count;
+		}
 
-					found++;
-					if (matched_usage_indexes)
-						(*matched_usage_indexes)[index] = true;
-					fi.bool_indexes.erase(it2);
-				}
-				else {
-					//HRP_DEBUGF("%08x - unmatched usage32\n", usage32);
-				}
-			}
+		if (var && index < num_indexes) {
+			const UsageRange& ur = fp.usage_ranges[fp.num_usage_ranges - 1];
+			uint16_t usage = ur.usage_max < ur.usage_min ? ur.usage_min : ur.usage_max;
+			for (; index < num_indexes; ++index)
+				found += MatchUsageRange(c, cr, fp, dfm, matched_usage_indexes, index, (uint32_t)ur.usage_page << 16, usage, 1);
 		}
 
 		return found;
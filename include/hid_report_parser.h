@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <vector>
 #include <map>
 #include <set>
@@ -68,6 +69,46 @@
 #  define HRP_IGNORE_LONELY_USAGE_MIN_OR_MAX 1
 #endif
 
+// The maximum number of entries (2 bytes each) in the item->variable lookup
+// table that SelectiveInputReportParser::Init builds for an array field.
+// The table has logical_max-logical_min+1 entries. Array fields with a wider
+// logical range (and array fields mapped onto more than one IInt32Target or
+// IBoolTarget) are parsed by scanning their usage ranges for each item.
+// Keyboard arrays need about 0x100 entries, consumer control arrays often
+// declare a logical range of 0x400 or more.
+#ifndef HRP_MAX_ARRAY_LOOKUP_TABLE_SIZE
+#  define HRP_MAX_ARRAY_LOOKUP_TABLE_SIZE 0x400
+#endif
+
+// HRP_WORD_AT_A_TIME_BIT_COPY=1 makes the report parser copy long bitfields
+// (keyboard keys, gamepad buttons) in size_t wide words through unaligned
+// loads and stores. That pays off only on little-endian CPUs with cheap
+// unaligned access (x86, ARMv7-M and later). Without it (e.g. on the Cortex-M0+
+// of the RP2040) HRP_ALIGNED_WORD_BIT_COPY applies.
+#ifndef HRP_WORD_AT_A_TIME_BIT_COPY
+#  if defined(_M_X64) || defined(_M_IX86) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && \
+	(defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || defined(__ARM_FEATURE_UNALIGNED)))
+#    define HRP_WORD_AT_A_TIME_BIT_COPY 1
+#  else
+#    define HRP_WORD_AT_A_TIME_BIT_COPY 0
+#  endif
+#endif
+
+// HRP_ALIGNED_WORD_BIT_COPY=1 is the fallback of CPUs without unaligned
+// access (e.g. the Cortex-M0+ of the RP2040): long bitfields are copied in
+// 32-bit words through aligned loads and stores only. The destination is
+// brought to a word boundary with byte copies and the source words are
+// shifted into place so the source needs no particular alignment. It
+// requires a little-endian CPU. With both options off the bitfields are
+// copied byte-by-byte.
+#ifndef HRP_ALIGNED_WORD_BIT_COPY
+#  if !HRP_WORD_AT_A_TIME_BIT_COPY && defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#    define HRP_ALIGNED_WORD_BIT_COPY 1
+#  else
+#    define HRP_ALIGNED_WORD_BIT_COPY 0
+#  endif
+#endif
+
 #ifndef HRP_DEBUG_PRINTF_ENABLED
 #  define HRP_DEBUG_PRINTF_ENABLED 0
 #endif
@@ -78,6 +119,19 @@
 #  define HRP_DEBUGF(fmt, ...)
 #endif
 
+// HRP_PROFILE_ZONES_ENABLED=1 makes the library measure the time spent in the
+// phases of SelectiveInputReportParser::Init and Parse (see hid::ProfileZone).
+// Each zone counts its calls and sums their elapsed time. The clock is the
+// 1us RP2040 timer on the device (single calls shorter than a microsecond
+// still average out correctly over many calls) and std::chrono::steady_clock
+// elsewhere. The per-report zones read the clock twice for every field and
+// that slows down Parse noticeably so compare the zones with each other rather
+// than with an unprofiled build. With the default zero the zones compile to
+// nothing.
+#ifndef HRP_PROFILE_ZONES_ENABLED
+#  define HRP_PROFILE_ZONES_ENABLED 0
+#endif
+
 
 namespace hid {
 
@@ -88,6 +142,46 @@ namespace hid {
 	// Returns default_str if the error_code isn't recognised.
 	const char* str_error(int error_code, const char* default_str=nullptr);
 
+#if HRP_PROFILE_ZONES_ENABLED
+	// The zones are nested: the time of a zone includes the time of the zones
+	// entered from it (e.g. init includes all the other init phases and
+	// descriptor_parse includes find_field_usages).
+	enum class ProfileZone : uint8_t {
+		// SelectiveInputReportParser::Init
+		init,
+		// Resetting the target variables and the usage flags of the config.
+		resize_vectors,
+		// DescriptorParser::Parse including the field callbacks.
+		descriptor_parse,
+		// Matching a descriptor field against the config collections.
+		find_field_usages,
+		// Matching the usage range of a field against the config ranges.
+		match_config_ranges,
+		// Building the extract ops from the mapped fields.
+		compile,
+		// Copying the ops into their final heap or arena block.
+		install,
+		// SelectiveInputReportParser::Parse and ParseChanges
+		parse_report,
+		// Extracting one variable field (or a run of bits) from a report.
+		var_field,
+		// Extracting one array field from a report.
+		array_field,
+		count
+	};
+
+	struct ProfileZoneStats {
+		uint32_t calls;
+		uint64_t total_ns;
+	};
+
+	// The counters are global and aren't synchronised: profile the parsers
+	// of only one thread (or core) at a time.
+	const ProfileZoneStats& GetProfileZoneStats(ProfileZone zone);
+	const char* GetProfileZoneName(ProfileZone zone);
+	void ResetProfileZones();
+#endif
+
 	static constexpr int ERR_SUCCESS = 0;
 	// ERR_UNSPECIFIED is usually returned in places where an error should
 	// never normally occur unless it is caused by something unforeseen.
@@ -147,6 +241,9 @@ namespace hid {
 	// and the device sends a report with keyboard changes then the
 	// SelectiveInputReportParser::Parse method can find no useful information
 	// in the report and returns ERR_NOTHING_CHANGED.
+	// SelectiveInputReportParser::ParseChanges returns ERR_NOTHING_CHANGED
+	// also when the report has mapped fields but none of the mapped variables
+	// changed as a result of parsing it.
 	// In a situation like that the int32 and bool variables are left unchanged
 	// so the application should not waste time on trying to look for changes.
 	// That could result even in buggy behaviour for example in case of relative
@@ -160,6 +257,12 @@ namespace hid {
 	// failed to specify a USAGE_PAGE before reaching an INPUT, OUTPUT or
 	// FEATURE item.
 	static constexpr int ERR_UNDEFINED_USAGE_PAGE = -25;
+	// Returned by SelectiveInputReportParser::Init if the descriptor and the
+	// mapping config need more memory than the size of the specified Arena.
+	static constexpr int ERR_ARENA_TOO_SMALL = -26;
+	// Returned by SelectiveInputReportParser::ParseLazy and Decode if Init
+	// hasn't been called with lazy=true.
+	static constexpr int ERR_LAZY_DECODING_DISABLED = -27;
 
 
 	// Usage page and usage ID constants copied from hut1_5.pdf:
@@ -1642,6 +1745,11 @@ namespace hid {
 		// aren't even mapped by the SelectiveInputReportParser::Init method.
 		// Two or more Int32Fields instances must not reference the same target.
 		IInt32Target* target = nullptr;
+		// Optional bitfield that receives one bit for each variable of target.
+		// SelectiveInputReportParser::Parse and ParseChanges set the bit of a
+		// variable when its value changes. The parser never clears these bits,
+		// the application has to do that after processing the changes.
+		IBoolTarget* changed = nullptr;
 		// you can leave UsageRange.usage_max zero if you want to specify only one usage (in usage_min)
 		std::vector<UsageRange> usages;
 
@@ -1654,6 +1762,7 @@ namespace hid {
 		// the convenience methods below.
 
 		Int32Fields& SetTarget(IInt32Target* t) { target = t; return *this; }
+		Int32Fields& SetChanged(IBoolTarget* c) { changed = c; return *this; }
 		Int32Fields& SetFlags(uint16_t mask_, uint16_t flags_) { mask = mask_; flags = flags_; return *this; }
 
 		Int32Fields& AddUsages(UsageRange&& r) { usages.push_back(std::move(r)); return *this; }
@@ -1697,6 +1806,9 @@ namespace hid {
 		// aren't even mapped by the SelectiveInputReportParser::Init method.
 		// Two or more BoolFields instances must not reference the same target.
 		IBoolTarget* target = nullptr;
+		// Optional bitfield that receives one bit for each variable of target.
+		// See Int32Fields::changed.
+		IBoolTarget* changed = nullptr;
 		// you can leave UsageRange.usage_max zero if you want to specify only one usage (in usage_min)
 		std::vector<UsageRange> usages;
 
@@ -1709,6 +1821,7 @@ namespace hid {
 		// the convenience methods below.
 
 		BoolFields& SetTarget(IBoolTarget* t) { target = t; return *this; }
+		BoolFields& SetChanged(IBoolTarget* c) { changed = c; return *this; }
 		BoolFields& SetFlags(uint16_t mask_, uint16_t flags_) { mask = mask_; flags = flags_; return *this; };
 
 		BoolFields& AddUsages(UsageRange&& r) { usages.push_back(std::move(r)); return *this; }
@@ -1802,6 +1915,74 @@ namespace hid {
 	};
 
 
+	// Arena is a caller-supplied memory block that SelectiveInputReportParser::Init
+	// can use instead of the heap. Without an arena Init allocates its temporary
+	// data structures (maps, sets and vectors) and the compiled extraction
+	// program from the heap every time a device is plugged in. That can
+	// fragment the heap of a microcontroller over a long uptime.
+	//
+	// Init allocates its temporary data from the bottom of the arena and the
+	// compiled extraction program (the only thing the parser keeps after Init)
+	// from the top of the arena. The temporary data is released before Init
+	// returns so only the compiled program occupies the arena between two
+	// Init calls. SelectiveInputReportParser::GetMemoryUsage tells you how
+	// large the arena has to be for a given descriptor and mapping config.
+	//
+	// A successful Init with an arena doesn't touch the heap if the 'mapped'
+	// and 'properties' vectors of the config have their final size already.
+	// Those belong to the application and live on the heap: Init sizes them
+	// the first time a config is used unless the application has called
+	// SelectiveInputReportParser::PrepareConfig (e.g. at startup).
+	//
+	// Init returns ERR_ARENA_TOO_SMALL if the arena can't hold everything.
+	// The standard containers used by Init can't handle allocation failures
+	// without exceptions so the temporary allocations that don't fit spill
+	// over to the heap and get released before Init returns the error. Only
+	// this failing Init uses the heap and GetMemoryUsage().peak tells the
+	// exact arena size it would have needed (the spilled allocations are
+	// counted as if they had been made from a large enough arena).
+	//
+	// An Arena can be used by only one SelectiveInputReportParser instance at
+	// a time. Init calls of different parsers with different arenas (or
+	// without arenas) can run concurrently.
+	class Arena {
+	public:
+		Arena(void* buffer, size_t size) {
+			// Both ends of the usable area are aligned to max_align_t.
+			uintptr_t mask = alignof(max_align_t) - 1;
+			uintptr_t begin = ((uintptr_t)buffer + mask) & ~mask;
+			uintptr_t end = ((uintptr_t)buffer + size) & ~mask;
+			_buffer = (uint8_t*)begin;
+			_size = end > begin ? end - begin : 0;
+		}
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		// The usable size that can be smaller than the size of the buffer
+		// if the buffer isn't aligned to max_align_t.
+		size_t Size() const { return _size; }
+
+	private:
+		friend class SelectiveInputReportParser;
+		uint8_t* _buffer;
+		size_t _size;
+		// number of bytes used by the temporary allocations of Init
+		size_t _bottom = 0;
+		// number of bytes used by the compiled extraction program
+		size_t _top = 0;
+	};
+
+
+	// Optional convenience template that declares an Arena with its buffer.
+	template <size_t SIZE>
+	class StaticArena : public Arena {
+	public:
+		StaticArena() : Arena(_storage, SIZE) {}
+	private:
+		alignas(max_align_t) uint8_t _storage[SIZE];
+	};
+
+
 	// SelectiveInputParser tries to find specific fields in input reports and
 	// extract them by ignoring everything else. The field values are parsed into
 	// variables you define for your application with the help of the Collection,
@@ -1818,15 +1999,44 @@ namespace hid {
 	//   and set the values of its fields.
 	class SelectiveInputReportParser {
 	public:
+		SelectiveInputReportParser() = default;
+		~SelectiveInputReportParser() { Reset(); }
+		SelectiveInputReportParser(const SelectiveInputReportParser&) = delete;
+		SelectiveInputReportParser& operator=(const SelectiveInputReportParser&) = delete;
+
 		// Returns zero (ERR_SUCCESS) on success.
 		// Returns ERR_COULD_NOT_MAP_ANY_USAGES if none of the descriptor fields
 		// can be mapped to the int32 and bool variables of your program.
-		int Init(Collection* input_fields, const void* descriptor, size_t descriptor_size);
+		// If you specify an arena then Init doesn't use the heap (see Arena).
+		// The arena has to outlive the parser or the next Init/Reset call.
+		// Set lazy if you want to use ParseLazy and Decode. It makes Init
+		// build the Decode index and the report copies of ParseLazy, which
+		// Parse and ParseChanges don't need.
+		int Init(Collection* input_fields, const void* descriptor, size_t descriptor_size, Arena* arena=nullptr, bool lazy=false);
+
+		// Sizes the 'mapped' and 'properties' vectors of the Int32Fields and
+		// BoolFields of a config to the number of their usages. Init does the
+		// same but these vectors live on the heap so an application that
+		// doesn't want Init to touch the heap calls this once at startup.
+		// The config's usages mustn't change afterwards.
+		static void PrepareConfig(Collection* input_fields);
 
 		// Reset removes any mapping configuration created by Init.
-		void Reset() {
-			_mapping.clear();
-		}
+		void Reset();
+
+		struct MemoryUsage {
+			// The high-water mark of the memory used by the last Init call
+			// including its temporary data structures. Heap allocations are
+			// counted without the bookkeeping overhead of the heap. In case
+			// of an arena this is the minimum arena size that works with the
+			// descriptor and mapping config of the last Init call.
+			size_t peak = 0;
+			// The size of the compiled extraction program that is kept by the
+			// parser until the next Init or Reset call.
+			size_t steady = 0;
+		};
+
+		const MemoryUsage& GetMemoryUsage() const { return _memory_usage; }
 
 		// If Parse returns zero (ERR_SUCCESS) you have to process the mapped
 		// int32 and bool variables that receive the input state changes.
@@ -1851,23 +2061,255 @@ namespace hid {
 		// desktop operating systems because they seem to forgive these errors.
 		int Parse(const void* report, size_t report_size);
 
+		// ParseChanges works like Parse but it returns ERR_NOTHING_CHANGED
+		// also when the report didn't change the value of any mapped variable.
+		// This makes it possible to skip processing the variables when the
+		// device keeps repeating the same input state. The changes are
+		// detected while extracting the fields (the 'changed' bitfields of
+		// Int32Fields and BoolFields are updated by Parse too) so this is
+		// cheaper than comparing the variables with a copy after parsing.
+		// A relative variable counts as changed whenever its value isn't zero.
+		int ParseChanges(const void* report, size_t report_size);
+
+		// Lazy decoding (requires Init with lazy=true): ParseLazy checks the
+		// report the same way as Parse and keeps a copy of it (one copy per
+		// report_id) without extracting anything. Decode extracts the value
+		// of one variable on demand from the most recent retained report that
+		// contains it, so the mapped variables the application doesn't read
+		// in response to a report cost nothing. Init builds an index from the
+		// variables to their ops so Decode costs one lookup and the
+		// extraction of one field.
+		//
+		// Decode returns zero if the value of the variable changed (its bit
+		// is set in the 'changed' bitfield too), ERR_NOTHING_CHANGED if it
+		// didn't change or no report with the variable has been retained yet
+		// and ERR_INVALID_PARAMETERS if the variable isn't mapped. Both return
+		// ERR_LAZY_DECODING_DISABLED if Init was called without lazy=true.
+		// Relative variables behave the same way as with Parse: they read as
+		// zero if the most recent report doesn't contain them and decoding one
+		// twice after the same report processes the same delta twice.
+		// The variables of an array field (e.g. keyboard keys) are decoded
+		// together because each item of the array can set any of them.
+		int ParseLazy(const void* report, size_t report_size);
+		int Decode(IInt32Target* target, size_t index);
+		int Decode(IBoolTarget* target, size_t index);
+
 	private:
 		struct ReportFieldMapping;
 		struct UsageIndexRange;
 		struct DescFieldMappings;
+		struct ExtractOp;
+		struct Program;
 		class DescriptorMapper;
 
+		// The memory bookkeeping of one Init call (arena, heap usage, peak).
+		struct InitMemory;
+
+		// The temporary data structures of Init are allocated through
+		// InitAllocator. It points to the InitMemory of the running Init call
+		// and uses its arena if it has one, otherwise the heap. It has no
+		// default constructor so every container of Init has to be given the
+		// InitMemory explicitly.
+		template <typename T>
+		struct InitAllocator {
+			typedef T value_type;
+			InitAllocator(InitMemory* m) : memory(m) {}
+			template <typename U> InitAllocator(const InitAllocator<U>& a) : memory(a.memory) {}
+			T* allocate(size_t n) { return (T*)InitAlloc(*memory, n * sizeof(T)); }
+			void deallocate(T* p, size_t n) { InitFree(*memory, p, n * sizeof(T)); }
+			template <typename U> bool operator==(const InitAllocator<U>& a) const { return memory == a.memory; }
+			template <typename U> bool operator!=(const InitAllocator<U>& a) const { return memory != a.memory; }
+			InitMemory* memory;
+		};
+
+		template <typename T>
+		using init_vector = std::vector<T, InitAllocator<T>>;
+		template <typename K, typename V>
+		using init_map = std::map<K, V, std::less<K>, InitAllocator<std::pair<const K, V>>>;
+		template <typename K, typename V>
+		using init_multimap = std::multimap<K, V, std::less<K>, InitAllocator<std::pair<const K, V>>>;
+		template <typename K>
+		using init_set = std::set<K, std::less<K>, InitAllocator<K>>;
+
+		static void* InitAlloc(InitMemory& im, size_t size);
+		static void InitFree(InitMemory& im, void* p, size_t size);
+		static void UpdateInitPeak(InitMemory& im);
+
 		// Mapping between input report fields and the program's int32/bool variables.
+		// This is the output of the DescriptorMapper. Init compiles it into
+		// the flat extraction program (_ops) and throws it away.
 		struct ReportMapper {
+			explicit ReportMapper(InitMemory* m) : fields(m) {}
 			// report size in bits not including the report_id byte if present
 			uint32_t bit_size = 0;
-			std::vector<ReportFieldMapping> fields;
+			init_vector<ReportFieldMapping> fields;
 		};
 
 		// key: report_id
 		// the zero report_id belongs to structs that don't have a report_id
-		typedef std::map<uint8_t, ReportMapper> mapping_t;
-		mapping_t _mapping;
+		typedef init_map<uint8_t, ReportMapper> mapping_t;
+
+		// key: IInt32Target::Data() or IBoolTarget::Data()
+		// value: the IBoolTarget::Data() of the related 'changed' bitfield
+		typedef init_map<const void*, uint8_t*> changed_bits_t;
+
+		// The compiled extraction program of one report_id.
+		struct CompiledReport {
+			// report size in bits not including the report_id byte if present
+			uint32_t bit_size;
+			// [first_op, first_op+num_ops) range in _ops
+			uint32_t first_op;
+			uint32_t num_ops;
+			// [first_reset, first_reset+num_resets) range in _resets
+			// num_resets is zero if the other report_ids have no relative
+			// fields which is the common case.
+			uint32_t first_reset;
+			uint32_t num_resets;
+			// ParseLazy: offset of the copy of the report in _retained
+			uint32_t retained_offset;
+			// ParseLazy: the _retain_counter value of the retained copy,
+			// zero if the report hasn't been retained yet.
+			uint32_t retained_stamp;
+		};
+
+		// A range of variables that has to be zeroed before parsing a report.
+		struct ResetRange {
+			// nullptr if the range consists of bool variables
+			int32_t* int32s;
+			uint8_t* bits;
+			// index of the first bit if bits isn't nullptr
+			uint32_t first_bit;
+			// the number of int32 or bool variables in the range
+			uint32_t length;
+		};
+
+		// A compiled array field. Its ExtractOp references it by index.
+		struct ArrayField {
+			// offset within the report not including the report_id byte if present
+			uint32_t bit_offset;
+			uint32_t report_size;
+			uint32_t report_count;
+			int32_t logical_min;
+			int32_t logical_max;
+			bool relative : 1;
+			bool first_usage_is_zero : 1;
+			bool byte_aligned : 1;  // true if both bit_offset and report_size are a multiple of 8
+			// [first_range, first_range+num_ranges) range in _array_ranges.
+			// The int32 ranges come first.
+			uint32_t first_range;
+			uint32_t num_ranges;
+			// Used only if the field has a lookup table (see
+			// HRP_MAX_ARRAY_LOOKUP_TABLE_SIZE): lookup_size is zero otherwise.
+			// _array_lookups[first_lookup+item-logical_min] is zero if the
+			// item isn't mapped, otherwise it is the index of the variable
+			// plus one in either lookup_int32s or lookup_bits.
+			uint32_t first_lookup;
+			uint32_t lookup_size;
+			int32_t* lookup_int32s;
+			uint8_t* lookup_bits;
+		};
+
+		// Maps the [desc_min, desc_min+length) items of an array field to
+		// the [val_min, val_min+length) variables of a target.
+		struct ArrayRange {
+			// nullptr if the range consists of bool variables
+			int32_t* int32s;
+			uint8_t* bits;
+			// the 'changed' bitfield of the target or nullptr
+			uint8_t* changed;
+			uint32_t desc_min;
+			uint32_t val_min;
+			uint32_t length;
+		};
+
+		// The Decode index of one target (IInt32Target or IBoolTarget).
+		// The ops that write variable i of the target are listed in
+		// _decode_entries[first_entry+(i-first_index)*slots] and the slots-1
+		// entries after it, in report order. An entry is the index of the op
+		// in _ops plus one, zero marks an unused slot. slots is the largest
+		// number of ops (one per report_id in practice) that write the same
+		// variable of the target.
+		struct DecodeTarget {
+			const void* data;  // IInt32Target::Data() or IBoolTarget::Data()
+			bool bits;         // true in case of an IBoolTarget
+			uint32_t first_index;
+			uint32_t num_indexes;
+			uint32_t slots;
+			uint32_t first_entry;
+		};
+
+		int InitProgram(InitMemory& memory, Collection* input_fields, const void* descriptor, size_t descriptor_size, Arena* arena, bool lazy);
+		int ParseReport(const void* report, size_t report_size, bool& changed);
+		// Checks the report and finds its CompiledReport. data receives the
+		// report without the report_id byte.
+		int FindReport(const void* report, size_t report_size, CompiledReport*& cr, const uint8_t*& data) const;
+		// Returns true if the value of at least one variable changed.
+		bool ExecuteOp(const ExtractOp& op, const uint8_t* report) const;
+		// Returns the Decode index entries of the specified variable (slots
+		// receives their number) or nullptr if the variable isn't mapped.
+		// Only one of int32s and bits is non-null.
+		const uint32_t* FindDecodeEntries(const int32_t* int32s, const uint8_t* bits, size_t index, uint32_t& slots) const;
+		int DecodeVariable(int32_t* int32s, uint8_t* bits, size_t index);
+
+		void Compile(const mapping_t& mapping, const changed_bits_t& changed_bits, bool lazy, Program& prog);
+		static void AppendVarFieldOps(Program& prog, const ReportFieldMapping& fm, const changed_bits_t& changed_bits);
+		static void AppendArrayField(Program& prog, const ReportFieldMapping& fm, const changed_bits_t& changed_bits);
+		static void BuildArrayLookup(Program& prog, ArrayField& af);
+		static void BuildDecodeIndex(Program& prog);
+		// Calls f(data, bits, first_index, length) for each range of
+		// variables written by op. data and bits identify the target like
+		// DecodeTarget::data and DecodeTarget::bits.
+		template <typename F>
+		static void ForEachVariableRange(const Program& prog, const ExtractOp& op, F f);
+		static uint8_t* FindChangedBits(const changed_bits_t& changed_bits, const void* target);
+		static void AppendRelativeResetRanges(const Program& prog, const CompiledReport& cr, init_vector<ResetRange>& ranges);
+		static void AppendResetRange(init_vector<ResetRange>& ranges, const ResetRange& r);
+		// Copies the program into a single memory block allocated from the
+		// heap or the arena. Returns false if it doesn't fit into the arena.
+		bool Install(const Program& prog, Arena* arena);
+
+		// Returns true if the value of at least one variable changed.
+		bool ParseArrayField(const ArrayField& af, const uint8_t* report) const;
+		void ParseArrayItems(const ArrayField& af, const uint8_t* report) const;
+		void ProcessArrayItem(const ArrayField& af, uint32_t item) const;
+
+		// The memory block that holds the compiled extraction program:
+		// _reports, _ops, _resets, _array_fields, _array_ranges,
+		// _array_lookups, _array_snapshot, _retained, _decode_targets and
+		// _decode_entries point into this block.
+		void* _program = nullptr;
+		// nullptr if _program has been allocated from the heap
+		Arena* _arena = nullptr;
+		MemoryUsage _memory_usage;
+
+		CompiledReport* _reports = nullptr;
+		uint32_t _num_reports = 0;
+		// Dispatch table indexed by report_id. Zero means that the report_id
+		// has no mapped fields, other values are indexes into _reports plus one.
+		// A descriptor can't have more than 255 report_ids (the zero report_id
+		// is used only by descriptors that don't use report_ids at all) so
+		// the index always fits.
+		uint8_t _report_index[256] = {};
+		// The extraction ops of all report_ids stored contiguously.
+		ExtractOp* _ops = nullptr;
+		// The relative fields of the other report_ids that have to be reset
+		// before parsing a report. See CompiledReport::first_reset.
+		ResetRange* _resets = nullptr;
+		ArrayField* _array_fields = nullptr;
+		ArrayRange* _array_ranges = nullptr;
+		uint16_t* _array_lookups = nullptr;
+		// Scratch buffer used by ParseArrayField to detect the changes of
+		// array fields: a copy of the variables of one array field.
+		uint8_t* _array_snapshot = nullptr;
+		// The report copies of ParseLazy. See CompiledReport::retained_offset.
+		// nullptr unless Init was called with lazy=true.
+		uint8_t* _retained = nullptr;
+		// Incremented by every ParseLazy call. Zero is skipped on wraparound.
+		uint32_t _retain_counter = 0;
+		// The Decode index. See DecodeTarget.
+		DecodeTarget* _decode_targets = nullptr;
+		uint32_t _num_decode_targets = 0;
+		uint32_t* _decode_entries = nullptr;
 		bool _have_report_ids = false;
 	};
 
@@ -1878,26 +2320,30 @@ namespace hid {
 	};
 
 	struct SelectiveInputReportParser::DescFieldMappings {
-		std::map<int32_t*, std::vector<UsageIndexRange>> int32_values;
-		std::map<uint8_t*, std::vector<UsageIndexRange>> bool_values;
+		explicit DescFieldMappings(InitMemory* m) : int32_values(m), bool_values(m) {}
+
+		init_map<int32_t*, init_vector<UsageIndexRange>> int32_values;
+		init_map<uint8_t*, init_vector<UsageIndexRange>> bool_values;
 
 		bool AddMapping(int32_t* v, size_t desc_usage_index, size_t values_usage_index) {
 			assert(v);
-			return AppendUsageIndex(int32_values[v], desc_usage_index, values_usage_index);
+			return AppendUsageIndex(int32_values.try_emplace(v, int32_values.get_allocator().memory).first->second,
+				desc_usage_index, values_usage_index);
 		}
 
 		bool AddMapping(uint8_t* v, size_t desc_usage_index, size_t values_usage_index) {
 			assert(v);
-			return AppendUsageIndex(bool_values[v], desc_usage_index, values_usage_index);
+			return AppendUsageIndex(bool_values.try_emplace(v, bool_values.get_allocator().memory).first->second,
+				desc_usage_index, values_usage_index);
 		}
 
 	private:
-		bool AppendUsageIndex(std::vector<UsageIndexRange>& ranges, size_t desc_usage_index, size_t values_usage_index) {
+		bool AppendUsageIndex(init_vector<UsageIndexRange>& ranges, size_t desc_usage_index, size_t values_usage_index) {
 			// The logic that tries map descriptor fields onto the application's
 			// variables (the FindFieldUsagesInCollection method) works by
-			// iterating through the usages found in the descriptor and trying
-			// to match them against the usages defined in the application's
-			// mapping config. Usages are processed one-by-one.
+			// intersecting the usage ranges found in the descriptor with the
+			// usage ranges defined in the application's mapping config. The
+			// matches are reported one-by-one in descriptor usage order.
 			//
 			// The code below makes sure that consecutive usages are handled as
 			// one block when their source and destination happen to be the same
@@ -1905,7 +2351,7 @@ namespace hid {
 			// performance of the report parser in case of large bit fields.
 			// A typical example is 100+ keyboard keys declared as a bitfield
 			// with a USAGE MIN/MAX both in the descriptor and the application's
-			// mapping config. Matching the usages one-by-one helps in finding
+			// mapping config. Joining the matches this way helps in finding
 			// large consecutive usage blocks even when the USAGE MIN/MAX ranges
 			// aren't identical in the descriptor and mapping config - it's
 			// enough to have an overlap.
@@ -1936,22 +2382,95 @@ namespace hid {
 		bool signed_ : 1;  // true if logical_min is below zero
 		bool first_usage_is_zero : 1; // used only in case of array fields
 		bool byte_aligned : 1;  // true if both bit_offset and report_size are a multiple of 8
+	};
+
+	// One step of the flat extraction program that SelectiveInputReportParser::Init
+	// compiles from the ReportFieldMapping instances of a report. The Parse
+	// method executes the ops of a report one after the other without having
+	// to walk the maps and range vectors of the ReportFieldMappings.
+	struct SelectiveInputReportParser::ExtractOp {
+		enum Kind : uint8_t {
+			INT32,          // integer field -> int32 variable
+			INT32_TO_BOOL,  // integer field -> bool variable
+			// Block of 1-bit fields -> block of bool variables. The kernel is
+			// picked by the alignment of the source and destination:
+			BITS_BYTES,     // both start at a byte boundary and the length is a multiple of 8
+			BITS_SAME_PHASE,// both start at the same bit position within a byte
+			BITS_SHIFTED,   // the source bits have to be shifted
+			ARRAY,          // array field -> int32 and/or bool variables
+		};
+
+		// How an INT32 op stores the extracted value.
+		enum Int32Mode : uint8_t {
+			INT32_ABSOLUTE,          // store the value as is
+			INT32_RELATIVE,          // as is but any nonzero value is a change
+			INT32_RELATIVE_CHECKED,  // store zero instead of an out-of-range value
+		};
 
-		static int ParseVarFields(const ReportFieldMapping& m, const uint8_t* report);
-		static int ParseArrayFields(const ReportFieldMapping& m, const uint8_t* report);
-		static void ProcessArrayItem(const ReportFieldMapping& m, uint32_t index);
+		typedef bool (*extract_fn)(const ExtractOp& op, const uint8_t* report);
 
-		static void ResetFields(const ReportFieldMapping& m);
+		Kind kind;
+		bool signed_ : 1;
+		bool relative : 1;
+		bool byte_aligned : 1;  // used only by INT32
+		// INT32: width of the field in bytes (1-4) if byte_aligned, otherwise
+		// in bits (1-32). INT32_TO_BOOL: width in bits (1-32).
+		uint8_t size;
+		// index of the op's CompiledReport in _reports (used by Decode)
+		uint8_t report;
+		// INT32: byte offset of the first item if byte_aligned, otherwise bit offset.
+		// INT32_TO_BOOL and BITS_*: bit offset.
+		// ARRAY: index into SelectiveInputReportParser::_array_fields.
+		// Offsets don't include the report_id byte.
+		uint32_t offset;
+		// INT32: index of the first destination variable in its IInt32Target.
+		// INT32_TO_BOOL: index of the destination bit.
+		// BITS_*: index of the first destination bit.
+		// The same index is used in the 'changed' bitfield.
+		uint32_t dest_bit;
+		// INT32: number of consecutive items (each op.size wide) extracted
+		// into consecutive variables. BITS_*: number of bits to copy.
+		uint32_t length;
+		int32_t logical_min;
+		int32_t logical_max;
+		union {
+			int32_t* int32;
+			uint8_t* bits;
+		} dest;
+		// The 'changed' bitfield of the destination or nullptr.
+		uint8_t* changed;
+		// INT32: an ExtractInt32 instance picked by Init for the layout,
+		// signedness and logical range of the field.
+		extract_fn extract;
+
+		static extract_fn SelectInt32Extractor(const ExtractOp& op);
+
+		// These return true if the value of at least one variable changed.
+		// BYTES is the width of a byte-aligned field (1-4) or 0 for a field
+		// that isn't byte-aligned. MODE is an Int32Mode.
+		template <uint8_t BYTES, bool SIGNED, uint8_t MODE>
+		static bool ExtractInt32(const ExtractOp& op, const uint8_t* report);
+		static bool ExtractInt32ToBool(const ExtractOp& op, const uint8_t* report);
+		static bool CopyBytes(const ExtractOp& op, const uint8_t* report);
+		template <bool SHIFTED>
+		static bool CopyBits(const ExtractOp& op, const uint8_t* report);
+		// Copies only the destination bit 'index' of a BITS_* op (Decode).
+		static bool CopyBit(const ExtractOp& op, const uint8_t* report, size_t index);
 	};
 
 
 	class SelectiveInputReportParser::DescriptorMapper : private DescriptorParser::EventHandler {
 	public:
-		DescriptorMapper(mapping_t* m, Collection* input_fields) : _mapping(m), _root(input_fields) {}
+		DescriptorMapper(InitMemory* memory, mapping_t* m, changed_bits_t* changed_bits, Collection* input_fields) :
+			_memory(memory), _mapping(m), _changed_bits(changed_bits), _root(input_fields),
+			_matched_set(memory), _matched(memory), _prev_matched_size(memory), _collection_config_ranges(memory) {}
 		int MapFields(const void* descriptor, size_t descriptor_size);
 
+		static void SizeConfigVectors(Collection* c);
+
 	private:
 		void ResizeVectors(Collection* c);
+		ReportMapper& GetReportMapper(uint8_t report_id);
 
 		int Field(const DescriptorParser::FieldParams& fp) override;
 		int Padding(ReportType rt, uint8_t report_id, uint32_t bit_size) override;
@@ -1965,38 +2484,58 @@ namespace hid {
 		static bool UsageMatch(const UsageRange& ur, uint16_t usage_page, uint16_t usage);
 		static size_t CountUsages(const UsageRange* usage_ranges, size_t num_usage_ranges);
 
-		struct FieldIndex {
+		// One UsageRange of an Int32Fields or BoolFields instance of a config
+		// collection. Descriptor usage ranges are intersected with these.
+		struct ConfigRange {
+			uint32_t page32;
+			uint16_t usage_min;
+			uint16_t usage_max;
 			// index into Collection::int32s or Collection::bools
-			size_t field_index;
-			// index into an IInt32Target or IBoolTarget that is referenced
-			// by an Int32Fields or BoolFields instance identified by field_index
-			size_t usage_index;
+			uint32_t field_index;
+			// index of usage_min in the IInt32Target or IBoolTarget that is
+			// referenced by the Int32Fields or BoolFields instance
+			uint32_t usage_index;
+			// index of usage_min in ConfigRanges::int32_used or bool_used
+			uint32_t first_used;
 		};
 
-		typedef std::multimap<uint32_t, FieldIndex> usage_to_field_index;
-		struct FieldIndexes {
-			usage_to_field_index int32_indexes;
-			usage_to_field_index bool_indexes;
+		// The ranges are kept in config order because the first config usage
+		// that matches a descriptor usage wins. A config usage can be mapped
+		// only once, the used vectors keep track of that.
+		struct ConfigRanges {
+			explicit ConfigRanges(InitMemory* m) : int32s(m), bools(m), int32_used(m), bool_used(m) {}
+			init_vector<ConfigRange> int32s;
+			init_vector<ConfigRange> bools;
+			init_vector<bool> int32_used;
+			init_vector<bool> bool_used;
 		};
 
-		static void AddFieldIndexes(usage_to_field_index& m, size_t field_index, const std::vector<UsageRange>& usages);
-		FieldIndexes& GetFieldIndexes(Collection* c);
-		static bool TestInt32FieldFlags(Collection* c, const FieldIndex& fi, uint16_t flags);
-		static bool TestBoolFieldFlags(Collection* c, const FieldIndex& fi, uint16_t flags);
+		template <typename FIELDS>
+		static void AddConfigRanges(init_vector<ConfigRange>& ranges, init_vector<bool>& used, const std::vector<FIELDS*>& fields);
+		ConfigRanges& GetConfigRanges(Collection* c);
+		template <typename FIELDS>
+		static void MatchConfigRanges(const init_vector<ConfigRange>& ranges, init_vector<bool>& used,
+			const std::vector<FIELDS*>& fields, uint16_t flags, uint32_t page32, uint32_t first, uint32_t last, uint16_t* match);
+		// Maps count consecutive descriptor usages starting at usage_min to
+		// the usage indexes starting at index. Returns the number of mapped usages.
+		int32_t MatchUsageRange(Collection* c, ConfigRanges& cr, const DescriptorParser::FieldParams& fp, DescFieldMappings& dfm,
+			init_vector<bool>* matched_usage_indexes, size_t index, uint32_t page32, uint32_t usage_min, uint32_t count);
 
 		// Returns the number of found/mapped usages or a negative error code.
 		int32_t FindFieldUsagesInCollection(Collection* c, const DescriptorParser::FieldParams& fp,
-			DescFieldMappings& dfm, std::vector<bool>* matched_usage_indexes = nullptr);
+			DescFieldMappings& dfm, init_vector<bool>* matched_usage_indexes = nullptr);
 
 	private:
+		InitMemory* _memory;
 		mapping_t* _mapping;
+		changed_bits_t* _changed_bits;
 
 		Collection* _root;
-		std::set<Collection*> _matched_set;
-		std::vector<Collection*> _matched;
-		std::vector<size_t> _prev_matched_size;
+		init_set<Collection*> _matched_set;
+		init_vector<Collection*> _matched;
+		init_vector<size_t> _prev_matched_size;
 
-		std::map<Collection*, FieldIndexes> _collection_field_indexes;
+		init_map<Collection*, ConfigRanges> _collection_config_ranges;
 	};
 
 
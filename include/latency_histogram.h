@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+
+// 遅延 (µs) を幅が 2 倍ずつ広がるバケツで数える
+//   バケツ 0 は 0 µs、バケツ i (1 以上) は [2^(i-1), 2^i) µs、最後のバケツはそれより長いものすべて
+// add() はバケツを選んで数を増やすだけなので、製品のビルドでも入れたままにできる
+// add() を呼ぶのは1つのコアだけにする (読み出しは別のコアからでもよい。途中の値が見えることはある)
+const uint8_t LATENCY_HISTOGRAM_BUCKETS = 24; // 最後のバケツは 2^22 µs (約 4 秒) 以上
+
+struct LatencyHistogram {
+    volatile uint32_t counts[LATENCY_HISTOGRAM_BUCKETS];
+    volatile uint32_t total;
+    volatile uint32_t max_us;
+
+    // Cortex-M0+ には CLZ 命令がないが、Pico SDK では __builtin_clz が ROM の速い実装になる
+    void add(uint32_t us) {
+        uint8_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+        if (bucket >= LATENCY_HISTOGRAM_BUCKETS) {
+            bucket = LATENCY_HISTOGRAM_BUCKETS - 1;
+        }
+        counts[bucket] = counts[bucket] + 1;
+        total = total + 1;
+        if (us > max_us) {
+            max_us = us;
+        }
+    }
+
+    void clear() {
+        for (uint8_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+            counts[i] = 0;
+        }
+        total = 0;
+        max_us = 0;
+    }
+
+    // バケツ i に入る最大の値
+    static uint32_t bucket_upper_us(uint8_t bucket) {
+        return bucket == 0 ? 0 : (1u << bucket) - 1;
+    }
+
+    // 小さい方から permille / 1000 の割合までが入るバケツの上限 (パーセンタイルの近似)
+    uint32_t percentile_upper_us(uint32_t permille) const {
+        uint32_t n = total;
+        if (n == 0) {
+            return 0;
+        }
+        uint32_t rank = ((uint64_t)n * permille + 999) / 1000;
+        uint32_t seen = 0;
+        for (uint8_t i = 0; i + 1 < LATENCY_HISTOGRAM_BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                uint32_t upper_us = bucket_upper_us(i);
+                return upper_us < max_us ? upper_us : max_us;
+            }
+        }
+        return max_us;
+    }
+};
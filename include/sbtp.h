@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "crc8.h"
+
+
+// SBTP フレーム
+//   [0x55] [データ長] [エスケープしたデータ...] [CRC-8] [0xAA]
+// データ中の 0x55, 0xAA, 0x5A は 0x5A の後ろに 0x42 と XOR した値を置く
+// データ長はエスケープ前のバイト数、CRC はエスケープ後のデータから計算する
+
+const uint8_t SBTP_HEADER_BYTE = 0x55;
+const uint8_t SBTP_FOOTER_BYTE = 0xAA;
+const uint8_t SBTP_ESCAPE_BYTE = 0x5A;
+const uint8_t SBTP_XOR_BYTE = 0x42;
+
+
+// data_len バイトのデータを送るのに必要な最大フレーム長 (全バイトをエスケープした場合)
+constexpr size_t sbtp_max_frame_size(size_t data_len) {
+    return data_len * 2 + 4;
+}
+
+
+// 出力先に直接1パスでフレームを書く
+// エスケープ、CRC の計算、ヘッダとフッタの書き込みを put() のたびに進める
+//   SbtpEncoder encoder(out, 9);
+//   encoder.put(...); (9 回)
+//   size_t frame_len = encoder.finish();
+// out には sbtp_max_frame_size(data_len) バイトの空きが必要
+struct SbtpEncoder {
+    uint8_t *out;
+    uint8_t *cursor;
+    uint8_t crc;
+
+    SbtpEncoder(uint8_t *out, uint8_t data_len) : out(out), cursor(out + 2), crc(CRC8_INITIAL_VALUE) {
+        out[0] = SBTP_HEADER_BYTE;
+        out[1] = data_len;
+    }
+
+    void put(uint8_t byte) {
+        if (byte == SBTP_HEADER_BYTE || byte == SBTP_FOOTER_BYTE || byte == SBTP_ESCAPE_BYTE) {
+            byte ^= SBTP_XOR_BYTE;
+            *cursor++ = SBTP_ESCAPE_BYTE;
+            crc = crc8_update(crc, SBTP_ESCAPE_BYTE);
+        }
+        *cursor++ = byte;
+        crc = crc8_update(crc, byte);
+    }
+
+    // CRC とフッタを書き、フレーム長を返す
+    size_t finish() {
+        *cursor++ = crc8_final(crc);
+        *cursor++ = SBTP_FOOTER_BYTE;
+        return cursor - out;
+    }
+};
+
+
+static inline size_t sbtp_encode(uint8_t *out, const uint8_t *data, uint8_t len) {
+    SbtpEncoder encoder(out, len);
+    for (uint8_t i = 0; i < len; i++) {
+        encoder.put(data[i]);
+    }
+    return encoder.finish();
+}
+
+
+const uint8_t SBTP_MAX_DATA_SIZE = 32; // SbtpDecoder が受け取れる最大データ長
+
+enum SbtpDecodeResult {
+    SBTP_DECODE_NONE, // フレームの途中
+    SBTP_DECODE_FRAME, // data にフレームのデータがそろった
+    SBTP_DECODE_ERROR, // 壊れたフレームを捨てた
+};
+
+
+// 受信したバイト列から1バイトずつフレームを取り出す (受信側の参考実装)
+struct SbtpDecoder {
+    enum State {
+        WAIT_HEADER,
+        LENGTH,
+        DATA,
+        ESCAPED,
+        CRC,
+        FOOTER,
+    };
+
+    uint8_t data[SBTP_MAX_DATA_SIZE];
+    uint8_t data_len = 0; // 受け取ったデータ長
+    uint8_t expected_len = 0; // フレームのデータ長
+    uint8_t crc = CRC8_INITIAL_VALUE;
+    bool crc_ok = false;
+    State state = WAIT_HEADER;
+
+    SbtpDecodeResult put(uint8_t byte) {
+        switch (state) {
+        case WAIT_HEADER:
+            if (byte == SBTP_HEADER_BYTE) {
+                state = LENGTH;
+            }
+            return SBTP_DECODE_NONE;
+        case LENGTH:
+            if (byte > SBTP_MAX_DATA_SIZE) {
+                return fail(byte);
+            }
+            expected_len = byte;
+            data_len = 0;
+            crc = CRC8_INITIAL_VALUE;
+            state = expected_len == 0 ? CRC : DATA;
+            return SBTP_DECODE_NONE;
+        case DATA:
+            if (byte == SBTP_HEADER_BYTE || byte == SBTP_FOOTER_BYTE) {
+                return fail(byte);
+            }
+            crc = crc8_update(crc, byte);
+            if (byte == SBTP_ESCAPE_BYTE) {
+                state = ESCAPED;
+                return SBTP_DECODE_NONE;
+            }
+            return store(byte);
+        case ESCAPED:
+            crc = crc8_update(crc, byte);
+            state = DATA;
+            return store(byte ^ SBTP_XOR_BYTE);
+        case CRC:
+            crc_ok = byte == crc8_final(crc);
+            state = FOOTER;
+            return SBTP_DECODE_NONE;
+        case FOOTER:
+            if (byte != SBTP_FOOTER_BYTE || !crc_ok) {
+                return fail(byte);
+            }
+            state = WAIT_HEADER;
+            return SBTP_DECODE_FRAME;
+        }
+        return SBTP_DECODE_NONE;
+    }
+
+private:
+    SbtpDecodeResult store(uint8_t byte) {
+        data[data_len] = byte;
+        data_len++;
+        if (data_len == expected_len) {
+            state = CRC;
+        }
+        return SBTP_DECODE_NONE;
+    }
+
+    // 途中でヘッダが来たらそこから読み直す
+    SbtpDecodeResult fail(uint8_t byte) {
+        state = byte == SBTP_HEADER_BYTE ? LENGTH : WAIT_HEADER;
+        return SBTP_DECODE_ERROR;
+    }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+
+// 書き込み側1つ、読み出し側いくつでもの共有変数 (シーケンスロック)
+// 書き込み側は待たない。読み出し側は書き込みと重なったら読み直すので、必ずそろった値を得る
+// 値は 32bit ずつ atomic にコピーするので、途中の値を読んでも未定義動作にならない
+template <class T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock needs a trivially copyable type");
+
+public:
+    Seqlock() {
+        for (uint32_t i = 0; i < WORDS; i++) {
+            _words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // 書き込み側
+
+    // 書き込んだ値のバージョンを返す
+    uint32_t write(const T &value) {
+        uint32_t words[WORDS] = {};
+        memcpy(words, &value, sizeof(T));
+
+        uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+        _sequence.store(sequence + 1, std::memory_order_relaxed); // 奇数は書き込み中
+        std::atomic_thread_fence(std::memory_order_release);
+        for (uint32_t i = 0; i < WORDS; i++) {
+            _words[i].store(words[i], std::memory_order_relaxed);
+        }
+        _sequence.store(sequence + 2, std::memory_order_release);
+        return (sequence + 2) >> 1;
+    }
+
+    // 読み出し側
+
+    // そろった値をコピーし、そのバージョンを返す
+    uint32_t read(T &value) const {
+        uint32_t words[WORDS];
+        while (true) {
+            uint32_t before = _sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            for (uint32_t i = 0; i < WORDS; i++) {
+                words[i] = _words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_sequence.load(std::memory_order_relaxed) == before) {
+                memcpy(&value, words, sizeof(T));
+                return before >> 1;
+            }
+        }
+    }
+
+    // 最後に書き込みを終えた値のバージョン (write() のたびに 1 増える)
+    uint32_t version() const {
+        return _sequence.load(std::memory_order_acquire) >> 1;
+    }
+
+private:
+    static constexpr uint32_t WORDS = (sizeof(T) + 3) / 4;
+
+    std::atomic<uint32_t> _sequence { 0 };
+    std::atomic<uint32_t> _words[WORDS];
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+
+// 生産者1つ、消費者1つのリングバッファ (ロックなし)
+// push() は生産者だけ、pop() は消費者だけが呼ぶ (別のコアやスレッドでよい)
+// いっぱいのときの push() は新しい要素を捨てて false を返す (捨てた数は dropped() で見える)
+template <class T, uint32_t CAPACITY>
+class SpscQueue {
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+    // 生産者側
+
+    bool push(const T &item) {
+        uint32_t head = _head.load(std::memory_order_relaxed);
+        uint32_t tail = _tail.load(std::memory_order_acquire);
+        if (head - tail >= CAPACITY) {
+            _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        _items[head & (CAPACITY - 1)] = item;
+        _head.store(head + 1, std::memory_order_release);
+
+        uint32_t used = head + 1 - tail;
+        if (used > _high_water.load(std::memory_order_relaxed)) {
+            _high_water.store(used, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // 生産者から見た空き (消費者が取り出すと増えることはあっても減ることはない)
+    uint32_t free_space() const {
+        return CAPACITY - (_head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_acquire));
+    }
+
+    // 消費者側
+
+    bool pop(T &item) {
+        uint32_t tail = _tail.load(std::memory_order_relaxed);
+        uint32_t head = _head.load(std::memory_order_acquire);
+        if (head == tail) {
+            return false;
+        }
+
+        item = _items[tail & (CAPACITY - 1)];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_relaxed);
+    }
+
+    // どちらからでも読める
+
+    static constexpr uint32_t capacity() { return CAPACITY; }
+    uint32_t high_water() const { return _high_water.load(std::memory_order_relaxed); }
+    uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+    T _items[CAPACITY];
+    std::atomic<uint32_t> _head { 0 }; // 次に書く位置 (生産者だけが進める)
+    std::atomic<uint32_t> _tail { 0 }; // 次に読む位置 (消費者だけが進める)
+    std::atomic<uint32_t> _high_water { 0 };
+    std::atomic<uint32_t> _dropped { 0 };
+};
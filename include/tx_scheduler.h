@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+
+// UART の送信タイミングを決める
+// 新しい入力があればすぐに送信し、入力がなければキープアライブ間隔で送信する
+// どちらの場合もフレーム間隔は min_gap_us 以上空ける
+// 時刻は呼び出し側が渡す (ハードウェアに依存しないのでホストでも動かせる)
+struct TxScheduler {
+    uint32_t min_gap_us;
+    uint32_t keepalive_us;
+    uint64_t last_tx_us;
+    bool has_sent;
+
+    TxScheduler(uint32_t min_gap_us, uint32_t keepalive_us)
+        : min_gap_us(min_gap_us), keepalive_us(keepalive_us), last_tx_us(0), has_sent(false) {}
+
+    // 今送信すべきなら true
+    bool is_due(uint64_t now_us, bool has_new_state) const {
+        if (!has_sent) {
+            return true;
+        }
+
+        uint64_t elapsed_us = now_us - last_tx_us;
+        if (elapsed_us < min_gap_us) {
+            return false;
+        }
+        return has_new_state || elapsed_us >= keepalive_us;
+    }
+
+    // 次に送信できるようになる時刻
+    // 新しい入力がなければキープアライブの時刻になる
+    uint64_t next_due_us(bool has_new_state) const {
+        if (!has_sent) {
+            return 0;
+        }
+        if (has_new_state || keepalive_us < min_gap_us) {
+            return last_tx_us + min_gap_us;
+        }
+        return last_tx_us + keepalive_us;
+    }
+
+    void mark_sent(uint64_t now_us) {
+        last_tx_us = now_us;
+        has_sent = true;
+    }
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+
+// フレームを実際に送り出す部分 (DMA, ホストの模擬など)
+// start() で渡したフレームを送り終えたら notify_complete() を呼ぶ
+// notify_complete() は割り込みから呼んでもよい
+class UartTxBackend {
+public:
+    typedef void (*complete_fn)(void *context);
+
+    virtual void start(const uint8_t *data, size_t len) = 0;
+    // キューの状態を変更する間、notify_complete() と競合しないようにする
+    virtual uint32_t lock() = 0;
+    virtual void unlock(uint32_t state) = 0;
+
+    void set_complete_callback(complete_fn fn, void *context) {
+        _complete_fn = fn;
+        _complete_context = context;
+    }
+
+protected:
+    void notify_complete() {
+        if (_complete_fn) {
+            _complete_fn(_complete_context);
+        }
+    }
+
+private:
+    complete_fn _complete_fn = nullptr;
+    void *_complete_context = nullptr;
+};
+
+
+// 送信待ちのフレームがいっぱいのときにどれを捨てるか
+enum UartTxPolicy {
+    UART_TX_DROP_OLDEST, // 一番古い送信待ちフレームを捨てる
+    UART_TX_COALESCE, // 一番新しい送信待ちフレームを新しいフレームで置き換える
+};
+
+
+struct UartTxStats {
+    uint32_t committed; // キューに積んだフレーム数
+    uint32_t sent; // 送信し終えたフレーム数
+    uint32_t dropped; // 送信されずに捨てられたフレーム数
+};
+
+
+// 送信フレームのリング
+// reserve() で空きスロットを借りてフレームを直接書き込み、commit() で送信待ちにする
+// 送信中でなければ commit() がそのまま送信を始め、送信が終わると次の送信待ちフレームを送る
+// reserve()/commit()/submit() はブロックしない
+template <uint8_t SLOTS, size_t SLOT_SIZE>
+class UartTxQueue {
+    static_assert(SLOTS >= 2 && SLOTS <= 16, "UartTxQueue needs 2 to 16 slots");
+
+public:
+    typedef void (*sent_fn)(void *context, uint32_t tag);
+
+    UartTxQueue(UartTxBackend *backend, UartTxPolicy policy) : _backend(backend), _policy(policy) {
+        _backend->set_complete_callback(on_complete, this);
+    }
+
+    // フレームを送り終えるたびに、commit() に渡した tag を付けて呼ぶ (送信完了の割り込みから呼ばれる)
+    // 捨てられたフレームでは呼ばない
+    void set_sent_callback(sent_fn fn, void *context) {
+        uint32_t state = _backend->lock();
+        _sent_fn = fn;
+        _sent_context = context;
+        _backend->unlock(state);
+    }
+
+    static constexpr size_t slot_size() { return SLOT_SIZE; }
+
+    // 書き込み用のスロットを返す
+    // 空きがなければポリシーに従って送信待ちフレームを1つ捨てる
+    uint8_t *reserve() {
+        uint32_t state = _backend->lock();
+        if (_writing < 0) {
+            if (_free_mask == 0) {
+                drop_pending();
+            }
+            _writing = take_free_slot();
+        }
+        _backend->unlock(state);
+        return _slots[_writing];
+    }
+
+    // reserve() したスロットを len バイトのフレームとして送信待ちにする
+    // len が 0 ならスロットを返すだけ
+    void commit(size_t len, uint32_t tag = 0) {
+        uint32_t state = _backend->lock();
+        if (_writing >= 0) {
+            if (len == 0 || len > SLOT_SIZE) {
+                _free_mask |= 1u << _writing;
+            }
+            else {
+                _lens[_writing] = len;
+                _tags[_writing] = tag;
+                _order[_count] = _writing;
+                _count++;
+                _stats.committed++;
+                if (_count > _high_water) {
+                    _high_water = _count;
+                }
+                start_next();
+            }
+            _writing = -1;
+        }
+        _backend->unlock(state);
+    }
+
+    // フレームをコピーして送信待ちにする
+    bool submit(const uint8_t *frame, size_t len) {
+        if (len == 0 || len > SLOT_SIZE) {
+            return false;
+        }
+        memcpy(reserve(), frame, len);
+        commit(len);
+        return true;
+    }
+
+    bool is_busy() const { return _busy; }
+    // 次の reserve() で送信待ちフレームが捨てられるなら true
+    bool is_full() const { return _writing < 0 && _free_mask == 0; }
+    uint8_t pending() const { return _count - (_busy ? 1 : 0); }
+    uint8_t high_water() const { return _high_water; }
+
+    UartTxStats stats() {
+        uint32_t state = _backend->lock();
+        UartTxStats stats = _stats;
+        _backend->unlock(state);
+        return stats;
+    }
+
+private:
+    static void on_complete(void *context) {
+        UartTxQueue *queue = static_cast<UartTxQueue *>(context);
+        uint32_t state = queue->_backend->lock();
+        queue->complete();
+        queue->_backend->unlock(state);
+    }
+
+    void complete() {
+        if (!_busy) {
+            return;
+        }
+        uint32_t tag = _tags[_order[0]];
+        _free_mask |= 1u << _order[0];
+        remove_at(0);
+        _busy = false;
+        _stats.sent++;
+        start_next();
+        if (_sent_fn) {
+            _sent_fn(_sent_context, tag);
+        }
+    }
+
+    void start_next() {
+        if (_busy || _count == 0) {
+            return;
+        }
+        _busy = true;
+        _backend->start(_slots[_order[0]], _lens[_order[0]]);
+    }
+
+    void drop_pending() {
+        // 送信中のフレームは捨てられない
+        uint8_t index = _policy == UART_TX_DROP_OLDEST ? (_busy ? 1 : 0) : _count - 1;
+        _free_mask |= 1u << _order[index];
+        remove_at(index);
+        _stats.dropped++;
+    }
+
+    int8_t take_free_slot() {
+        for (uint8_t i = 0; i < SLOTS; i++) {
+            if (_free_mask & (1u << i)) {
+                _free_mask &= ~(1u << i);
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void remove_at(uint8_t index) {
+        for (uint8_t i = index; i + 1 < _count; i++) {
+            _order[i] = _order[i + 1];
+        }
+        _count--;
+    }
+
+    UartTxBackend *_backend;
+    UartTxPolicy _policy;
+    uint8_t _slots[SLOTS][SLOT_SIZE];
+    size_t _lens[SLOTS];
+    uint32_t _tags[SLOTS];
+    uint8_t _order[SLOTS]; // 送信順のスロット番号 (先頭が送信中)
+    volatile uint8_t _count = 0;
+    volatile bool _busy = false;
+    volatile uint32_t _free_mask = (1u << SLOTS) - 1;
+    int8_t _writing = -1;
+    uint8_t _high_water = 0;
+    UartTxStats _stats = { 0, 0, 0 };
+    sent_fn _sent_fn = nullptr;
+    void *_sent_context = nullptr;
+};
@@ -0,0 +1,50 @@
+#include "uart_tx_dma.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+
+UartTxDma *UartTxDma::_instance = nullptr;
+
+
+void UartTxDma::init(uart_inst_t *uart) {
+    _instance = this;
+    _channel = dma_claim_unused_channel(true);
+
+    dma_channel_config config = dma_channel_get_default_config(_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, uart_get_dreq_num(uart, true));
+    dma_channel_configure(_channel, &config, &uart_get_hw(uart)->dr, NULL, 0, false);
+
+    dma_channel_set_irq1_enabled(_channel, true);
+    irq_add_shared_handler(DMA_IRQ_1, irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
+}
+
+
+void UartTxDma::start(const uint8_t *data, size_t len) {
+    dma_channel_transfer_from_buffer_now(_channel, data, len);
+}
+
+
+uint32_t UartTxDma::lock() {
+    return save_and_disable_interrupts();
+}
+
+
+void UartTxDma::unlock(uint32_t state) {
+    restore_interrupts(state);
+}
+
+
+void UartTxDma::irq_handler() {
+    UartTxDma *self = _instance;
+    if (self == nullptr || !dma_channel_get_irq1_status(self->_channel)) {
+        return;
+    }
+    dma_channel_acknowledge_irq1(self->_channel);
+    // DMA は最後のバイトを UART の FIFO に積んだ時点で終わる (次のフレームはその後ろに続く)
+    self->notify_complete();
+}
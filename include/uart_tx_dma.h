@@ -0,0 +1,22 @@
+#pragma once
+
+#include "hardware/uart.h"
+#include "uart_tx.h"
+
+
+// DMA で UART にフレームを送るバックエンド
+// 送信完了は DMA_IRQ_1 で受け取る。割り込みは init() を呼んだコアで動く
+class UartTxDma : public UartTxBackend {
+public:
+    void init(uart_inst_t *uart);
+
+    void start(const uint8_t *data, size_t len) override;
+    uint32_t lock() override;
+    void unlock(uint32_t state) override;
+
+private:
+    static void irq_handler();
+
+    static UartTxDma *_instance;
+    int _channel = -1;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "uart_tx.h"
+
+
+// ホストで UartTxQueue を動かすためのバックエンド
+// 送信されたフレームを記録し、finish() が呼ばれるまで送信中のままにする
+class HostUartTxBackend : public UartTxBackend {
+public:
+    std::vector<uint8_t> bytes; // 送信されたバイト列
+    std::vector<size_t> frame_lens; // 送信されたフレームの長さ
+
+    void start(const uint8_t *data, size_t len) override {
+        bytes.insert(bytes.end(), data, data + len);
+        frame_lens.push_back(len);
+        _busy = true;
+    }
+
+    uint32_t lock() override {
+        _mutex.lock();
+        return 0;
+    }
+
+    void unlock(uint32_t) override {
+        _mutex.unlock();
+    }
+
+    bool is_busy() const { return _busy; }
+
+    // 送信完了の割り込みを模擬する
+    void finish() {
+        if (!_busy) {
+            return;
+        }
+        _busy = false;
+        notify_complete();
+    }
+
+private:
+    std::mutex _mutex;
+    bool _busy = false;
+};
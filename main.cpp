@@ -1,12 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <memory>
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
 #include "hardware/uart.h"
+#include "hardware/sync.h"
 #include "tusb.h"
 #include "bsp/board_api.h"
 #include "hid_report_parser.h"
+#include "sbtp.h"
+#include "cobs.h"
+#include "gamepad_frame.h"
+#include "spsc_queue.h"
+#include "seqlock.h"
+#include "doorbell_fifo.h"
+#include "tx_scheduler.h"
+#include "uart_tx.h"
+#include "uart_tx_dma.h"
+#include "latency_histogram.h"
 
 
 struct MountedGamepad {
@@ -50,6 +60,8 @@ struct GamepadData {
     uint8_t left_trigger; // 1byte
     uint8_t right_trigger; // 1byte
     uint8_t dpad; // 4bit
+    uint32_t timestamp_us; // USB レポートを受け取った時刻
+    uint32_t parsed_us; // レポートを解析し終えた時刻
 };
 
 const uint8_t DPAD_UP = 0;
@@ -72,94 +84,249 @@ const uint8_t LED_RED = 17;
 const uint8_t LED_GREEN = 16;
 const uint8_t LED_BLUE = 25;
 
+const size_t PARSER_ARENA_SIZE = 16 * 1024;
+
+const uint32_t UART_MIN_FRAME_GAP_US = 1000; // フレーム間の最小間隔
+const uint32_t UART_KEEPALIVE_MOUNTED_US = 20000; // ゲームパッド接続中、入力に変化がないときの送信間隔
+const uint32_t UART_KEEPALIVE_UNMOUNTED_US = 250000; // ゲームパッド未接続時の送信間隔
+const uint8_t UART_TX_SLOTS = 2; // 送信中 + 送信待ち
+const size_t UART_TX_SLOT_SIZE = 68;
+// true にすると変わったフィールドだけの差分フレームを送る (受信側が差分フレームに対応している必要がある)
+const bool UART_DELTA_FRAMES = false;
+const uint8_t UART_KEYFRAME_INTERVAL = 32; // 差分フレームを送るときのキーフレームの間隔 (フレーム数)
+// true にすると SBTP の代わりに COBS でフレームを区切る (キーフレームのフレーム長が最大 13 バイトに収まる)
+const bool UART_COBS_FRAMING = false;
+// true にするとシーケンス番号とタイムスタンプを付けた拡張フレームを送る (受信側が拡張フレームに対応している必要がある)
+const bool UART_EXTENDED_FRAMES = false;
+// true にするとボタンと十字キーの変化をエッジフレームにまとめて送る (受信側がエッジフレームに対応している必要がある)
+// false なら変化を1つずつ状態のフレームで送るので、変化がフレームの送信より速く続くとキューがあふれる
+const bool UART_EDGE_FRAMES = true;
+const uint32_t EDGE_EVENT_QUEUE_SIZE = 64;
+const uint32_t USB_MIN_REPORT_INTERVAL_US = 1000; // フルスピードの HID のポーリング間隔の最小値
+const uint8_t FRAME_TIMING_SLOTS = 4; // 送信完了を待っているフレームの時刻を覚えておく数
+const uint32_t FRAME_TIMING_NONE = 0xFFFFFFFF; // 新しい状態を運ばないフレーム (キープアライブ) の tag
+
 static bool is_ps3 = false;
 static bool is_ps3_initialized = false;
 
 static uart_inst_t *UART_ID = uart1;
 
-static uint16_t uart_interval_ms = 250;
+static volatile uint32_t uart_keepalive_us = UART_KEEPALIVE_UNMOUNTED_US;
 static uint8_t gamepad_dev_addr = 0;
 static uint8_t gamepad_idx = 0;
-static std::unique_ptr<MountedGamepad> p = nullptr;
-static struct GamepadData gamepad_data = { { 0, 0 }, { 0, 0 }, { 0 }, 0, 0, 0 };
+// パーサーのメモリはヒープではなく静的な領域から確保する (抜き差しを繰り返してもヒープが断片化しない)
+static hid::StaticArena<PARSER_ARENA_SIZE> parser_arena;
+static hid::GamepadConfig gamepad_cfg;
+static MountedGamepad mounted_gamepad;
+static MountedGamepad *p = nullptr;
+// core1 だけが使う (送信完了の割り込みも core1 で動く)
+static UartTxDma uart_tx_dma;
+// 送信待ちがあふれたら古い状態のフレームを新しいもので置き換える
+static UartTxQueue<UART_TX_SLOTS, UART_TX_SLOT_SIZE> uart_tx(&uart_tx_dma, UART_TX_COALESCE);
+// core0 が最後に公開した状態 (core0 だけが使う)
+static struct GamepadData gamepad_data = { { 0, 0 }, { 0, 0 }, { 0 }, 0, 0, 0, 0, 0 };
+// core1 に渡す状態 (書き込み中の値を読まないようにシーケンスロックで守る)
+// バージョンは書き込むたびに増えるので、core1 はこれを見て新しい入力を知る
+// スティックとトリガーはここでまとめられ、core1 は送るときの最新の値を送る
+static Seqlock<GamepadData> shared_gamepad_data;
+// 公開したら core1 を起こす
+static FifoDoorbell core1_doorbell;
+// 短いボタンの押し離しもフレーム間隔に埋もれないように、ボタンか十字キーが変わった状態を1つずつ core1 に渡す
+// (スティックとトリガーもその時点の値を持たせ、エッジフレームで最後の変化と一緒に送る)
+static SpscQueue<GamepadData, EDGE_EVENT_QUEUE_SIZE> edge_events;
+static volatile uint32_t dropped_edge_events = 0; // キューがいっぱいで失ったボタンの変化 (0 のはず)
+
+// USB レポートが届いてから UART で送り終えるまでの段階ごとの遅延
+// 送り終えた時刻は DMA が最後のバイトを UART の FIFO に積んだ時刻 (線に出終わるのは最大 FIFO 分後)
+static LatencyHistogram latency_received_to_parsed; // レポートの解析 (core0)
+static LatencyHistogram latency_parsed_to_encoded; // core1 に渡ってフレームにするまで (core1)
+static LatencyHistogram latency_encoded_to_sent; // 送信キューで待って送り終えるまで (core1 の割り込み)
+static LatencyHistogram latency_received_to_sent; // 全体 (core1 の割り込み)
+static LatencyHistogram latency_edge_received_to_sent; // 全体のうち、ボタンか十字キーの変化を運んだフレーム (一番古い変化)
+
+// 送信完了を待っているフレームの時刻 (core1 だけが使う)
+struct FrameTiming {
+    uint32_t received_us;
+    uint32_t encoded_us;
+    bool is_edge;
+};
+static FrameTiming frame_timings[FRAME_TIMING_SLOTS];
 
 
-static uint8_t crc8(uint8_t *data, uint8_t len) {
-    const uint8_t CRC8_GENERATE_POLYNOMIAL = 0xD5;
-    const uint8_t CRC8_INITIAL_VALUE = 0xFF;
-    const uint8_t CRC8_FINAL_XOR = 0xFF;
+static void publish_gamepad_data(const struct GamepadData &data) {
+    bool is_edge = data.buttons.raw != gamepad_data.buttons.raw || data.dpad != gamepad_data.dpad;
 
-    uint8_t crc = CRC8_INITIAL_VALUE;
+    // 変化を先に積むので、core1 が読んだ状態までの変化はキューから取り出せる
+    if (is_edge && !edge_events.push(data)) {
+        dropped_edge_events = dropped_edge_events + 1;
+    }
+    gamepad_data = data;
+    shared_gamepad_data.write(data);
+    core1_doorbell.ring();
+}
 
-    for (uint8_t i = 0; i < len; i++) {
-        crc ^= data[i];
-        for (uint8_t j = 0; j < 8; j++) {
-            if ((crc & 0x80) != 0) {
-                crc = (crc << 1) ^ CRC8_GENERATE_POLYNOMIAL;
-            }
-            else {
-                crc <<= 1;
-            }
-        }
+
+// フレームと同じ並び (GAMEPAD_STATE_SIZE バイト) にする
+static void to_frame_state(const struct GamepadData &data, uint8_t *state) {
+    state[0] = data.left_joystick.x;
+    state[1] = data.left_joystick.y;
+    state[2] = data.right_joystick.x;
+    state[3] = data.right_joystick.y;
+    state[4] = (data.buttons.raw & 0xFF00) >> 8;
+    state[5] = data.buttons.raw & 0x00FF;
+    state[6] = data.left_trigger;
+    state[7] = data.right_trigger;
+    state[8] = data.dpad;
+}
+
+
+// 送信完了の割り込みから呼ばれる (tag は frame_timings の番号)
+static void on_frame_sent(void *context, uint32_t tag) {
+    // 送信キューの空きを待って WFE で眠っている core1 を起こす
+    __sev();
+    if (tag == FRAME_TIMING_NONE) {
+        return;
+    }
+    uint32_t sent_us = time_us_32();
+    const FrameTiming &timing = frame_timings[tag % FRAME_TIMING_SLOTS];
+    latency_encoded_to_sent.add(sent_us - timing.encoded_us);
+    latency_received_to_sent.add(sent_us - timing.received_us);
+    if (timing.is_edge) {
+        latency_edge_received_to_sent.add(sent_us - timing.received_us);
     }
-    return crc ^ CRC8_FINAL_XOR;
 }
 
 
 static void core1_main() {
-    const uint8_t DATA_LEN = 9;
-
-    const uint8_t SBTP_HEADER_BYTE = 0x55;
-    const uint8_t SBTP_FOOTER_BYTE = 0xAA;
-    const uint8_t SBTP_ESCAPE_BYTE = 0x5A;
-    const uint8_t SBTP_XOR_BYTE = 0x42;
+    static_assert(sbtp_max_frame_size(GAMEPAD_MAX_FRAME_DATA_SIZE) <= UART_TX_SLOT_SIZE, "UART_TX_SLOT_SIZE is too small");
+    static_assert(cobs_max_frame_size(GAMEPAD_MAX_FRAME_DATA_SIZE) <= UART_TX_SLOT_SIZE, "UART_TX_SLOT_SIZE is too small");
+    // 送信完了を待つフレームは送信キューのスロット数まで
+    static_assert(FRAME_TIMING_SLOTS >= UART_TX_SLOTS, "FRAME_TIMING_SLOTS is too small");
+
+    uart_tx_dma.init(UART_ID);
+    uart_tx.set_sent_callback(on_frame_sent, nullptr);
+
+    TxScheduler scheduler(UART_MIN_FRAME_GAP_US, uart_keepalive_us);
+    GamepadFrameEncoder frame_encoder(UART_DELTA_FRAMES ? UART_KEYFRAME_INTERVAL : 1);
+    GamepadFrameHeader frame_header = { 0, 0 };
+    uint32_t sent_version = shared_gamepad_data.version();
+    // 最後に送った変化のボタンと十字キー (状態のフレームもこれを送り、変化の順番を追い越さない)
+    uint16_t sent_buttons = 0;
+    uint8_t sent_dpad = 0;
+    uint32_t resynced_drops = 0;
 
     while (true) {
-        gpio_put(LED_BLUE, false);
-
-        uint8_t data[DATA_LEN] = {
-            gamepad_data.left_joystick.x,
-            gamepad_data.left_joystick.y,
-            gamepad_data.right_joystick.x,
-            gamepad_data.right_joystick.y,
-            (gamepad_data.buttons.raw & 0xFF00) >> 8,
-            gamepad_data.buttons.raw & 0x00FF,
-            gamepad_data.left_trigger,
-            gamepad_data.right_trigger,
-            gamepad_data.dpad
-        };
-
-        uint8_t payload[DATA_LEN * 2];
-        uint8_t payload_len = 0;
-
-        for (uint8_t i = 0; i < DATA_LEN; i++) {
-            if (data[i] == SBTP_HEADER_BYTE || data[i] == SBTP_FOOTER_BYTE || data[i] == SBTP_ESCAPE_BYTE) {
-                payload[payload_len] = SBTP_ESCAPE_BYTE;
-                payload_len++;
-                payload[payload_len] = data[i] ^ SBTP_XOR_BYTE;
-                payload_len++;
-            } else {
-                payload[payload_len] = data[i];
-                payload_len++;
+        gpio_put(LED_BLUE, !uart_tx.is_busy());
+
+        // 送信待ちを置き換えると変化が消えるので、送信キューに空きができるまでは送らない
+        // 空きは送信完了の割り込みでできるので、それまで WFE で眠る (割り込みが __sev() で起こす)
+        if (uart_tx.is_full()) {
+            __wfe();
+            continue;
+        }
+
+        // 新しい入力の通知か、送信できる時刻 (最小間隔かキープアライブ) まで眠る
+        uint64_t now_us = time_us_64();
+        bool has_new_state = !edge_events.empty() || shared_gamepad_data.version() != sent_version;
+        scheduler.keepalive_us = uart_keepalive_us;
+        if (!scheduler.is_due(now_us, has_new_state)) {
+            core1_doorbell.wait_until(scheduler.next_due_us(has_new_state));
+            continue;
+        }
+        scheduler.mark_sent(now_us);
+
+        // スティックとトリガーはいつも最新の状態を送る
+        uint32_t drops = dropped_edge_events;
+        struct GamepadData data;
+        sent_version = shared_gamepad_data.read(data);
+
+        // キューがあふれて変化を失ったら、読んだ状態までの変化を取り出し終えたところで最新のボタンに合わせる
+        if (drops != resynced_drops && edge_events.empty()) {
+            sent_buttons = (uint16_t)data.buttons.raw;
+            sent_dpad = data.dpad;
+            resynced_drops = drops;
+        }
+
+        frame_header.timestamp_us = data.timestamp_us;
+        const GamepadFrameHeader *header = UART_EXTENDED_FRAMES ? &frame_header : nullptr;
+        uint8_t *frame = uart_tx.reserve();
+        size_t frame_len;
+        uint32_t oldest_received_us = data.timestamp_us;
+        uint32_t oldest_parsed_us = data.parsed_us;
+        bool has_edge = false;
+
+        // 変化は積まれた順にエッジフレームにまとめて送る (最初の変化の前にキーフレームが必要)
+        // 送信が追いつかなくても、1フレームで運ぶ変化が増えるだけで変化は失わない
+        GamepadEdge edges[GAMEPAD_EDGE_FRAME_MAX_ENTRIES];
+        uint32_t edge_received_us[GAMEPAD_EDGE_FRAME_MAX_ENTRIES];
+        uint8_t edge_count = 0;
+        GamepadData event;
+        while (UART_EDGE_FRAMES && frame_encoder.has_keyframe && edge_count < GAMEPAD_EDGE_FRAME_MAX_ENTRIES
+            && edge_events.pop(event)) {
+            if (edge_count == 0) {
+                oldest_received_us = event.timestamp_us;
+                oldest_parsed_us = event.parsed_us;
             }
+            to_frame_state(event, edges[edge_count].state);
+            edge_received_us[edge_count] = event.timestamp_us;
+            edge_count++;
         }
 
-        uint8_t frame[DATA_LEN * 2 + 4];
-        frame[0] = SBTP_HEADER_BYTE;
-        frame[1] = 9;
+        if (edge_count > 0) {
+            uint32_t last_received_us = event.timestamp_us;
+            for (uint8_t i = 0; i < edge_count; i++) {
+                uint32_t age_us = last_received_us - edge_received_us[i];
+                edges[i].age_us = age_us < GAMEPAD_EDGE_MAX_AGE_US ? age_us : GAMEPAD_EDGE_MAX_AGE_US;
+            }
+            sent_buttons = (uint16_t)event.buttons.raw;
+            sent_dpad = event.dpad;
+            has_edge = true;
 
-        for (uint8_t i = 0; i < payload_len; i++) {
-            frame[2 + i] = payload[i];
+            frame_header.timestamp_us = last_received_us;
+            if (UART_COBS_FRAMING) {
+                frame_len = frame_encoder.encode_edges<CobsEncoder>(frame, edges, edge_count, header);
+            }
+            else {
+                frame_len = frame_encoder.encode_edges<SbtpEncoder>(frame, edges, edge_count, header);
+            }
         }
+        else {
+            // エッジフレームを使わないときは、変化を1つずつ状態のフレームで送る
+            if (!UART_EDGE_FRAMES && edge_events.pop(event)) {
+                sent_buttons = (uint16_t)event.buttons.raw;
+                sent_dpad = event.dpad;
+                oldest_received_us = event.timestamp_us;
+                oldest_parsed_us = event.parsed_us;
+                frame_header.timestamp_us = event.timestamp_us;
+                has_edge = true;
+            }
+            data.buttons.raw = sent_buttons;
+            data.dpad = sent_dpad;
+            uint8_t state[GAMEPAD_STATE_SIZE];
+            to_frame_state(data, state);
 
-        frame[2 + payload_len] = crc8(payload, payload_len);
-        frame[3 + payload_len] = SBTP_FOOTER_BYTE;
+            // キープアライブはキーフレームにする (送信待ちは置き換えないので差分は途切れない)
+            bool keyframe = !has_new_state;
 
-        uart_write_blocking(UART_ID, frame, 4 + payload_len);
+            // 送信キューのスロットに直接フレームを書く
+            if (UART_COBS_FRAMING) {
+                frame_len = frame_encoder.encode<CobsEncoder>(frame, state, keyframe, header);
+            }
+            else {
+                frame_len = frame_encoder.encode<SbtpEncoder>(frame, state, keyframe, header);
+            }
+        }
 
-        sleep_ms(uart_interval_ms / 2);
-        gpio_put(LED_BLUE, true);
-        sleep_ms(uart_interval_ms / 2);
+        // 新しい状態を運ぶフレームだけ遅延を数える
+        uint32_t timing_tag = FRAME_TIMING_NONE;
+        if (has_new_state) {
+            uint32_t encoded_us = time_us_32();
+            latency_parsed_to_encoded.add(encoded_us - oldest_parsed_us);
+            timing_tag = frame_header.sequence;
+            frame_timings[timing_tag % FRAME_TIMING_SLOTS] = { oldest_received_us, encoded_us, has_edge };
+        }
+        uart_tx.commit(frame_len, timing_tag);
+        frame_header.sequence++;
     }
 }
 
@@ -201,10 +368,61 @@ static void print_gamepad_data(struct GamepadData *data) {
         data->buttons.share,
         data->buttons.home
     );
+    printf(
+        "Edges: high water %2u/%u, dropped %u \r\n",
+        (unsigned)edge_events.high_water(),
+        (unsigned)edge_events.capacity(),
+        (unsigned)dropped_edge_events
+    );
     printf("\e[0;0H");
 }
 
 
+static void print_latency_histogram(const char *name, const LatencyHistogram &histogram) {
+    printf(
+        "Latency %-19s n=%lu p50<=%lu p90<=%lu p99<=%lu max=%lu buckets=",
+        name,
+        (unsigned long)histogram.total,
+        (unsigned long)histogram.percentile_upper_us(500),
+        (unsigned long)histogram.percentile_upper_us(900),
+        (unsigned long)histogram.percentile_upper_us(990),
+        (unsigned long)histogram.max_us
+    );
+    for (uint8_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        printf(i == 0 ? "%lu" : ",%lu", (unsigned long)histogram.counts[i]);
+    }
+    printf("\r\n");
+}
+
+
+static void print_latency_histograms() {
+    printf("Latency (us) buckets: 0, 1, 2-3, 4-7, ..., 2^22 and more\r\n");
+    print_latency_histogram("received->parsed", latency_received_to_parsed);
+    print_latency_histogram("parsed->encoded", latency_parsed_to_encoded);
+    print_latency_histogram("encoded->sent", latency_encoded_to_sent);
+    print_latency_histogram("received->sent", latency_received_to_sent);
+    print_latency_histogram("edge received->sent", latency_edge_received_to_sent);
+}
+
+
+#if HRP_PROFILE_ZONES_ENABLED
+// パーサのゾーンごとの呼び出し回数と時間 (ゾーンは入れ子なので、外側の時間は内側を含む)
+static void print_parser_profile_zones() {
+    printf("Parser zones: calls, total us, average ns\r\n");
+    for (size_t i = 0; i < (size_t)hid::ProfileZone::count; i++) {
+        const hid::ProfileZoneStats &stats = hid::GetProfileZoneStats((hid::ProfileZone)i);
+        printf(
+            "  %s: %lu, %lu, %lu\r\n",
+            hid::GetProfileZoneName((hid::ProfileZone)i),
+            (unsigned long)stats.calls,
+            (unsigned long)(stats.total_ns / 1000),
+            (unsigned long)(stats.calls == 0 ? 0 : stats.total_ns / stats.calls)
+        );
+    }
+}
+#endif
+
+
 static void read_gamepad_task() {
     if (gamepad_dev_addr == 0) {
         return;
@@ -225,11 +443,18 @@ static void read_gamepad_task() {
 }
 
 
+static bool print_gamepad_data_enabled = false;
+
 static void print_gamepad_data_task() {
     const uint16_t PRINT_INTERVAL_MS = 100;
 
     static uint32_t start_ms = 0;
 
+    if (!print_gamepad_data_enabled) {
+        start_ms = board_millis();
+        return;
+    }
+
     if (board_millis() - start_ms < PRINT_INTERVAL_MS) {
         return;
     }
@@ -239,6 +464,38 @@ static void print_gamepad_data_task() {
     print_gamepad_data(&gamepad_data);
 }
 
+// デバッグ用のシリアル (stdio) から1文字のコマンドを受け取る
+//   l: 遅延のヒストグラムを表示する
+//   c: 遅延のヒストグラム (とパーサのゾーン) を消す (他のコアが数えている途中の分はずれることがある)
+//   p: パーサのゾーンを表示する (-DHRP_PROFILE_ZONES=ON でビルドしたときだけ)
+//   d: 入力の表示 (100ms ごと) を切り替える
+static void serial_command_task() {
+    int command = getchar_timeout_us(0);
+    if (command == 'l') {
+        print_latency_histograms();
+    }
+    else if (command == 'c') {
+        latency_received_to_parsed.clear();
+        latency_parsed_to_encoded.clear();
+        latency_encoded_to_sent.clear();
+        latency_received_to_sent.clear();
+        latency_edge_received_to_sent.clear();
+#if HRP_PROFILE_ZONES_ENABLED
+        hid::ResetProfileZones();
+#endif
+        printf("Info: latency histograms cleared\r\n");
+    }
+    else if (command == 'd') {
+        print_gamepad_data_enabled = !print_gamepad_data_enabled;
+    }
+#if HRP_PROFILE_ZONES_ENABLED
+    else if (command == 'p') {
+        print_parser_profile_zones();
+    }
+#endif
+}
+
+
 static void led_blink_task() {
     const uint16_t BLINK_INTERVAL_MS = 500;
 
@@ -264,6 +521,10 @@ int main() {
     stdio_init_all();
     sleep_ms(1000);
 
+    // 設定の mapped / properties のベクタは起動時に一度だけヒープに確保する
+    // (これで接続のたびの parser.Init はアリーナしか使わない)
+    hid::SelectiveInputReportParser::PrepareConfig(&gamepad_cfg.root);
+
     tuh_init(BOARD_TUH_RHPORT);
     printf("Info: TinyUSB Host initialized\r\n");
 
@@ -273,6 +534,10 @@ int main() {
     const uart_parity_t UART_PARITY = UART_PARITY_NONE;
     const uint8_t UART_TX_PIN = 4;
     const uint8_t UART_RX_PIN = 5;
+    // 最大のエッジフレーム (SBTP でエスケープがないとき。COBS は最大でもこの長さ) を送り終えるまでに
+    // 届く変化が、そのフレームで運べる数より少なければ、変化が続いてもキューは伸びない
+    static_assert((GAMEPAD_MAX_FRAME_DATA_SIZE + 4) * (1 + UART_DATA_BITS + UART_STOP_BITS) * 1000000ull / UART_BAUD_RATE_BPS
+        < GAMEPAD_EDGE_FRAME_MAX_ENTRIES * USB_MIN_REPORT_INTERVAL_US, "Edge frames cannot keep up with the USB report rate");
 
     uart_init(UART_ID, UART_BAUD_RATE_BPS);
     gpio_set_function(UART_TX_PIN, UART_FUNCSEL_NUM(UART_ID, UART_TX_PIN));
@@ -303,7 +568,8 @@ int main() {
     while (true) {
         tuh_task();
         read_gamepad_task();
-        // print_gamepad_data_task();
+        print_gamepad_data_task();
+        serial_command_task();
         led_blink_task();
     }
 }
@@ -319,17 +585,20 @@ void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t idx, uint8_t const* desc_report,
         return;
     }
 
-    p = std::unique_ptr<MountedGamepad>(new MountedGamepad);
+    p = &mounted_gamepad;
     hid::BitFieldRef buttons_ref = p->buttons.Ref();
     hid::Int32ArrayRef axes_ref = p->axes.Ref();
-    hid::GamepadConfig cfg;
-    hid::Collection *cfg_root = cfg.Init(&buttons_ref, &axes_ref);
+    hid::Collection *cfg_root = gamepad_cfg.Init(&buttons_ref, &axes_ref);
     
-    int result = p->parser.Init(cfg_root, desc_report, desc_len);
+    int result = p->parser.Init(cfg_root, desc_report, desc_len, &parser_arena);
+
+    const hid::SelectiveInputReportParser::MemoryUsage &mem = p->parser.GetMemoryUsage();
+    printf("Info: parser memory: peak=%u steady=%u arena=%u\r\n", (unsigned)mem.peak, (unsigned)mem.steady, (unsigned)parser_arena.Size());
 
     if (result) {
         printf("Error: parser init failed: result=%s[%d] desc_size=%u\r\n", hid::str_error(result, "UNKNOWN"), result, desc_len);
-        p.reset();
+        p->parser.Reset();
+        p = nullptr;
         return;
     }
 
@@ -346,7 +615,7 @@ void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t idx, uint8_t const* desc_report,
 
     printf("Info: Gamepad mounted. address: 0x%02X, idx: %u\r\n", dev_addr, idx);
 
-    uart_interval_ms = 4;
+    uart_keepalive_us = UART_KEEPALIVE_MOUNTED_US;
     gamepad_dev_addr = dev_addr;
     gamepad_idx = idx;
 
@@ -367,19 +636,21 @@ void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t idx) {
 
     printf("Info: Gamepad unmounted. address: 0x%02X, idx: %u\r\n", dev_addr, idx);
 
-    uart_interval_ms = 250;
+    uart_keepalive_us = UART_KEEPALIVE_UNMOUNTED_US;
     gamepad_dev_addr = 0;
     gamepad_idx = 0;
     is_ps3 = false;
     is_ps3_initialized = false;
-    p.reset();
-    gamepad_data = { { 0, 0 }, { 0, 0 }, { 0 }, 0, 0, 0 };
+    p->parser.Reset();
+    p = nullptr;
+    uint32_t now_us = time_us_32();
+    publish_gamepad_data({ { 0, 0 }, { 0, 0 }, { 0 }, 0, 0, 0, now_us, now_us });
 
     gpio_put(LED_GREEN, true);
 }
 
 
-void parse_ps3(uint8_t const *report, uint16_t len) {
+void parse_ps3(uint8_t const *report, uint16_t len, uint32_t received_us) {
     int8_t lx = (int16_t)(report[6]) - 128;
     int8_t ly = (int16_t)(report[7]) - 128;
     struct JoyStickData left_joystick = { lx, ly };
@@ -404,19 +675,27 @@ void parse_ps3(uint8_t const *report, uint16_t len) {
     buttons.south = (report[3] & 0x40) != 0;
     buttons.west = (report[3] & 0x80) != 0;
     buttons.home = (report[4] & 0x01) != 0;
-    gamepad_data = { left_joystick, right_joystick, buttons, left_trigger, right_trigger, dpad };
+
+    uint32_t parsed_us = time_us_32();
+    latency_received_to_parsed.add(parsed_us - received_us);
+    publish_gamepad_data({ left_joystick, right_joystick, buttons, left_trigger, right_trigger, dpad, received_us, parsed_us });
 }
 
 
 void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t idx, uint8_t const *report, uint16_t len) {
+    uint32_t received_us = time_us_32(); // レポートを受け取った時刻 (拡張フレームのタイムスタンプ)
+
     if (gamepad_dev_addr != dev_addr || gamepad_idx != idx) { return; } // ゲームパッド以外のデバイス
 
     if (is_ps3) {
-        parse_ps3(report, len);
+        parse_ps3(report, len, received_us);
         return;
     }
 
-    int result = p->parser.Parse(report, len);
+    int result = p->parser.ParseChanges(report, len);
+    uint32_t parsed_us = time_us_32();
+    latency_received_to_parsed.add(parsed_us - received_us);
+    if (result == hid::ERR_NOTHING_CHANGED) { return; } // 入力に変化なし
     if (result) {
         printf("Error: parse failed: result=%s[%d] report_size=%u\r\n", hid::str_error(result, "UNKNOWN"), result, len);
         return;
@@ -452,5 +731,5 @@ void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t idx, uint8_t const *re
         dpad |= 0b1000;
     }
 
-    gamepad_data = { left_joystick, right_joystick, buttons, left_trigger, right_trigger, dpad };
+    publish_gamepad_data({ left_joystick, right_joystick, buttons, left_trigger, right_trigger, dpad, received_us, parsed_us });
 }
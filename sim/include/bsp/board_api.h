@@ -0,0 +1,11 @@
+#pragma once
+
+// シミュレータ用の bsp/board_api.h
+
+#include <stdint.h>
+
+
+void board_init();
+uint32_t board_millis();
+// ボードによってはない (ファームウェアはアドレスを確かめてから呼ぶ)
+void board_init_after_tusb() __attribute__((weak));
@@ -0,0 +1,53 @@
+#pragma once
+
+// シミュレータ用の hardware/dma.h
+// 書き込み先が UART の DR のチャンネルだけを扱い、TX FIFO に空きがある分だけバイトを移す
+// 最後のバイトを移し終えたら IRQ1 を上げる
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+typedef struct {
+    enum dma_channel_transfer_size data_size;
+    bool read_increment;
+    bool write_increment;
+    unsigned dreq;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+
+static inline dma_channel_config dma_channel_get_default_config(unsigned channel) {
+    (void)channel;
+    dma_channel_config config = { DMA_SIZE_32, true, false, 0x3F };
+    return config;
+}
+
+static inline void channel_config_set_transfer_data_size(dma_channel_config *config, enum dma_channel_transfer_size size) {
+    config->data_size = size;
+}
+
+static inline void channel_config_set_read_increment(dma_channel_config *config, bool increment) {
+    config->read_increment = increment;
+}
+
+static inline void channel_config_set_write_increment(dma_channel_config *config, bool increment) {
+    config->write_increment = increment;
+}
+
+static inline void channel_config_set_dreq(dma_channel_config *config, unsigned dreq) {
+    config->dreq = dreq;
+}
+
+void dma_channel_configure(unsigned channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, unsigned transfer_count, bool trigger);
+void dma_channel_transfer_from_buffer_now(unsigned channel, const volatile void *read_addr, uint32_t transfer_count);
+void dma_channel_set_irq1_enabled(unsigned channel, bool enabled);
+bool dma_channel_get_irq1_status(unsigned channel);
+void dma_channel_acknowledge_irq1(unsigned channel);
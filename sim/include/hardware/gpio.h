@@ -0,0 +1,21 @@
+#pragma once
+
+// シミュレータ用の hardware/gpio.h (出力の状態を覚えるだけ)
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+enum gpio_function {
+    GPIO_FUNC_UART = 2,
+    GPIO_FUNC_SIO = 5,
+};
+
+void gpio_init(unsigned gpio);
+void gpio_set_dir(unsigned gpio, bool out);
+void gpio_put(unsigned gpio, bool value);
+bool gpio_get_out_level(unsigned gpio);
+void gpio_set_function(unsigned gpio, enum gpio_function function);
@@ -0,0 +1,21 @@
+#pragma once
+
+// シミュレータ用の hardware/irq.h
+// 割り込みは UART の送信を模擬するスレッドから呼ばれる
+// save_and_disable_interrupts() (hardware/sync.h) の間は呼ばれない
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+enum irq_num {
+    DMA_IRQ_0 = 11,
+    DMA_IRQ_1 = 12,
+};
+
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+
+typedef void (*irq_handler_t)(void);
+
+void irq_add_shared_handler(unsigned num, irq_handler_t handler, uint8_t order_priority);
+void irq_set_enabled(unsigned num, bool enabled);
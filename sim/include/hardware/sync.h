@@ -0,0 +1,13 @@
+#pragma once
+
+// シミュレータ用の hardware/sync.h
+// 割り込みを止める代わりに、割り込みを呼ぶスレッドと共有するロックを取る (入れ子にできる)
+// __wfe() は各コアのイベントのフラグが立つまで眠り、__sev() は両方のコアのフラグを立てる
+
+#include <stdint.h>
+
+
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+void __wfe();
+void __sev();
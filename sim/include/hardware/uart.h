@@ -0,0 +1,48 @@
+#pragma once
+
+// シミュレータ用の hardware/uart.h
+// 送信は DMA (hardware/dma.h) から TX FIFO に積まれ、ボーレートに合わせて1バイトずつ線に出る
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hardware/gpio.h"
+
+
+typedef struct {
+    volatile uint32_t dr;
+} uart_hw_t;
+
+typedef struct uart_inst {
+    uart_hw_t hw;
+    unsigned index;
+} uart_inst_t;
+
+extern uart_inst_t sim_uart_instances[2];
+#define uart0 (&sim_uart_instances[0])
+#define uart1 (&sim_uart_instances[1])
+
+typedef enum {
+    UART_PARITY_NONE,
+    UART_PARITY_EVEN,
+    UART_PARITY_ODD,
+} uart_parity_t;
+
+#define UART_FUNCSEL_NUM(uart, gpio) GPIO_FUNC_UART
+
+unsigned uart_init(uart_inst_t *uart, unsigned baudrate);
+void uart_set_format(uart_inst_t *uart, unsigned data_bits, unsigned stop_bits, uart_parity_t parity);
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts);
+
+static inline uart_hw_t *uart_get_hw(uart_inst_t *uart) {
+    return &uart->hw;
+}
+
+static inline unsigned uart_get_index(uart_inst_t *uart) {
+    return uart->index;
+}
+
+// RP2040 の DREQ_UART0_TX = 20 から TX, RX, UART1 TX, RX の順
+static inline unsigned uart_get_dreq_num(uart_inst_t *uart, bool is_tx) {
+    return 20 + 2 * uart->index + (is_tx ? 0 : 1);
+}
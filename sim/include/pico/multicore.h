@@ -0,0 +1,19 @@
+#pragma once
+
+// シミュレータ用の pico/multicore.h
+// core1 はスレッドで動く。FIFO はコアごとの受信キュー (RP2040 と同じく 8 段)
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+void multicore_launch_core1(void (*entry)(void));
+
+bool multicore_fifo_rvalid();
+bool multicore_fifo_wready();
+void multicore_fifo_push_blocking(uint32_t data);
+uint32_t multicore_fifo_pop_blocking();
+bool multicore_fifo_pop_timeout_us(uint64_t timeout_us, uint32_t *out);
+void multicore_fifo_drain();
+
+uint32_t get_core_num();
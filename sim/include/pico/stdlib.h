@@ -0,0 +1,28 @@
+#pragma once
+
+// シミュレータ用の pico/stdlib.h (ファームウェアが使う分だけ)
+// 実装は sim/sim_pico.cpp
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hardware/gpio.h"
+#include "hardware/uart.h"
+
+
+// 時刻はシミュレータを起動してからの µs
+uint64_t time_us_64();
+uint32_t time_us_32();
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+// 他のスレッドに CPU を譲る
+void tight_loop_contents();
+
+enum pico_error_codes {
+    PICO_OK = 0,
+    PICO_ERROR_TIMEOUT = -1,
+};
+
+bool stdio_init_all();
+// シミュレータには入力がないので、いつもタイムアウトする
+int getchar_timeout_us(uint32_t timeout_us);
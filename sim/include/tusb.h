@@ -0,0 +1,25 @@
+#pragma once
+
+// シミュレータ用の tusb.h (HID ホストで使う分だけ)
+// tuh_task() がトレースのイベントを時刻どおりに取り出し、ファームウェアのコールバックを呼ぶ
+// 実装は sim/sim_tusb.cpp
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define BOARD_TUH_RHPORT 1
+
+bool tuh_init(uint8_t rhport);
+void tuh_task();
+bool tuh_vid_pid_get(uint8_t dev_addr, uint16_t *vid, uint16_t *pid);
+
+bool tuh_hid_receive_ready(uint8_t dev_addr, uint8_t idx);
+bool tuh_hid_receive_report(uint8_t dev_addr, uint8_t idx);
+bool tuh_hid_set_report(uint8_t dev_addr, uint8_t idx, uint8_t report_id, uint8_t report_type, void *report, uint16_t len);
+
+// ファームウェアが実装するコールバック
+void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t idx, uint8_t const *desc_report, uint16_t desc_len);
+void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t idx);
+void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t idx, uint8_t const *report, uint16_t len);
+void tuh_hid_set_report_complete_cb(uint8_t dev_addr, uint8_t idx, uint8_t report_id, uint8_t report_type, uint16_t len);
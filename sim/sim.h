@@ -0,0 +1,99 @@
+#pragma once
+
+// シミュレータの部品の間のインターフェース
+//   sim_pico.cpp     タイマー、GPIO、マルチコア、UART、DMA、割り込みの代わり
+//   sim_tusb.cpp     TinyUSB の代わり (トレースを再生する)
+//   sim_trace.cpp    トレースのファイルを読む
+//   sim_firmware.cpp main.cpp をそのままビルドし、中の状態を見せる
+//   sim_main.cpp     トレースを読んでファームウェアを動かし、UART の出力を集計する
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "uart_tx.h"
+
+
+// sim_pico.cpp
+
+struct SimUartByte {
+    uint64_t time_us; // ストップビットを送り終えた時刻
+    uint8_t byte;
+};
+
+// これまでに線に出たバイト列
+std::vector<SimUartByte> sim_uart_bytes();
+// 1 バイトを送るのにかかる時間 (スタート、データ、パリティ、ストップビット)
+double sim_uart_byte_time_us();
+// core の FIFO が空で待っていたときに、相手が積んでから core が受け取るまでの時間 (µs)
+// core1 では FifoDoorbell の ring() から wait_until() が戻るまでの時間になる
+std::vector<uint64_t> sim_fifo_wake_latencies(uint32_t core);
+
+
+// sim_trace.cpp
+
+struct SimTraceEvent {
+    enum Kind {
+        MOUNT,
+        REPORT,
+        UMOUNT,
+    };
+    Kind kind;
+    uint64_t time_us; // 再生を始めてからの時刻
+    std::vector<uint8_t> report;
+};
+
+struct SimTrace {
+    uint16_t vid = 0;
+    uint16_t pid = 0;
+    std::vector<uint8_t> descriptor;
+    std::vector<SimTraceEvent> events; // 時刻順
+};
+
+bool sim_load_trace(const char *path, SimTrace &trace);
+
+
+// sim_tusb.cpp
+
+// tuh_init() から再生を始め、最後のイベントの settle_us 後に sim_on_trace_end() を呼ぶ
+void sim_usb_play(const SimTrace *trace, uint64_t settle_us);
+
+
+// sim_firmware.cpp
+
+struct SimFirmwareConfig {
+    bool cobs_framing;
+    bool delta_frames;
+    bool extended_frames;
+    bool edge_frames;
+};
+
+struct SimFirmwareStats {
+    uint32_t edge_high_water;
+    uint32_t edge_capacity;
+    uint32_t dropped_edge_events;
+    // ファームウェアが自分の時刻で数えた、ボタンの変化が届いてから送り終えるまで (バケツの上限の近似)
+    uint32_t edge_latency_n;
+    uint32_t edge_latency_p50_us;
+    uint32_t edge_latency_p99_us;
+    uint32_t edge_latency_max_us;
+    UartTxStats tx;
+};
+
+extern const SimFirmwareConfig sim_firmware_config;
+// core0 が最後に公開した状態をフレームと同じ並び (GAMEPAD_STATE_SIZE バイト) で書き、バージョンを返す
+// core0 (tuh_task() の中) から呼ぶ
+uint32_t sim_firmware_published_state(uint8_t *state);
+SimFirmwareStats sim_firmware_stats();
+// ファームウェアの遅延のヒストグラムを、シリアルの 'l' コマンドと同じ形で表示する
+void sim_firmware_print_latency();
+int firmware_main();
+
+
+// sim_main.cpp
+
+// USB のコールバックを呼んだ後に core0 から呼ばれる (time_us はトレースのイベントの時刻)
+void sim_on_usb_event(const SimTraceEvent &event, uint64_t event_time_us);
+// トレースを再生し終えたら core0 から呼ばれる (戻らない)
+// play_start_us は再生を始めた時刻 (time_us_64() の時計)
+[[noreturn]] void sim_on_trace_end(uint64_t play_start_us);
@@ -0,0 +1,40 @@
+// ファームウェア (main.cpp) をそのままホストでビルドする
+// main() はシミュレータのものと分けるため firmware_main() にする
+#define main firmware_main
+#include "../main.cpp"
+#undef main
+
+#include "sim.h"
+
+
+const SimFirmwareConfig sim_firmware_config = {
+    UART_COBS_FRAMING,
+    UART_DELTA_FRAMES,
+    UART_EXTENDED_FRAMES,
+    UART_EDGE_FRAMES,
+};
+
+
+uint32_t sim_firmware_published_state(uint8_t *state) {
+    to_frame_state(gamepad_data, state);
+    return shared_gamepad_data.version();
+}
+
+
+SimFirmwareStats sim_firmware_stats() {
+    return {
+        edge_events.high_water(),
+        edge_events.capacity(),
+        dropped_edge_events,
+        latency_edge_received_to_sent.total,
+        latency_edge_received_to_sent.percentile_upper_us(500),
+        latency_edge_received_to_sent.percentile_upper_us(990),
+        latency_edge_received_to_sent.max_us,
+        uart_tx.stats(),
+    };
+}
+
+
+void sim_firmware_print_latency() {
+    print_latency_histograms();
+}
@@ -0,0 +1,299 @@
+// ファームウェアのホスト用シミュレータ
+// ホストビルド (-DGAMEPAD2UART_HOST_BUILD=ON) で gamepad2uart_sim としてビルドされる
+//
+//   gamepad2uart_sim [--uart-log ファイル] [--settle-ms ミリ秒] [トレース]
+//
+// main.cpp をそのまま動かし (core0 はこのスレッド、core1 は別スレッド)、USB レポートのトレース
+// (書式は sim_trace.cpp) を時刻どおりに渡す。UART に出たバイト列をフレームに戻し、
+// core0 が公開した状態のどれを運んだかを突き合わせて、最後に JSON を1行出力する
+//   reports / states_published / edges_published  渡したレポート、公開された状態、そのうちボタンか十字キーの変化
+//   frames / frame_rate_hz / line_utilization      再生中に線に出たフレームと、UART の使用率
+//   states_seen                                    フレームで届いた状態 (スティックはまとめて送るので、途中の状態は届かない)
+//   edges_seen / edges_missing                     エッジフレームの変化 (エッジフレームを使わないときはボタンか十字キーが
+//                                                  変わったフレーム) で届いた変化と、届かなかった変化 (ファームウェアが失ったもの)
+//   latency_us / edge_latency_us                   トレースの時刻からフレームを送り終えるまで (p50, p90, p99, max)
+//   doorbell_wake_us                               眠っていた core1 が core0 の通知 (FifoDoorbell) で起きるまで
+//   firmware                                       ファームウェアのボタンの変化のキューと送信キューの数字と、
+//                                                  ファームウェアが数えたボタンの変化の遅延 (edge_received_to_sent_us)
+// JSON の前に、ファームウェア自身が数えた遅延のヒストグラムも表示する
+// --uart-log を付けると、線に出たバイトを「時刻 (µs) バイト」の形で1行ずつ書く
+//
+// 時刻はホストの実時間なので、遅延にはホストのスレッドの切り替えの遅れも含まれる
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "pico/stdlib.h"
+#include "sbtp.h"
+#include "cobs.h"
+#include "gamepad_frame.h"
+#include "sim.h"
+
+
+const uint64_t SIM_DEFAULT_SETTLE_MS = 300; // 最後のイベントの後、送り終えるのを待つ時間
+
+
+struct PublishedState {
+    uint8_t state[GAMEPAD_STATE_SIZE];
+    uint64_t event_time_us; // トレースでレポートが届いた時刻
+    uint64_t published_us; // core0 が公開し終えた時刻
+    bool is_edge; // ボタンか十字キーが変わった
+    bool seen; // フレームで届いた
+    bool edge_seen; // ボタンと十字キーがこの状態と同じフレームで届いた (is_edge のときだけ)
+};
+
+
+static SimTrace trace;
+static std::string trace_name;
+static const char *uart_log_path = nullptr;
+static uint32_t reports = 0;
+static uint32_t last_version = 0;
+static std::vector<PublishedState> published;
+
+
+void sim_on_usb_event(const SimTraceEvent &event, uint64_t event_time_us) {
+    if (event.kind == SimTraceEvent::REPORT) {
+        reports++;
+    }
+
+    PublishedState entry = {};
+    uint32_t version = sim_firmware_published_state(entry.state);
+    if (version == last_version) {
+        return;
+    }
+    last_version = version;
+
+    // フレームでは区別できないので、前と同じ状態はまとめる
+    static const uint8_t initial[GAMEPAD_STATE_SIZE] = {};
+    const uint8_t *previous = published.empty() ? initial : published.back().state;
+    if (memcmp(previous, entry.state, GAMEPAD_STATE_SIZE) == 0) {
+        return;
+    }
+    entry.event_time_us = event_time_us;
+    entry.published_us = time_us_64();
+    entry.is_edge = previous[4] != entry.state[4] || previous[5] != entry.state[5] || previous[8] != entry.state[8];
+    published.push_back(entry);
+}
+
+
+struct Percentiles {
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+static Percentiles percentiles(std::vector<uint64_t> values) {
+    if (values.empty()) {
+        return { 0, 0, 0, 0 };
+    }
+    std::sort(values.begin(), values.end());
+    // 小さい方から q の割合に入る最後の値 (nearest-rank)
+    auto rank = [&](double q) {
+        size_t index = (size_t)std::ceil(q * values.size());
+        return values[std::max<size_t>(index, 1) - 1];
+    };
+    return { rank(0.50), rank(0.90), rank(0.99), values.back() };
+}
+
+
+[[noreturn]] void sim_on_trace_end(uint64_t play_start_us) {
+    uint64_t end_us = time_us_64();
+    std::vector<SimUartByte> bytes = sim_uart_bytes();
+    SimFirmwareStats stats = sim_firmware_stats();
+    const SimFirmwareConfig &config = sim_firmware_config;
+
+    SbtpDecoder sbtp;
+    CobsDecoder cobs;
+    GamepadFrameDecoder frame_decoder(config.extended_frames);
+    GamepadLinkMonitor link_monitor;
+    uint32_t frames = 0;
+    uint32_t uart_bytes = 0;
+    uint32_t decode_errors = 0;
+    size_t next_published = 0;
+    size_t next_edge = 0;
+    uint8_t previous_buttons[3] = { 0, 0, 0 };
+    std::vector<uint64_t> latencies;
+    std::vector<uint64_t> edge_latencies;
+
+    for (const SimUartByte &byte : bytes) {
+        bool in_play = byte.time_us >= play_start_us;
+        uart_bytes += in_play;
+
+        const uint8_t *data;
+        uint8_t data_len;
+        if (config.cobs_framing) {
+            CobsDecodeResult result = cobs.put(byte.byte);
+            decode_errors += in_play && result == COBS_DECODE_ERROR;
+            if (result != COBS_DECODE_FRAME) {
+                continue;
+            }
+            data = cobs.data;
+            data_len = cobs.data_len;
+        }
+        else {
+            SbtpDecodeResult result = sbtp.put(byte.byte);
+            decode_errors += in_play && result == SBTP_DECODE_ERROR;
+            if (result != SBTP_DECODE_FRAME) {
+                continue;
+            }
+            data = sbtp.data;
+            data_len = sbtp.data_len;
+        }
+        if (!frame_decoder.apply(data, data_len)) {
+            continue;
+        }
+        // フレームが運んだボタンと十字キー (バイト 4, 5, 8) の変化を順に並べる
+        // エッジフレームは途中の状態をすべて、それ以外は前のフレームから変わったときだけ
+        uint8_t frame_edges[GAMEPAD_EDGE_FRAME_MAX_ENTRIES][3];
+        uint8_t frame_edge_count = 0;
+        for (uint8_t i = 0; i < std::max<uint8_t>(frame_decoder.edge_count, 1); i++) {
+            const uint8_t *state = frame_decoder.edge_count > 0 ? frame_decoder.edges[i].state : frame_decoder.state;
+            uint8_t buttons[3] = { state[4], state[5], state[8] };
+            if (memcmp(buttons, previous_buttons, sizeof(buttons)) != 0) {
+                memcpy(frame_edges[frame_edge_count++], buttons, sizeof(buttons));
+                memcpy(previous_buttons, buttons, sizeof(buttons));
+            }
+        }
+        if (!in_play) {
+            continue;
+        }
+        frames++;
+        if (config.extended_frames) {
+            link_monitor.on_frame(frame_decoder.header, byte.time_us);
+        }
+
+        // 公開された順に、このフレームより前に公開された同じ状態を探す
+        // (キープアライブは最後に届いた状態と同じなので、どれにも当たらない)
+        for (size_t i = next_published; i < published.size() && published[i].published_us <= byte.time_us; i++) {
+            PublishedState &entry = published[i];
+            if (memcmp(entry.state, frame_decoder.state, GAMEPAD_STATE_SIZE) != 0) {
+                continue;
+            }
+            entry.seen = true;
+            latencies.push_back(byte.time_us - entry.event_time_us);
+            next_published = i + 1;
+            break;
+        }
+
+        // 変化ごとに、公開された順にボタンと十字キーが同じ変化を探す
+        // (スティックは比べない)
+        for (uint8_t j = 0; j < frame_edge_count; j++) {
+            const uint8_t *buttons = frame_edges[j];
+            for (size_t i = next_edge; i < published.size() && published[i].published_us <= byte.time_us; i++) {
+                PublishedState &entry = published[i];
+                if (!entry.is_edge || entry.state[4] != buttons[0] || entry.state[5] != buttons[1] || entry.state[8] != buttons[2]) {
+                    continue;
+                }
+                entry.edge_seen = true;
+                edge_latencies.push_back(byte.time_us - entry.event_time_us);
+                next_edge = i + 1;
+                break;
+            }
+        }
+    }
+
+    uint32_t edges_published = 0;
+    uint32_t edges_seen = 0;
+    for (const PublishedState &entry : published) {
+        edges_published += entry.is_edge;
+        edges_seen += entry.edge_seen;
+    }
+    double duration_s = (end_us - play_start_us) / 1e6;
+    Percentiles latency = percentiles(latencies);
+    Percentiles edge_latency = percentiles(edge_latencies);
+    std::vector<uint64_t> wake_latencies = sim_fifo_wake_latencies(1);
+    Percentiles wake_latency = percentiles(wake_latencies);
+
+    sim_firmware_print_latency();
+
+    printf(
+        "{\"trace\":\"%s\",\"framing\":\"%s\",\"delta_frames\":%s,\"extended_frames\":%s,\"edge_frames\":%s,\"duration_s\":%.3f,"
+        "\"reports\":%u,\"states_published\":%zu,\"edges_published\":%u,"
+        "\"frames\":%u,\"uart_bytes\":%u,\"decode_errors\":%u,\"frame_rate_hz\":%.1f,\"line_utilization\":%.3f,"
+        "\"states_seen\":%zu,\"edges_seen\":%u,\"edges_missing\":%u,"
+        "\"latency_us\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu},"
+        "\"edge_latency_us\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu},"
+        "\"doorbell_wake_us\":{\"n\":%zu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu},",
+        trace_name.c_str(), config.cobs_framing ? "cobs" : "sbtp",
+        config.delta_frames ? "true" : "false", config.extended_frames ? "true" : "false",
+        config.edge_frames ? "true" : "false", duration_s,
+        reports, published.size(), edges_published,
+        frames, uart_bytes, decode_errors, frames / duration_s, uart_bytes * sim_uart_byte_time_us() / 1e6 / duration_s,
+        latencies.size(), edges_seen, edges_published - edges_seen,
+        (unsigned long long)latency.p50, (unsigned long long)latency.p90,
+        (unsigned long long)latency.p99, (unsigned long long)latency.max,
+        (unsigned long long)edge_latency.p50, (unsigned long long)edge_latency.p90,
+        (unsigned long long)edge_latency.p99, (unsigned long long)edge_latency.max,
+        wake_latencies.size(), (unsigned long long)wake_latency.p50, (unsigned long long)wake_latency.p90,
+        (unsigned long long)wake_latency.p99, (unsigned long long)wake_latency.max
+    );
+    if (config.extended_frames) {
+        printf(
+            "\"link\":{\"lost\":%u,\"average_latency_us\":%.1f,\"max_latency_us\":%u},",
+            link_monitor.lost, link_monitor.average_latency_us(), link_monitor.max_latency_us
+        );
+    }
+    printf(
+        "\"firmware\":{\"edge_high_water\":%u,\"edge_capacity\":%u,\"dropped_edge_events\":%u,"
+        "\"edge_received_to_sent_us\":{\"n\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u},"
+        "\"tx_committed\":%u,\"tx_sent\":%u,\"tx_dropped\":%u}}\n",
+        stats.edge_high_water, stats.edge_capacity, stats.dropped_edge_events,
+        stats.edge_latency_n, stats.edge_latency_p50_us, stats.edge_latency_p99_us, stats.edge_latency_max_us,
+        stats.tx.committed, stats.tx.sent, stats.tx.dropped
+    );
+
+    int exit_code = 0;
+    if (uart_log_path != nullptr) {
+        FILE *log = fopen(uart_log_path, "w");
+        if (log == nullptr) {
+            fprintf(stderr, "Error: cannot write %s\n", uart_log_path);
+            exit_code = 1;
+        }
+        else {
+            for (const SimUartByte &byte : bytes) {
+                fprintf(log, "%llu %02X\n", (unsigned long long)byte.time_us, byte.byte);
+            }
+            fclose(log);
+        }
+    }
+
+    // 他のスレッドは止まらないので、後片付けをせずに終わる
+    fflush(stdout);
+    fflush(stderr);
+    _Exit(exit_code);
+}
+
+
+int main(int argc, char **argv) {
+    const char *trace_path = SIM_DEFAULT_TRACE;
+    uint64_t settle_ms = SIM_DEFAULT_SETTLE_MS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--uart-log") == 0 && i + 1 < argc) {
+            uart_log_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--settle-ms") == 0 && i + 1 < argc) {
+            settle_ms = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (argv[i][0] != '-') {
+            trace_path = argv[i];
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--uart-log FILE] [--settle-ms MS] [TRACE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!sim_load_trace(trace_path, trace)) {
+        return 1;
+    }
+    trace_name = trace_path;
+    trace_name = trace_name.substr(trace_name.find_last_of('/') + 1);
+    trace_name = trace_name.substr(0, trace_name.find_last_of('.'));
+
+    sim_usb_play(&trace, settle_ms * 1000);
+    return firmware_main();
+}
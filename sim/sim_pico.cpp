@@ -0,0 +1,409 @@
+// Pico SDK の代わり (タイマー、GPIO、マルチコア、UART、DMA、割り込み)
+// core0 はシミュレータのメインスレッド、core1 は multicore_launch_core1() で作るスレッドで動く
+// UART の線はもう1つのスレッドで、ボーレートどおりの時刻に1バイトずつ送り出す
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "sim.h"
+
+
+// タイマー
+
+static const std::chrono::steady_clock::time_point boot_time = std::chrono::steady_clock::now();
+
+static std::chrono::steady_clock::time_point to_time_point(uint64_t time_us) {
+    return boot_time + std::chrono::microseconds(time_us);
+}
+
+uint64_t time_us_64() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot_time).count();
+}
+
+uint32_t time_us_32() {
+    return (uint32_t)time_us_64();
+}
+
+void sleep_ms(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void sleep_us(uint64_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void tight_loop_contents() {
+    std::this_thread::yield();
+}
+
+bool stdio_init_all() {
+    return true;
+}
+
+int getchar_timeout_us(uint32_t) {
+    return PICO_ERROR_TIMEOUT;
+}
+
+
+// GPIO
+
+static const unsigned NUM_GPIOS = 30;
+static std::atomic<bool> gpio_levels[NUM_GPIOS];
+
+void gpio_init(unsigned gpio) {
+    gpio_levels[gpio] = false;
+}
+
+void gpio_set_dir(unsigned, bool) {
+}
+
+void gpio_put(unsigned gpio, bool value) {
+    gpio_levels[gpio] = value;
+}
+
+bool gpio_get_out_level(unsigned gpio) {
+    return gpio_levels[gpio];
+}
+
+void gpio_set_function(unsigned, enum gpio_function) {
+}
+
+
+// マルチコア (FIFO はコアごとの受信キュー)
+// FIFO を待って眠っていたコアが起きるまでの時間 (積んだ時刻から) を集めておく
+
+struct SimFifoEntry {
+    uint32_t data;
+    uint64_t push_us;
+};
+
+static const size_t FIFO_DEPTH = 8;
+static std::mutex fifo_mutex;
+static std::condition_variable fifo_condition;
+static std::deque<SimFifoEntry> fifos[2];
+static std::vector<uint64_t> fifo_wake_latencies[2];
+static thread_local uint32_t core_num = 0;
+
+uint32_t get_core_num() {
+    return core_num;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    std::thread([entry] {
+        core_num = 1;
+        entry();
+    }).detach();
+}
+
+bool multicore_fifo_rvalid() {
+    std::lock_guard<std::mutex> lock(fifo_mutex);
+    return !fifos[core_num].empty();
+}
+
+bool multicore_fifo_wready() {
+    std::lock_guard<std::mutex> lock(fifo_mutex);
+    return fifos[core_num ^ 1].size() < FIFO_DEPTH;
+}
+
+void multicore_fifo_push_blocking(uint32_t data) {
+    std::unique_lock<std::mutex> lock(fifo_mutex);
+    std::deque<SimFifoEntry> &fifo = fifos[core_num ^ 1];
+    fifo_condition.wait(lock, [&] { return fifo.size() < FIFO_DEPTH; });
+    fifo.push_back({ data, time_us_64() });
+    fifo_condition.notify_all();
+}
+
+// 空の FIFO を待っていたなら、起きるまでの時間を記録する (fifo_mutex を持って呼ぶ)
+static uint32_t fifo_pop_locked(bool waited) {
+    std::deque<SimFifoEntry> &fifo = fifos[core_num];
+    SimFifoEntry entry = fifo.front();
+    fifo.pop_front();
+    if (waited) {
+        fifo_wake_latencies[core_num].push_back(time_us_64() - entry.push_us);
+    }
+    fifo_condition.notify_all();
+    return entry.data;
+}
+
+uint32_t multicore_fifo_pop_blocking() {
+    std::unique_lock<std::mutex> lock(fifo_mutex);
+    std::deque<SimFifoEntry> &fifo = fifos[core_num];
+    bool waited = fifo.empty();
+    fifo_condition.wait(lock, [&] { return !fifo.empty(); });
+    return fifo_pop_locked(waited);
+}
+
+bool multicore_fifo_pop_timeout_us(uint64_t timeout_us, uint32_t *out) {
+    std::unique_lock<std::mutex> lock(fifo_mutex);
+    std::deque<SimFifoEntry> &fifo = fifos[core_num];
+    bool waited = fifo.empty();
+    if (!fifo_condition.wait_for(lock, std::chrono::microseconds(timeout_us), [&] { return !fifo.empty(); })) {
+        return false;
+    }
+    *out = fifo_pop_locked(waited);
+    return true;
+}
+
+void multicore_fifo_drain() {
+    std::lock_guard<std::mutex> lock(fifo_mutex);
+    fifos[core_num].clear();
+    fifo_condition.notify_all();
+}
+
+std::vector<uint64_t> sim_fifo_wake_latencies(uint32_t core) {
+    std::lock_guard<std::mutex> lock(fifo_mutex);
+    return fifo_wake_latencies[core];
+}
+
+
+// 割り込み
+// 割り込みは UART の線のスレッドから呼ぶ。割り込み禁止の間はこのロックで待たせる
+
+static std::recursive_mutex irq_mutex;
+static std::vector<irq_handler_t> dma_irq1_handlers;
+static std::atomic<bool> dma_irq1_enabled(false);
+
+uint32_t save_and_disable_interrupts() {
+    irq_mutex.lock();
+    return 0;
+}
+
+void restore_interrupts(uint32_t) {
+    irq_mutex.unlock();
+}
+
+// WFE と SEV
+// 実機と同じく、__sev() で立てたフラグは __wfe() が1回だけ消費する (先に立っていればすぐに戻る)
+
+static std::mutex event_mutex;
+static std::condition_variable event_condition;
+static bool event_flags[2] = { false, false };
+
+void __wfe() {
+    std::unique_lock<std::mutex> lock(event_mutex);
+    event_condition.wait(lock, [] { return event_flags[core_num]; });
+    event_flags[core_num] = false;
+}
+
+void __sev() {
+    std::lock_guard<std::mutex> lock(event_mutex);
+    event_flags[0] = true;
+    event_flags[1] = true;
+    event_condition.notify_all();
+}
+
+void irq_add_shared_handler(unsigned num, irq_handler_t handler, uint8_t) {
+    if (num == DMA_IRQ_1) {
+        std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+        dma_irq1_handlers.push_back(handler);
+    }
+}
+
+void irq_set_enabled(unsigned num, bool enabled) {
+    if (num == DMA_IRQ_1) {
+        dma_irq1_enabled = enabled;
+    }
+}
+
+
+// UART と DMA
+// DMA は UART の TX FIFO (32 段) に空きがある分だけバイトを移し、移し終えたら IRQ1 を上げる
+// 線のスレッドは FIFO の先頭をシフトレジスタに取り、1 バイトの時間が過ぎたら記録する
+
+uart_inst_t sim_uart_instances[2] = { { { 0 }, 0 }, { { 0 }, 1 } };
+
+static const size_t UART_FIFO_DEPTH = 32;
+static const unsigned NUM_DMA_CHANNELS = 12;
+
+struct DmaChannel {
+    volatile void *write_addr = nullptr;
+    const uint8_t *read_addr = nullptr;
+    uint64_t start_us = 0;
+    uint32_t remaining = 0;
+    bool busy = false;
+    bool irq1_enabled = false;
+    bool irq1_status = false;
+};
+
+static std::mutex uart_mutex;
+static std::condition_variable uart_condition;
+static unsigned uart_baudrate = 115200;
+static unsigned uart_bits_per_byte = 10;
+struct UartFifoEntry {
+    uint8_t byte;
+    double ready_us; // FIFO に入った時刻
+};
+
+static std::deque<UartFifoEntry> uart_fifo;
+static double uart_fifo_space_us = 0; // 最後に FIFO に空きができた時刻
+static std::vector<SimUartByte> uart_log;
+static DmaChannel dma_channels[NUM_DMA_CHANNELS];
+static unsigned dma_claimed = 0;
+static bool uart_wire_started = false;
+
+
+// UART の DR に書くチャンネルから FIFO にバイトを移す。IRQ1 を上げたら true
+static bool feed_uart_fifo() {
+    bool raised = false;
+    for (DmaChannel &channel : dma_channels) {
+        if (!channel.busy) {
+            continue;
+        }
+        while (channel.remaining > 0 && uart_fifo.size() < UART_FIFO_DEPTH) {
+            uart_fifo.push_back({ *channel.read_addr, std::max((double)channel.start_us, uart_fifo_space_us) });
+            channel.read_addr++;
+            channel.remaining--;
+        }
+        if (channel.remaining == 0) {
+            channel.busy = false;
+            if (channel.irq1_enabled) {
+                channel.irq1_status = true;
+                raised = true;
+            }
+        }
+    }
+    return raised;
+}
+
+
+static void call_dma_irq1_handlers() {
+    std::lock_guard<std::recursive_mutex> lock(irq_mutex);
+    for (irq_handler_t handler : dma_irq1_handlers) {
+        handler();
+    }
+}
+
+
+static void uart_wire_main() {
+    std::unique_lock<std::mutex> lock(uart_mutex);
+    bool shifting = false;
+    uint8_t shift_byte = 0;
+    uint64_t shift_end_us = 0;
+    double line_free_us = 0; // 前のバイトを送り終える時刻
+
+    while (true) {
+        if (feed_uart_fifo() && dma_irq1_enabled) {
+            lock.unlock();
+            call_dma_irq1_handlers();
+            lock.lock();
+            continue;
+        }
+
+        if (shifting) {
+            // 送り終わる前に DMA が始まったら、すぐ FIFO に移すために起きる
+            uart_condition.wait_until(lock, to_time_point(shift_end_us));
+            if (time_us_64() >= shift_end_us) {
+                uart_log.push_back({ shift_end_us, shift_byte });
+                shifting = false;
+            }
+            continue;
+        }
+
+        // 時刻はスレッドが起きた時刻ではなく、FIFO に入った時刻と前のバイトを送り終えた時刻から決める
+        // (ホストのスレッドの起床の遅れで線の速さが変わらないようにする)
+        if (!uart_fifo.empty()) {
+            UartFifoEntry entry = uart_fifo.front();
+            uart_fifo.pop_front();
+            double start_us = std::max(entry.ready_us, line_free_us);
+            uart_fifo_space_us = start_us;
+            shift_byte = entry.byte;
+            line_free_us = start_us + 1e6 * uart_bits_per_byte / uart_baudrate;
+            shift_end_us = (uint64_t)line_free_us;
+            shifting = true;
+            continue;
+        }
+
+        uart_condition.wait(lock);
+    }
+}
+
+
+unsigned uart_init(uart_inst_t *, unsigned baudrate) {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    uart_baudrate = baudrate;
+    if (!uart_wire_started) {
+        uart_wire_started = true;
+        std::thread(uart_wire_main).detach();
+    }
+    return baudrate;
+}
+
+void uart_set_format(uart_inst_t *, unsigned data_bits, unsigned stop_bits, uart_parity_t parity) {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    uart_bits_per_byte = 1 + data_bits + (parity == UART_PARITY_NONE ? 0 : 1) + stop_bits;
+}
+
+void uart_set_hw_flow(uart_inst_t *, bool, bool) {
+}
+
+
+int dma_claim_unused_channel(bool) {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    if (dma_claimed == NUM_DMA_CHANNELS) {
+        return -1;
+    }
+    return dma_claimed++;
+}
+
+static void start_transfer(DmaChannel &channel, const volatile void *read_addr, uint32_t transfer_count) {
+    // UART の DR に書くもの以外は模擬しない
+    if (channel.write_addr != &uart1->hw.dr && channel.write_addr != &uart0->hw.dr) {
+        return;
+    }
+    channel.read_addr = (const uint8_t *)read_addr;
+    channel.remaining = transfer_count;
+    channel.start_us = time_us_64();
+    channel.busy = true;
+    uart_condition.notify_all();
+}
+
+void dma_channel_configure(unsigned channel, const dma_channel_config *, volatile void *write_addr,
+                           const volatile void *read_addr, unsigned transfer_count, bool trigger) {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    dma_channels[channel].write_addr = write_addr;
+    if (trigger) {
+        start_transfer(dma_channels[channel], read_addr, transfer_count);
+    }
+}
+
+void dma_channel_transfer_from_buffer_now(unsigned channel, const volatile void *read_addr, uint32_t transfer_count) {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    start_transfer(dma_channels[channel], read_addr, transfer_count);
+}
+
+void dma_channel_set_irq1_enabled(unsigned channel, bool enabled) {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    dma_channels[channel].irq1_enabled = enabled;
+}
+
+bool dma_channel_get_irq1_status(unsigned channel) {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    return dma_channels[channel].irq1_status;
+}
+
+void dma_channel_acknowledge_irq1(unsigned channel) {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    dma_channels[channel].irq1_status = false;
+}
+
+
+// シミュレータ本体に見せる部分
+
+std::vector<SimUartByte> sim_uart_bytes() {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    return uart_log;
+}
+
+double sim_uart_byte_time_us() {
+    std::lock_guard<std::mutex> lock(uart_mutex);
+    return 1e6 * uart_bits_per_byte / uart_baudrate;
+}
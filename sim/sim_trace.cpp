@@ -0,0 +1,83 @@
+// USB レポートのトレースを読む (シミュレータと、トレースを使うベンチマークで共用)
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include "sim.h"
+
+
+static bool parse_hex(std::istringstream &line, std::vector<uint8_t> &out) {
+    std::string token;
+    while (line >> token) {
+        char *end;
+        unsigned long value = strtoul(token.c_str(), &end, 16);
+        if (*end != '\0' || value > 0xFF) {
+            return false;
+        }
+        out.push_back((uint8_t)value);
+    }
+    return true;
+}
+
+
+// トレースの書式 (1行に1項目、時刻は再生を始めてからの µs で昇順)
+//   # コメント
+//   vid_pid 054C 0268
+//   descriptor 05 01 09 05 ...   (複数行ならつなげる)
+//   mount <時刻>
+//   report <時刻> 00 01 02 ...
+//   umount <時刻>
+bool sim_load_trace(const char *path, SimTrace &trace) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return false;
+    }
+
+    std::string text;
+    int line_number = 0;
+    while (std::getline(file, text)) {
+        line_number++;
+        std::istringstream line(text);
+        std::string key;
+        if (!(line >> key) || key[0] == '#') {
+            continue;
+        }
+
+        bool ok = true;
+        if (key == "vid_pid") {
+            unsigned vid, pid;
+            ok = (bool)(line >> std::hex >> vid >> pid) && vid <= 0xFFFF && pid <= 0xFFFF;
+            trace.vid = vid;
+            trace.pid = pid;
+        }
+        else if (key == "descriptor") {
+            ok = parse_hex(line, trace.descriptor);
+        }
+        else if (key == "mount" || key == "report" || key == "umount") {
+            SimTraceEvent event;
+            event.kind = key == "mount" ? SimTraceEvent::MOUNT : key == "report" ? SimTraceEvent::REPORT : SimTraceEvent::UMOUNT;
+            ok = (bool)(line >> event.time_us);
+            if (ok && event.kind == SimTraceEvent::REPORT) {
+                ok = parse_hex(line, event.report) && !event.report.empty();
+            }
+            if (ok && !trace.events.empty() && event.time_us < trace.events.back().time_us) {
+                ok = false;
+            }
+            trace.events.push_back(event);
+        }
+        else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: %s:%d: invalid line\n", path, line_number);
+            return false;
+        }
+    }
+
+    if (trace.events.empty()) {
+        fprintf(stderr, "Error: %s: no events\n", path);
+        return false;
+    }
+    return true;
+}
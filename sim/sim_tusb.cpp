@@ -0,0 +1,150 @@
+// TinyUSB (HID ホスト) とボードの代わり
+// tuh_task() がトレースのイベントを時刻どおりに取り出してファームウェアのコールバックを呼ぶ
+// レポートは実機と同じく、ファームウェアが tuh_hid_receive_report() で要求するまで渡さない
+// (要求が遅れたら、その分だけトレースの時刻より遅れて届く)
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "bsp/board_api.h"
+#include "sim.h"
+
+
+const uint8_t SIM_DEV_ADDR = 1;
+const uint8_t SIM_HID_IDX = 0;
+const uint64_t SIM_IDLE_SLEEP_US = 1000; // 次のイベントまでの間、tuh_task() が一度に眠る最大時間
+
+static const SimTrace *trace = nullptr;
+static uint64_t settle_us = 0;
+static bool playing = false;
+static uint64_t play_start_us = 0;
+static size_t next_event = 0;
+static bool mounted = false;
+static bool report_requested = false;
+static bool set_report_pending = false;
+static uint8_t set_report_id = 0;
+static uint8_t set_report_type = 0;
+static uint16_t set_report_len = 0;
+
+
+void sim_usb_play(const SimTrace *trace_, uint64_t settle_us_) {
+    trace = trace_;
+    settle_us = settle_us_;
+}
+
+
+// TinyUSB
+
+bool tuh_init(uint8_t) {
+    play_start_us = time_us_64();
+    playing = trace != nullptr;
+    return true;
+}
+
+
+void tuh_task() {
+    if (!playing) {
+        sleep_us(SIM_IDLE_SLEEP_US);
+        return;
+    }
+
+    uint64_t now_us = time_us_64();
+    if (now_us >= play_start_us + trace->events.back().time_us + settle_us) {
+        sim_on_trace_end(play_start_us);
+    }
+
+    if (set_report_pending) {
+        set_report_pending = false;
+        tuh_hid_set_report_complete_cb(SIM_DEV_ADDR, SIM_HID_IDX, set_report_id, set_report_type, set_report_len);
+        return;
+    }
+
+    if (next_event == trace->events.size()) {
+        sleep_us(SIM_IDLE_SLEEP_US);
+        return;
+    }
+
+    const SimTraceEvent &event = trace->events[next_event];
+    uint64_t event_time_us = play_start_us + event.time_us;
+    if (event_time_us > now_us) {
+        sleep_us(std::min(event_time_us - now_us, SIM_IDLE_SLEEP_US));
+        return;
+    }
+    // 要求されるまでレポートは渡さない (ファームウェアはこの後 read_gamepad_task() で要求する)
+    if (event.kind == SimTraceEvent::REPORT && mounted && !report_requested) {
+        return;
+    }
+
+    // 1回の tuh_task() で1つずつ渡す (次のレポートを要求する機会を作る)
+    next_event++;
+    switch (event.kind) {
+    case SimTraceEvent::MOUNT:
+        mounted = true;
+        tuh_hid_mount_cb(SIM_DEV_ADDR, SIM_HID_IDX, trace->descriptor.data(), trace->descriptor.size());
+        break;
+    case SimTraceEvent::REPORT:
+        if (!mounted) {
+            return;
+        }
+        report_requested = false;
+        tuh_hid_report_received_cb(SIM_DEV_ADDR, SIM_HID_IDX, event.report.data(), event.report.size());
+        break;
+    case SimTraceEvent::UMOUNT:
+        mounted = false;
+        report_requested = false;
+        tuh_hid_umount_cb(SIM_DEV_ADDR, SIM_HID_IDX);
+        break;
+    }
+    sim_on_usb_event(event, event_time_us);
+}
+
+
+bool tuh_vid_pid_get(uint8_t dev_addr, uint16_t *vid, uint16_t *pid) {
+    if (!mounted || dev_addr != SIM_DEV_ADDR) {
+        return false;
+    }
+    *vid = trace->vid;
+    *pid = trace->pid;
+    return true;
+}
+
+
+bool tuh_hid_receive_ready(uint8_t dev_addr, uint8_t idx) {
+    return mounted && dev_addr == SIM_DEV_ADDR && idx == SIM_HID_IDX && !report_requested;
+}
+
+
+bool tuh_hid_receive_report(uint8_t dev_addr, uint8_t idx) {
+    if (!tuh_hid_receive_ready(dev_addr, idx)) {
+        return false;
+    }
+    report_requested = true;
+    return true;
+}
+
+
+bool tuh_hid_set_report(uint8_t dev_addr, uint8_t idx, uint8_t report_id, uint8_t report_type, void *, uint16_t len) {
+    if (!mounted || dev_addr != SIM_DEV_ADDR || idx != SIM_HID_IDX || set_report_pending) {
+        return false;
+    }
+    // 次の tuh_task() で完了を知らせる
+    set_report_pending = true;
+    set_report_id = report_id;
+    set_report_type = report_type;
+    set_report_len = len;
+    return true;
+}
+
+
+// ボード
+
+void board_init() {
+}
+
+
+uint32_t board_millis() {
+    return (uint32_t)(time_us_64() / 1000);
+}
@@ -0,0 +1,20 @@
+// ベースラインのパーサの型 (bench/corpus.h の CorpusTargets<BaselineHid> で使う)
+#pragma once
+
+#include "hid_report_parser_baseline.h"
+
+
+struct BaselineHid {
+    template <size_t BIT_SIZE> using BitField = hid_baseline::BitField<BIT_SIZE>;
+    template <size_t SIZE> using Int32Array = hid_baseline::Int32Array<SIZE>;
+    using Collection = hid_baseline::Collection;
+    using Int32Fields = hid_baseline::Int32Fields;
+    using BoolFields = hid_baseline::BoolFields;
+    using BoolVector = hid_baseline::BoolVector;
+    using GamepadConfig = hid_baseline::GamepadConfig;
+    using BigGamepadConfig = hid_baseline::BigGamepadConfig;
+    using MouseConfig = hid_baseline::MouseConfig;
+    using KeyboardConfig = hid_baseline::KeyboardConfig;
+    using MultimediaKeyboardConfig = hid_baseline::MultimediaKeyboardConfig;
+    using Parser = hid_baseline::SelectiveInputReportParser;
+};
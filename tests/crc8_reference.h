@@ -0,0 +1,29 @@
+// main.cpp にあった1ビットずつの CRC-8 (表にする前の実装)。crc8.h の確かめと比較に使う
+// crc8.h の表は crc8_shift_bits() から作られるので、それとは別に元のコードをそのまま残しておく
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+static inline uint8_t reference_crc8_update(uint8_t crc, uint8_t byte) {
+    crc ^= byte;
+    for (int j = 0; j < 8; j++) {
+        if (crc & 0x80) {
+            crc = (crc << 1) ^ 0xD5;
+        }
+        else {
+            crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+
+static inline uint8_t reference_crc8(const uint8_t *data, size_t len) {
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < len; i++) {
+        crc = reference_crc8_update(crc, data[i]);
+    }
+    return crc ^ 0xFF;
+}
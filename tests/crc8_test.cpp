@@ -0,0 +1,64 @@
+// crc8.h の CRC-8 が元の1ビットずつの実装 (crc8_reference.h) とビット単位で一致することを
+// 総当たりで確かめる。CRC8_USE_NIBBLE_TABLE=0 (256 バイトの表) と 1 (16 バイトの表) の
+// 両方でビルドして実行する
+//   - すべての CRC の途中の値 × すべての入力バイト (256 × 256) で crc8_update() が一致する
+//   - すべての 2 バイトの入力 (65536 通り) で crc8() が一致する
+//   - 長いデータをまとめて渡しても 1 バイトずつ渡しても同じになる
+#include <stdio.h>
+#include <stdint.h>
+#include <random>
+#include <vector>
+#include "crc8.h"
+#include "crc8_reference.h"
+#include "test.h"
+
+
+static void test_all_states_and_bytes() {
+    int mismatches = 0;
+    for (int crc = 0; crc < 256; crc++) {
+        for (int byte = 0; byte < 256; byte++) {
+            if (crc8_update((uint8_t)crc, (uint8_t)byte) != reference_crc8_update((uint8_t)crc, (uint8_t)byte)) {
+                mismatches++;
+            }
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+}
+
+
+static void test_all_two_byte_inputs() {
+    int mismatches = 0;
+    for (int i = 0; i < 65536; i++) {
+        uint8_t data[2] = { (uint8_t)(i >> 8), (uint8_t)i };
+        if (crc8(data, 2) != reference_crc8(data, 2)) {
+            mismatches++;
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+}
+
+
+static void test_long_data() {
+    std::mt19937 rng(1);
+    for (int i = 0; i < 1000; i++) {
+        std::vector<uint8_t> data(rng() % 1024);
+        for (uint8_t &byte : data) {
+            byte = (uint8_t)rng();
+        }
+        uint8_t crc = CRC8_INITIAL_VALUE;
+        for (uint8_t byte : data) {
+            crc = crc8_update(crc, byte);
+        }
+        CHECK_EQ(crc8_final(crc), reference_crc8(data.data(), data.size()));
+        CHECK_EQ(crc8(data.data(), data.size()), reference_crc8(data.data(), data.size()));
+    }
+}
+
+
+int main() {
+    test_all_states_and_bytes();
+    test_all_two_byte_inputs();
+    test_long_data();
+    printf("CRC8_USE_NIBBLE_TABLE=%d\n", CRC8_USE_NIBBLE_TABLE);
+    return test_result("crc8_test");
+}
@@ -0,0 +1,254 @@
+// SBTP と COBS のフレームのテスト
+//   - CRC-8 が元の1ビットずつの実装と同じ値になる
+//   - エンコードしたフレームをデコーダに1バイトずつ与えると元のデータに戻る
+//     (エスケープや 0x00 が多いデータ、連続したフレーム、前後のゴミを含む)
+//   - データを1バイト壊したフレームは捨てられる
+//   - エッジフレームで送ったボタンと十字キーの変化が、途中の状態も含めて順番どおりに戻る
+//     (キーフレームと差分フレームの間に挟んでも、拡張フレームのヘッダを付けても同じ)
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <random>
+#include <set>
+#include <vector>
+#include "crc8.h"
+#include "sbtp.h"
+#include "cobs.h"
+#include "gamepad_frame.h"
+#include "crc8_reference.h"
+#include "test.h"
+
+
+const int RANDOM_FRAMES = 20000;
+
+
+// エスケープが必要なバイトと 0x00 が多く出るようにしたランダムなデータ
+static std::vector<uint8_t> random_data(std::mt19937 &rng, size_t len) {
+    static const uint8_t SPECIAL[] = { SBTP_HEADER_BYTE, SBTP_FOOTER_BYTE, SBTP_ESCAPE_BYTE, 0x00, 0xFF };
+    std::vector<uint8_t> data(len);
+    for (uint8_t &byte : data) {
+        byte = rng() % 3 == 0 ? SPECIAL[rng() % sizeof(SPECIAL)] : (uint8_t)rng();
+    }
+    return data;
+}
+
+
+static void test_crc8(std::mt19937 &rng) {
+    const uint8_t CHECK_INPUT[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    CHECK_EQ(crc8(CHECK_INPUT, sizeof(CHECK_INPUT)), reference_crc8(CHECK_INPUT, sizeof(CHECK_INPUT)));
+    CHECK_EQ(crc8(nullptr, 0), reference_crc8(nullptr, 0));
+
+    for (int i = 0; i < RANDOM_FRAMES; i++) {
+        std::vector<uint8_t> data = random_data(rng, rng() % 65);
+        CHECK_EQ(crc8(data.data(), data.size()), reference_crc8(data.data(), data.size()));
+    }
+}
+
+
+// frame をデコーダに与え、最後のバイトでちょうど1フレームが出てくるか確かめる
+template <class DECODER, class RESULT>
+static bool decode_frame(DECODER &decoder, const uint8_t *frame, size_t frame_len, RESULT frame_result) {
+    for (size_t i = 0; i < frame_len; i++) {
+        RESULT result = decoder.put(frame[i]);
+        if (result == frame_result) {
+            return i + 1 == frame_len;
+        }
+    }
+    return false;
+}
+
+
+static void test_sbtp(std::mt19937 &rng) {
+    SbtpDecoder decoder;
+    for (int i = 0; i < RANDOM_FRAMES; i++) {
+        std::vector<uint8_t> data = random_data(rng, rng() % (SBTP_MAX_DATA_SIZE + 1));
+        uint8_t frame[sbtp_max_frame_size(SBTP_MAX_DATA_SIZE)];
+        size_t frame_len = sbtp_encode(frame, data.data(), data.size());
+
+        CHECK(frame_len <= sbtp_max_frame_size(data.size()));
+        CHECK_EQ(frame[0], SBTP_HEADER_BYTE);
+        CHECK_EQ(frame[1], data.size());
+        CHECK_EQ(frame[frame_len - 1], SBTP_FOOTER_BYTE);
+        // CRC はエスケープ後のデータから計算する
+        CHECK_EQ(frame[frame_len - 2], reference_crc8(frame + 2, frame_len - 4));
+        for (size_t j = 2; j + 2 < frame_len; j++) {
+            CHECK(frame[j] != SBTP_HEADER_BYTE && frame[j] != SBTP_FOOTER_BYTE);
+        }
+
+        // 前のフレームとの間にゴミが入っていることがある
+        if (rng() % 4 == 0) {
+            decoder.put(SBTP_FOOTER_BYTE);
+            decoder.put((uint8_t)rng());
+        }
+        bool ok = decode_frame(decoder, frame, frame_len, SBTP_DECODE_FRAME);
+        CHECK(ok);
+        if (ok) {
+            CHECK_EQ(decoder.data_len, data.size());
+            CHECK(memcmp(decoder.data, data.data(), data.size()) == 0);
+        }
+
+        // エスケープに関係しないデータのバイトを1ビット反転すると CRC で捨てられる
+        size_t index = 2 + rng() % (frame_len - 3);
+        uint8_t flipped = frame[index] ^ (uint8_t)(1 << (rng() % 8));
+        bool plain = index < frame_len - 2;
+        for (uint8_t byte : { frame[index], flipped, frame[index - 1] }) {
+            plain = plain && byte != SBTP_HEADER_BYTE && byte != SBTP_FOOTER_BYTE && byte != SBTP_ESCAPE_BYTE;
+        }
+        if (plain) {
+            frame[index] = flipped;
+            SbtpDecoder fresh;
+            CHECK(!decode_frame(fresh, frame, frame_len, SBTP_DECODE_FRAME));
+        }
+    }
+}
+
+
+static void test_cobs(std::mt19937 &rng) {
+    CobsDecoder decoder;
+    for (int i = 0; i < RANDOM_FRAMES; i++) {
+        std::vector<uint8_t> data = random_data(rng, rng() % (COBS_MAX_DATA_SIZE + 1));
+        uint8_t frame[cobs_max_frame_size(COBS_MAX_DATA_SIZE)];
+        size_t frame_len = cobs_encode(frame, data.data(), data.size());
+
+        CHECK(frame_len <= cobs_max_frame_size(data.size()));
+        CHECK_EQ(frame[frame_len - 1], COBS_DELIMITER_BYTE);
+        for (size_t j = 0; j + 1 < frame_len; j++) {
+            CHECK(frame[j] != COBS_DELIMITER_BYTE);
+        }
+
+        // 受信の途中から始まった場合は、最初の区切りまでがエラーになる
+        if (rng() % 4 == 0) {
+            decoder.put((uint8_t)(rng() | 1));
+            CHECK(decoder.put(COBS_DELIMITER_BYTE) == COBS_DECODE_ERROR);
+        }
+        bool ok = decode_frame(decoder, frame, frame_len, COBS_DECODE_FRAME);
+        CHECK(ok);
+        if (ok) {
+            CHECK_EQ(decoder.data_len, data.size());
+            CHECK(memcmp(decoder.data, data.data(), data.size()) == 0);
+        }
+
+        // コードバイト以外を1ビット反転すると CRC で捨てられる (0x00 にする反転は除く)
+        std::set<size_t> code_bytes;
+        for (size_t j = 0; j + 1 < frame_len; j += frame[j]) {
+            code_bytes.insert(j);
+        }
+        size_t index = rng() % (frame_len - 1);
+        uint8_t flipped = frame[index] ^ (uint8_t)(1 << (rng() % 8));
+        if (code_bytes.count(index) == 0 && flipped != COBS_DELIMITER_BYTE) {
+            frame[index] = flipped;
+            CobsDecoder fresh;
+            CHECK(!decode_frame(fresh, frame, frame_len, COBS_DECODE_FRAME));
+        }
+    }
+}
+
+
+// ボタン (14bit) と十字キー (0〜8) を変えた状態
+static void random_edge_state(std::mt19937 &rng, const uint8_t *previous, uint8_t *state) {
+    memcpy(state, previous, GAMEPAD_STATE_SIZE);
+    do {
+        uint16_t buttons = rng() & 0x3FFF;
+        state[4] = buttons >> 8;
+        state[5] = buttons & 0xFF;
+        state[8] = rng() % 9;
+    } while (state[4] == previous[4] && state[5] == previous[5] && state[8] == previous[8]);
+    for (uint8_t offset : GAMEPAD_EDGE_AXES_OFFSETS) {
+        state[offset] = (uint8_t)rng();
+    }
+}
+
+
+static void test_gamepad_edges(std::mt19937 &rng, bool extended) {
+    GamepadFrameEncoder encoder(8);
+    GamepadFrameDecoder decoder(extended);
+    SbtpDecoder sbtp;
+    GamepadFrameHeader header = { 0, 0 };
+    const GamepadFrameHeader *header_ptr = extended ? &header : nullptr;
+    uint8_t frame[sbtp_max_frame_size(GAMEPAD_MAX_FRAME_DATA_SIZE)];
+    uint8_t state[GAMEPAD_STATE_SIZE] = {};
+    CHECK(GAMEPAD_MAX_FRAME_DATA_SIZE <= SBTP_MAX_DATA_SIZE);
+    CHECK(GAMEPAD_MAX_FRAME_DATA_SIZE <= COBS_MAX_DATA_SIZE);
+
+    // キーフレームの前のエッジフレームは使えない
+    GamepadEdge edge = { 0, {} };
+    random_edge_state(rng, state, edge.state);
+    size_t frame_len = encoder.encode_edges<SbtpEncoder>(frame, &edge, 1, header_ptr);
+    header.sequence++;
+    CHECK(decode_frame(sbtp, frame, frame_len, SBTP_DECODE_FRAME));
+    CHECK(!decoder.apply(sbtp.data, sbtp.data_len));
+    memcpy(state, edge.state, GAMEPAD_STATE_SIZE);
+    frame_len = encoder.encode<SbtpEncoder>(frame, state, true, header_ptr);
+    header.sequence++;
+    CHECK(decode_frame(sbtp, frame, frame_len, SBTP_DECODE_FRAME) && decoder.apply(sbtp.data, sbtp.data_len));
+
+    for (int i = 0; i < RANDOM_FRAMES; i++) {
+        if (rng() % 3 == 0) {
+            // スティックだけ変えた状態のフレーム (キーフレームか差分フレーム)
+            state[rng() % 4] = (uint8_t)rng();
+            frame_len = encoder.encode<SbtpEncoder>(frame, state, false, header_ptr);
+            header.sequence++;
+            bool ok = decode_frame(sbtp, frame, frame_len, SBTP_DECODE_FRAME) && decoder.apply(sbtp.data, sbtp.data_len);
+            CHECK(ok);
+            CHECK_EQ(decoder.edge_count, 0);
+            CHECK(memcmp(decoder.state, state, GAMEPAD_STATE_SIZE) == 0);
+            continue;
+        }
+
+        GamepadEdge edges[GAMEPAD_EDGE_FRAME_MAX_ENTRIES];
+        uint8_t count = 1 + rng() % GAMEPAD_EDGE_FRAME_MAX_ENTRIES;
+        const uint8_t *previous = state;
+        for (uint8_t j = 0; j < count; j++) {
+            edges[j].age_us = (uint16_t)rng();
+            random_edge_state(rng, previous, edges[j].state);
+            previous = edges[j].state;
+        }
+        frame_len = encoder.encode_edges<SbtpEncoder>(frame, edges, count, header_ptr);
+        header.sequence++;
+        bool ok = decode_frame(sbtp, frame, frame_len, SBTP_DECODE_FRAME);
+        CHECK(ok);
+        CHECK(sbtp.data_len > (extended ? GAMEPAD_FRAME_HEADER_SIZE : 0) + GAMEPAD_STATE_SIZE);
+        ok = ok && decoder.apply(sbtp.data, sbtp.data_len);
+        CHECK(ok);
+        if (!ok) {
+            continue;
+        }
+
+        // 途中の状態のボタンと十字キーは送った順、スティックとトリガーは最後の変化のもの
+        CHECK_EQ(decoder.edge_count, count);
+        const uint8_t *last_state = edges[count - 1].state;
+        for (uint8_t j = 0; j < count && j < decoder.edge_count; j++) {
+            uint8_t expected[GAMEPAD_STATE_SIZE];
+            memcpy(expected, last_state, GAMEPAD_STATE_SIZE);
+            expected[4] = edges[j].state[4];
+            expected[5] = edges[j].state[5];
+            expected[8] = edges[j].state[8];
+            CHECK_EQ(decoder.edges[j].age_us, edges[j].age_us);
+            CHECK(memcmp(decoder.edges[j].state, expected, GAMEPAD_STATE_SIZE) == 0);
+        }
+        CHECK(memcmp(decoder.state, last_state, GAMEPAD_STATE_SIZE) == 0);
+        memcpy(state, last_state, GAMEPAD_STATE_SIZE);
+    }
+
+    // 変化の途中で切れた長さのエッジフレームは捨て、次のキーフレームまで同期を外す
+    const uint8_t header_len = extended ? GAMEPAD_FRAME_HEADER_SIZE : 0;
+    uint8_t broken[GAMEPAD_MAX_FRAME_DATA_SIZE] = {};
+    for (uint8_t j = 0; j < header_len; j++) {
+        broken[j] = sbtp.data[j];
+    }
+    broken[0] = header.sequence & 0xFF;
+    broken[1] = header.sequence >> 8;
+    CHECK(!decoder.apply(broken, header_len + GAMEPAD_EDGE_AXES_SIZE + GAMEPAD_EDGE_ENTRY_SIZE + 1));
+    CHECK(!decoder.synced);
+}
+
+
+int main() {
+    std::mt19937 rng(1);
+    test_crc8(rng);
+    test_sbtp(rng);
+    test_cobs(rng);
+    test_gamepad_edges(rng, false);
+    test_gamepad_edges(rng, true);
+    return test_result("frame_codec_test");
+}
@@ -0,0 +1,311 @@
+// レポートパーサの出力がベースライン (tests/baseline、抽出プログラムにする前のパーサ) と
+// 同じになることを確かめる
+//
+// bench/corpus のディスクリプタそれぞれを、コーパスにあるすべての設定でマッピングし、
+// コーパスのレポートとそれを壊したレポート (バイトの書き換え、長さの増減、別のレポート ID)
+// を両方のパーサに与えて、戻り値と出力先の変数を比べる。今のパーサは
+//   Parse (ヒープ)、Parse (アリーナ)、ParseChanges、ParseLazy + すべての変数の Decode (Init は lazy=true)
+// の4通りで動かす。HRP_WORD_AT_A_TIME_BIT_COPY=0 でビルドしたパーサでも同じテストを実行する
+//
+// ParseChanges では出力先ごとに changed のビットフィールドを付け、レポートごとに
+//   変化のビット = 前のレポートの後の値と違う変数 (相対値の変数は 0 でない変数)
+//   戻り値 = ベースラインが ERR_SUCCESS なら、変化のビットが1つでもあれば ERR_SUCCESS、
+//            なければ ERR_NOTHING_CHANGED。それ以外はベースラインと同じ
+// になることも確かめる。相対値の int32 の変数をマッピングするのは mouse の設定 (軸) だけ
+//
+// アリーナがあふれて Init がヒープに逃げたときの GetMemoryUsage().peak が、必要なアリーナの
+// 大きさそのもの (その大きさなら成功し、1段小さいと ERR_ARENA_TOO_SMALL) になることも確かめる
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "hid_report_parser.h"
+#include "corpus.h"
+#include "baseline_hid.h"
+#include "test.h"
+
+
+const int MUTATED_REPORTS_PER_REPORT = 400;
+const size_t PARSER_ARENA_SIZE = 16 * 1024; // main.cpp と同じ
+
+static int compared_reports = 0;
+static int accepted_reports = 0;
+
+static const char *const CONFIGS[] = { "gamepad", "biggamepad", "mouse", "keyboard", "mmkeyboard" };
+
+enum class Mode {
+    PARSE_HEAP,
+    PARSE_ARENA,
+    PARSE_CHANGES,
+    PARSE_LAZY,
+};
+
+static const char *mode_name(Mode mode) {
+    switch (mode) {
+        case Mode::PARSE_HEAP: return "Parse";
+        case Mode::PARSE_ARENA: return "Parse(arena)";
+        case Mode::PARSE_CHANGES: return "ParseChanges";
+        case Mode::PARSE_LAZY: return "ParseLazy+Decode";
+    }
+    return "?";
+}
+
+
+// ParseChanges で使う、CorpusTargets の出力先ごとの changed のビットフィールド
+struct ChangedTargets {
+    hid::BitField<256> bools {};
+    hid::BitField<256> bools2 {};
+    hid::BitField<32> ints {};
+    decltype(bools.Ref()) bools_ref = bools.Ref();
+    decltype(bools2.Ref()) bools2_ref = bools2.Ref();
+    decltype(ints.Ref()) ints_ref = ints.Ref();
+
+    // 設定のすべての Int32Fields と BoolFields に、出力先に対応する changed を付ける
+    void attach(hid::Collection *collection, CorpusTargets<> &targets) {
+        for (hid::Int32Fields *fields : collection->int32s) {
+            fields->changed = fields->target == &targets.ints_ref ? &ints_ref : nullptr;
+        }
+        for (hid::BoolFields *fields : collection->bools) {
+            fields->changed = fields->target == &targets.bools_ref ? &bools_ref
+                : fields->target == &targets.bools2_ref ? &bools2_ref : nullptr;
+        }
+        for (hid::Collection *child : collection->collections) {
+            attach(child, targets);
+        }
+    }
+
+    void clear() {
+        memset(bools.bytes, 0, sizeof(bools.bytes));
+        memset(bools2.bytes, 0, sizeof(bools2.bytes));
+        memset(ints.bytes, 0, sizeof(ints.bytes));
+    }
+};
+
+
+// 前のレポートの後の値 prev と今の値から、changed に立つはずのビットを作る
+// 戻り値は立つはずのビットが1つでもあるか
+static bool expected_changes(const CorpusTargets<> &prev, const CorpusTargets<> &current, bool relative_ints, ChangedTargets &expected) {
+    expected.clear();
+    bool any = false;
+    for (size_t i = 0; i < decltype(current.ints)::SIZE; i++) {
+        int32_t v = current.ints.items[i];
+        if (relative_ints ? v != 0 : v != prev.ints.items[i]) {
+            expected.ints.bytes[i >> 3] |= (uint8_t)(1 << (i & 7));
+            any = true;
+        }
+    }
+    for (size_t i = 0; i < sizeof(current.bools.bytes); i++) {
+        expected.bools.bytes[i] = prev.bools.bytes[i] ^ current.bools.bytes[i];
+        expected.bools2.bytes[i] = prev.bools2.bytes[i] ^ current.bools2.bytes[i];
+        any = any || expected.bools.bytes[i] != 0 || expected.bools2.bytes[i] != 0;
+    }
+    return any;
+}
+
+
+static bool same_changes(const ChangedTargets &a, const ChangedTargets &b) {
+    return memcmp(a.bools.bytes, b.bools.bytes, sizeof(a.bools.bytes)) == 0
+        && memcmp(a.bools2.bytes, b.bools2.bytes, sizeof(a.bools2.bytes)) == 0
+        && memcmp(a.ints.bytes, b.ints.bytes, sizeof(a.ints.bytes)) == 0;
+}
+
+
+template <class A, class B>
+static bool same_values(const CorpusTargets<A> &a, const CorpusTargets<B> &b) {
+    return memcmp(a.bools.bytes, b.bools.bytes, sizeof(a.bools.bytes)) == 0
+        && memcmp(a.bools2.bytes, b.bools2.bytes, sizeof(a.bools2.bytes)) == 0
+        && memcmp(a.ints.items, b.ints.items, sizeof(a.ints.items)) == 0;
+}
+
+
+// 今のパーサを mode の方法で動かす
+static int parse_current(Mode mode, hid::SelectiveInputReportParser &parser, CorpusTargets<> &targets,
+                         const std::vector<uint8_t> &report) {
+    if (mode == Mode::PARSE_CHANGES) {
+        return parser.ParseChanges(report.data(), report.size());
+    }
+    if (mode != Mode::PARSE_LAZY) {
+        return parser.Parse(report.data(), report.size());
+    }
+
+    int result = parser.ParseLazy(report.data(), report.size());
+    if (result != hid::ERR_SUCCESS) {
+        return result;
+    }
+    for (size_t i = 0; i < decltype(targets.ints)::SIZE; i++) {
+        parser.Decode(&targets.ints_ref, i);
+    }
+    for (size_t i = 0; i < decltype(targets.bools)::BIT_SIZE; i++) {
+        parser.Decode(&targets.bools_ref, i);
+    }
+    for (size_t i = 0; i < decltype(targets.bools2)::BIT_SIZE; i++) {
+        parser.Decode(&targets.bools2_ref, i);
+    }
+    return hid::ERR_SUCCESS;
+}
+
+
+// あふれたときの peak が、足りたときの peak と同じで、その大きさのアリーナでちょうど足りるか
+static void check_arena_peak(const CorpusEntry &entry, const char *config) {
+    alignas(max_align_t) static uint8_t buffer[PARSER_ARENA_SIZE];
+    const size_t alignment = alignof(max_align_t);
+    const uint8_t *desc = entry.descriptor.data();
+    size_t desc_len = entry.descriptor.size();
+    CorpusTargets<> targets;
+    hid::Collection *root = targets.root(config);
+    hid::SelectiveInputReportParser::PrepareConfig(root);
+    hid::SelectiveInputReportParser parser;
+
+    hid::Arena large(buffer, sizeof(buffer));
+    if (parser.Init(root, desc, desc_len, &large) != hid::ERR_SUCCESS) {
+        return;
+    }
+    size_t peak = parser.GetMemoryUsage().peak;
+
+    hid::Arena tiny(buffer, alignment);
+    CHECK_EQ(parser.Init(root, desc, desc_len, &tiny), hid::ERR_ARENA_TOO_SMALL);
+    size_t overflow_peak = parser.GetMemoryUsage().peak;
+    if (overflow_peak != peak) {
+        fprintf(stderr, "%s/%s: peak after an arena overflow %zu != %zu\n", entry.name.c_str(), config, overflow_peak, peak);
+        test_failures++;
+    }
+
+    hid::Arena exact(buffer, peak);
+    CHECK_EQ(parser.Init(root, desc, desc_len, &exact), hid::ERR_SUCCESS);
+    hid::Arena smaller(buffer, peak - alignment);
+    CHECK_EQ(parser.Init(root, desc, desc_len, &smaller), hid::ERR_ARENA_TOO_SMALL);
+}
+
+
+static std::vector<std::vector<uint8_t>> make_reports(const CorpusEntry &entry, std::mt19937 &rng) {
+    std::vector<std::vector<uint8_t>> reports = entry.reports;
+    for (const std::vector<uint8_t> &original : entry.reports) {
+        for (int i = 0; i < MUTATED_REPORTS_PER_REPORT; i++) {
+            std::vector<uint8_t> report = original;
+            switch (rng() % 4) {
+                case 0: // ランダムなバイトを1つ書き換える (レポート ID も書き換わることがある)
+                    report[rng() % report.size()] = (uint8_t)rng();
+                    break;
+                case 1: // 先頭以外をすべてランダムにする
+                    for (size_t j = 1; j < report.size(); j++) {
+                        report[j] = (uint8_t)rng();
+                    }
+                    break;
+                case 2: // 短くする
+                    report.resize(rng() % report.size());
+                    break;
+                case 3: // 長くする
+                    report.resize(report.size() + 1 + rng() % 4, (uint8_t)rng());
+                    break;
+            }
+            reports.push_back(report);
+        }
+    }
+    return reports;
+}
+
+
+static void run(const CorpusEntry &entry, const char *config, Mode mode, const std::vector<std::vector<uint8_t>> &reports) {
+    CorpusTargets<BaselineHid> base_targets;
+    CorpusTargets<> targets;
+    BaselineHid::Parser base_parser;
+    hid::SelectiveInputReportParser parser;
+    static hid::StaticArena<PARSER_ARENA_SIZE> arena;
+
+    const uint8_t *desc = entry.descriptor.data();
+    size_t desc_len = entry.descriptor.size();
+    ChangedTargets changes;
+    ChangedTargets expected;
+    hid::Collection *root = targets.root(config);
+    if (mode == Mode::PARSE_CHANGES) {
+        changes.attach(root, targets);
+    }
+    int base_init = base_parser.Init(base_targets.root(config), desc, desc_len);
+    int init = parser.Init(root, desc, desc_len, mode == Mode::PARSE_ARENA ? &arena : nullptr, mode == Mode::PARSE_LAZY);
+    if (base_init != init) {
+        fprintf(stderr, "%s/%s/%s: Init %d != baseline %d\n", entry.name.c_str(), config, mode_name(mode), init, base_init);
+        test_failures++;
+        return;
+    }
+    if (init != hid::ERR_SUCCESS) {
+        return;
+    }
+    // lazy=true なしの Init では ParseLazy と Decode は使えない
+    if (mode == Mode::PARSE_HEAP) {
+        CHECK_EQ(parser.ParseLazy(reports[0].data(), reports[0].size()), hid::ERR_LAZY_DECODING_DISABLED);
+        CHECK_EQ(parser.Decode(&targets.ints_ref, 0), hid::ERR_LAZY_DECODING_DISABLED);
+        CHECK_EQ(parser.Decode(&targets.bools_ref, 0), hid::ERR_LAZY_DECODING_DISABLED);
+    }
+
+    bool relative_ints = strcmp(config, "mouse") == 0;
+    CorpusTargets<> prev;
+    for (size_t i = 0; i < reports.size(); i++) {
+        const std::vector<uint8_t> &report = reports[i];
+        memcpy(prev.bools.bytes, targets.bools.bytes, sizeof(prev.bools.bytes));
+        memcpy(prev.bools2.bytes, targets.bools2.bytes, sizeof(prev.bools2.bytes));
+        memcpy(prev.ints.items, targets.ints.items, sizeof(prev.ints.items));
+        changes.clear();
+
+        int base_result = base_parser.Parse(report.data(), report.size());
+        int result = parse_current(mode, parser, targets, report);
+        int expected_result = base_result;
+        bool changes_ok = true;
+        if (mode == Mode::PARSE_CHANGES) {
+            // エラーのときは何も書かないので、相対値の変数も前の値のまま変化のビットは立たない
+            bool any_change = false;
+            expected.clear();
+            if (base_result == hid_baseline::ERR_SUCCESS || base_result == hid_baseline::ERR_NOTHING_CHANGED) {
+                any_change = expected_changes(prev, targets, relative_ints, expected);
+            }
+            if (base_result == hid_baseline::ERR_SUCCESS && !any_change) {
+                expected_result = hid::ERR_NOTHING_CHANGED;
+            }
+            changes_ok = same_changes(changes, expected);
+        }
+        if (result != expected_result || !same_values(base_targets, targets) || !changes_ok) {
+            fprintf(stderr, "%s/%s/%s: report %zu (%zu bytes): result %d, expected %d (baseline %d), values %s, changed bits %s\n",
+                entry.name.c_str(), config, mode_name(mode), i, report.size(), result, expected_result, base_result,
+                same_values(base_targets, targets) ? "same" : "differ", changes_ok ? "same" : "differ");
+            test_failures++;
+            return;
+        }
+        compared_reports++;
+        if (base_result == hid_baseline::ERR_SUCCESS) {
+            accepted_reports++;
+        }
+    }
+}
+
+
+int main(int argc, char **argv) {
+    std::vector<CorpusEntry> entries;
+    if (!load_corpus(argc > 1 ? argv[1] : DESCRIPTOR_CORPUS_DIR, entries)) {
+        return 1;
+    }
+
+    int mapped = 0;
+    for (const CorpusEntry &entry : entries) {
+        std::mt19937 rng(1);
+        std::vector<std::vector<uint8_t>> reports = make_reports(entry, rng);
+        for (const char *config : CONFIGS) {
+            for (Mode mode : { Mode::PARSE_HEAP, Mode::PARSE_ARENA, Mode::PARSE_CHANGES, Mode::PARSE_LAZY }) {
+                run(entry, config, mode, reports);
+            }
+            check_arena_peak(entry, config);
+            CorpusTargets<> targets;
+            hid::SelectiveInputReportParser parser;
+            if (parser.Init(targets.root(config), entry.descriptor.data(), entry.descriptor.size()) == hid::ERR_SUCCESS) {
+                mapped++;
+            }
+        }
+        // 少なくともコーパスに書かれた設定ではマッピングできる
+        CorpusTargets<> targets;
+        hid::SelectiveInputReportParser parser;
+        CHECK_EQ(parser.Init(targets.root(entry.config), entry.descriptor.data(), entry.descriptor.size()), hid::ERR_SUCCESS);
+    }
+    printf("%zu descriptors, %d mapped configs, %d reports compared (%d accepted), word-at-a-time bit copy %d\n",
+        entries.size(), mapped, compared_reports, accepted_reports, HRP_WORD_AT_A_TIME_BIT_COPY);
+    return test_result("parser_parity_test");
+}
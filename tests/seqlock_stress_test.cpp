@@ -0,0 +1,158 @@
+// Seqlock の読み出しが書き込みと重なっても途中の値を返さないことを確かめる
+// 書き込みスレッド1つが Seqlock に書き続け、読み出しスレッドいくつかが読み続けて、
+// 読んだ値がすべてそろっているか (1回の write() で書かれたものか) を調べる
+//   - 値のすべての語が書き込みの通し番号から決まるので、2回の書き込みが混ざればわかる
+//   - read() が返すバージョンと値の通し番号が一致する
+//   - 1つの読み出しスレッドから見たバージョンは減らない
+// 比較のため、Seqlock を通さずに同じ語を読んだ場合の途中の値の数も表示する (確かめはしない)
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "seqlock.h"
+#include "test.h"
+
+
+const int READER_THREADS = 3;
+const int DURATION_MS = 500;
+const uint32_t WORDS = 16;
+
+
+struct Snapshot {
+    uint32_t version;
+    uint32_t words[WORDS];
+};
+
+
+static uint32_t word_for(uint32_t version, uint32_t index) {
+    return version * 0x9E3779B9u ^ (index * 0x85EBCA6Bu);
+}
+
+
+static bool is_consistent(const Snapshot &snapshot) {
+    for (uint32_t i = 0; i < WORDS; i++) {
+        if (snapshot.words[i] != word_for(snapshot.version, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static Seqlock<Snapshot> shared;
+static std::atomic<uint32_t> unprotected[WORDS + 1];
+static std::atomic<bool> running { true };
+
+
+struct ReaderResult {
+    uint64_t reads = 0;
+    uint64_t torn = 0;
+    uint64_t version_mismatches = 0;
+    uint64_t version_decreases = 0;
+    uint64_t versions_seen = 0;
+    uint64_t unprotected_reads = 0;
+    uint64_t unprotected_torn = 0;
+};
+
+
+static void reader(ReaderResult *result) {
+    uint32_t last_version = 0;
+    while (running.load(std::memory_order_relaxed)) {
+        Snapshot snapshot;
+        uint32_t version = shared.read(snapshot);
+        result->reads++;
+        if (!is_consistent(snapshot)) {
+            result->torn++;
+        }
+        if (version != snapshot.version) {
+            result->version_mismatches++;
+        }
+        if (version < last_version) {
+            result->version_decreases++;
+        }
+        if (version != last_version) {
+            result->versions_seen++;
+        }
+        last_version = version;
+
+        // Seqlock を通さない読み出し (比較用)
+        Snapshot raw;
+        raw.version = unprotected[0].load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < WORDS; i++) {
+            raw.words[i] = unprotected[i + 1].load(std::memory_order_relaxed);
+        }
+        result->unprotected_reads++;
+        if (!is_consistent(raw)) {
+            result->unprotected_torn++;
+        }
+    }
+}
+
+
+int main() {
+    // Seqlock の初期値 (すべて 0) はそろった値ではないので、読み出しスレッドを始める前に
+    // バージョン 1 を書いておく。n 回目の write() は version = n の値を書く
+    Snapshot first;
+    first.version = 1;
+    unprotected[0].store(1);
+    for (uint32_t i = 0; i < WORDS; i++) {
+        first.words[i] = word_for(1, i);
+        unprotected[i + 1].store(first.words[i]);
+    }
+    CHECK_EQ(shared.write(first), 1);
+
+    std::vector<ReaderResult> results(READER_THREADS);
+    std::vector<std::thread> readers;
+    for (ReaderResult &result : results) {
+        readers.emplace_back(reader, &result);
+    }
+
+    uint32_t writes = 1;
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(DURATION_MS);
+    while (std::chrono::steady_clock::now() < end) {
+        for (int n = 0; n < 1000; n++) {
+            Snapshot snapshot;
+            snapshot.version = writes + 1;
+            for (uint32_t i = 0; i < WORDS; i++) {
+                snapshot.words[i] = word_for(snapshot.version, i);
+            }
+            if (shared.write(snapshot) != snapshot.version) {
+                test_failures++;
+            }
+            writes++;
+
+            unprotected[0].store(snapshot.version, std::memory_order_relaxed);
+            for (uint32_t i = 0; i < WORDS; i++) {
+                unprotected[i + 1].store(snapshot.words[i], std::memory_order_relaxed);
+            }
+        }
+    }
+    running = false;
+    for (std::thread &thread : readers) {
+        thread.join();
+    }
+
+    ReaderResult total;
+    for (const ReaderResult &result : results) {
+        CHECK(result.reads > 0);
+        total.reads += result.reads;
+        total.torn += result.torn;
+        total.version_mismatches += result.version_mismatches;
+        total.version_decreases += result.version_decreases;
+        total.versions_seen += result.versions_seen;
+        total.unprotected_reads += result.unprotected_reads;
+        total.unprotected_torn += result.unprotected_torn;
+    }
+    CHECK_EQ(total.torn, 0);
+    CHECK_EQ(total.version_mismatches, 0);
+    CHECK_EQ(total.version_decreases, 0);
+    CHECK_EQ(shared.version(), writes);
+
+    printf("writes=%u reads=%llu versions_seen=%llu torn=%llu unprotected_torn=%llu/%llu\n",
+        writes, (unsigned long long)total.reads, (unsigned long long)total.versions_seen,
+        (unsigned long long)total.torn,
+        (unsigned long long)total.unprotected_torn, (unsigned long long)total.unprotected_reads);
+    return test_result("seqlock_stress_test");
+}
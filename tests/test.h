@@ -0,0 +1,37 @@
+// ホスト用テストの共通の道具 (ctest から実行される。失敗があれば終了コード 1)
+#pragma once
+
+#include <stdio.h>
+
+
+static int test_failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            test_failures++; \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+// 失敗したときに値も表示する (整数だけ)
+#define CHECK_EQ(a, b) \
+    do { \
+        long long check_a_ = (long long)(a); \
+        long long check_b_ = (long long)(b); \
+        if (check_a_ != check_b_) { \
+            test_failures++; \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+                __FILE__, __LINE__, #a, #b, check_a_, check_b_); \
+        } \
+    } while (0)
+
+// main の最後で返す
+static inline int test_result(const char *name) {
+    if (test_failures != 0) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
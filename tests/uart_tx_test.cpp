@@ -0,0 +1,269 @@
+// UartTxQueue のテスト (HostUartTxBackend で送信を模擬する)
+//   - 送信待ちがいっぱいのとき、UART_TX_DROP_OLDEST は一番古い送信待ちフレームを、
+//     UART_TX_COALESCE は一番新しい送信待ちフレームを捨てる。送信中のフレームは捨てない
+//   - 積んだ順に送られ、送り終えるたびに commit() の tag で送信完了のコールバックが呼ばれる
+//   - 長さ 0 や長すぎるフレームは積まない。reserve() を続けて呼んでも同じスロットを返す
+//   - 積む・送り終えるをランダムに繰り返し、送られたフレームと統計を単純なモデルと比べる
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <random>
+#include <vector>
+#include "uart_tx.h"
+#include "uart_tx_host.h"
+#include "test.h"
+
+
+// 1バイトのフレーム (中身で区別する)
+template <class QUEUE>
+static void commit_frame(QUEUE &queue, uint8_t id) {
+    uint8_t *slot = queue.reserve();
+    slot[0] = id;
+    queue.commit(1, id);
+}
+
+
+// 送信中のフレームも送信待ちのフレームも送り終える
+static void finish_all(HostUartTxBackend &backend) {
+    while (backend.is_busy()) {
+        backend.finish();
+    }
+}
+
+
+static void test_drop_oldest() {
+    HostUartTxBackend backend;
+    UartTxQueue<3, 8> queue(&backend, UART_TX_DROP_OLDEST);
+
+    commit_frame(queue, 1); // 送信中
+    commit_frame(queue, 2);
+    commit_frame(queue, 3);
+    CHECK(queue.is_full());
+    commit_frame(queue, 4); // 2 を捨てる
+    commit_frame(queue, 5); // 3 を捨てる
+    finish_all(backend);
+
+    CHECK(backend.bytes == std::vector<uint8_t>({ 1, 4, 5 }));
+    UartTxStats stats = queue.stats();
+    CHECK_EQ(stats.committed, 5);
+    CHECK_EQ(stats.sent, 3);
+    CHECK_EQ(stats.dropped, 2);
+}
+
+
+static void test_coalesce() {
+    HostUartTxBackend backend;
+    UartTxQueue<3, 8> queue(&backend, UART_TX_COALESCE);
+
+    commit_frame(queue, 1); // 送信中
+    commit_frame(queue, 2);
+    commit_frame(queue, 3);
+    commit_frame(queue, 4); // 3 を置き換える
+    commit_frame(queue, 5); // 4 を置き換える
+    finish_all(backend);
+
+    CHECK(backend.bytes == std::vector<uint8_t>({ 1, 2, 5 }));
+    UartTxStats stats = queue.stats();
+    CHECK_EQ(stats.committed, 5);
+    CHECK_EQ(stats.sent, 3);
+    CHECK_EQ(stats.dropped, 2);
+}
+
+
+// ファームウェアと同じ2スロット (送信中 + 送信待ち) ではどちらのポリシーも
+// 送信待ちの1つを新しいフレームで置き換える
+static void test_two_slots(UartTxPolicy policy) {
+    HostUartTxBackend backend;
+    UartTxQueue<2, 8> queue(&backend, policy);
+
+    for (uint8_t id = 1; id <= 10; id++) {
+        commit_frame(queue, id);
+    }
+    CHECK_EQ(queue.pending(), 1);
+    finish_all(backend);
+
+    CHECK(backend.bytes == std::vector<uint8_t>({ 1, 10 }));
+    CHECK_EQ(queue.stats().dropped, 8);
+}
+
+
+// 送信待ちを捨てるのは reserve() の時点で空きがないときだけ。その前に送信が終わっていれば捨てない
+static void test_drop_decided_on_reserve(UartTxPolicy policy) {
+    HostUartTxBackend backend;
+    UartTxQueue<2, 8> queue(&backend, policy);
+
+    commit_frame(queue, 1);
+    commit_frame(queue, 2);
+    backend.finish(); // 1 を送り終え、2 を送り始める
+    commit_frame(queue, 3);
+    finish_all(backend);
+
+    CHECK(backend.bytes == std::vector<uint8_t>({ 1, 2, 3 }));
+    CHECK_EQ(queue.stats().dropped, 0);
+}
+
+
+struct SentLog {
+    std::vector<uint32_t> tags;
+
+    static void on_sent(void *context, uint32_t tag) {
+        static_cast<SentLog *>(context)->tags.push_back(tag);
+    }
+};
+
+
+static void test_order_and_tags() {
+    HostUartTxBackend backend;
+    UartTxQueue<4, 8> queue(&backend, UART_TX_DROP_OLDEST);
+    SentLog log;
+    queue.set_sent_callback(SentLog::on_sent, &log);
+
+    CHECK(!queue.is_busy());
+    commit_frame(queue, 1);
+    CHECK(queue.is_busy());
+    CHECK_EQ(queue.pending(), 0);
+    commit_frame(queue, 2);
+    commit_frame(queue, 3);
+    CHECK_EQ(queue.pending(), 2);
+    CHECK(!queue.is_full());
+    CHECK_EQ(backend.frame_lens.size(), 1); // 送信中のフレームだけがバックエンドに渡っている
+
+    backend.finish();
+    CHECK(log.tags == std::vector<uint32_t>({ 1 }));
+    CHECK_EQ(queue.pending(), 1);
+    finish_all(backend);
+    CHECK(!queue.is_busy());
+    CHECK(log.tags == std::vector<uint32_t>({ 1, 2, 3 }));
+    CHECK(backend.bytes == std::vector<uint8_t>({ 1, 2, 3 }));
+    CHECK_EQ(queue.high_water(), 3);
+
+    // 送信中でなければ送信完了の割り込みが来ても何もしない
+    backend.finish();
+    CHECK_EQ(log.tags.size(), 3);
+    CHECK_EQ(queue.stats().sent, 3);
+}
+
+
+static void test_slot_reuse_and_lengths() {
+    HostUartTxBackend backend;
+    UartTxQueue<2, 8> queue(&backend, UART_TX_DROP_OLDEST);
+
+    // commit() するまでは同じスロット
+    uint8_t *slot = queue.reserve();
+    CHECK(queue.reserve() == slot);
+
+    // 長さ 0 と長すぎるフレームはスロットを返すだけ
+    queue.commit(0);
+    queue.reserve();
+    queue.commit(9);
+    CHECK_EQ(queue.stats().committed, 0);
+    CHECK(!queue.is_busy());
+
+    // スロットの大きさちょうどのフレームは送れる
+    memset(queue.reserve(), 0x5A, 8);
+    queue.commit(8, 7);
+    CHECK(backend.frame_lens == std::vector<size_t>({ 8 }));
+
+    // submit() はコピーして積む
+    const uint8_t frame[3] = { 0x11, 0x22, 0x33 };
+    CHECK(queue.submit(frame, sizeof(frame)));
+    CHECK(!queue.submit(frame, 0));
+    uint8_t too_long[9] = {};
+    CHECK(!queue.submit(too_long, sizeof(too_long)));
+    finish_all(backend);
+    CHECK(backend.frame_lens == std::vector<size_t>({ 8, 3 }));
+    CHECK(memcmp(backend.bytes.data() + 8, frame, sizeof(frame)) == 0);
+
+    UartTxStats stats = queue.stats();
+    CHECK_EQ(stats.committed, 2);
+    CHECK_EQ(stats.sent, 2);
+    CHECK_EQ(stats.dropped, 0);
+}
+
+
+// 積む・送り終えるをランダムに繰り返し、送られたフレームの順番と統計をモデルと比べる
+template <uint8_t SLOTS>
+static void test_random_against_model(UartTxPolicy policy) {
+    HostUartTxBackend backend;
+    UartTxQueue<SLOTS, 4> queue(&backend, policy);
+    SentLog log;
+    queue.set_sent_callback(SentLog::on_sent, &log);
+
+    std::mt19937 rng(SLOTS * 2 + policy);
+    bool busy = false;
+    uint32_t sending = 0; // 送信中のフレーム
+    std::deque<uint32_t> pending; // 送信待ちのフレーム
+    std::vector<uint32_t> sent;
+    uint32_t dropped = 0;
+
+    for (uint32_t id = 1; id <= 20000; id++) {
+        if (rng() % 2 == 0) {
+            // モデル: 送信中と送信待ちでスロットがすべて埋まっていれば送信待ちを1つ捨てる
+            if ((busy ? 1 : 0) + pending.size() == SLOTS) {
+                if (policy == UART_TX_DROP_OLDEST) {
+                    pending.pop_front();
+                }
+                else {
+                    pending.pop_back();
+                }
+                dropped++;
+            }
+            if (busy) {
+                pending.push_back(id);
+            }
+            else {
+                sending = id;
+                busy = true;
+            }
+
+            uint8_t *slot = queue.reserve();
+            memcpy(slot, &id, sizeof(id));
+            queue.commit(sizeof(id), id);
+        }
+        else if (busy) {
+            sent.push_back(sending);
+            busy = !pending.empty();
+            if (busy) {
+                sending = pending.front();
+                pending.pop_front();
+            }
+            backend.finish();
+        }
+        CHECK_EQ(queue.is_busy(), busy);
+        CHECK_EQ(queue.pending(), pending.size());
+    }
+    finish_all(backend);
+    if (busy) {
+        sent.push_back(sending);
+    }
+    sent.insert(sent.end(), pending.begin(), pending.end());
+
+    CHECK(log.tags == sent);
+    CHECK_EQ(backend.frame_lens.size(), sent.size());
+    bool same_bytes = backend.bytes.size() == sent.size() * sizeof(uint32_t)
+        && memcmp(backend.bytes.data(), sent.data(), backend.bytes.size()) == 0;
+    CHECK(same_bytes);
+    UartTxStats stats = queue.stats();
+    CHECK_EQ(stats.sent, sent.size());
+    CHECK_EQ(stats.dropped, dropped);
+    CHECK_EQ(stats.committed, stats.sent + stats.dropped);
+    CHECK_EQ(queue.high_water(), SLOTS);
+}
+
+
+int main() {
+    test_order_and_tags();
+    test_slot_reuse_and_lengths();
+    test_random_against_model<2>(UART_TX_DROP_OLDEST);
+    test_random_against_model<2>(UART_TX_COALESCE);
+    test_random_against_model<5>(UART_TX_DROP_OLDEST);
+    test_random_against_model<5>(UART_TX_COALESCE);
+    test_drop_oldest();
+    test_coalesce();
+    test_two_slots(UART_TX_DROP_OLDEST);
+    test_two_slots(UART_TX_COALESCE);
+    test_drop_decided_on_reserve(UART_TX_DROP_OLDEST);
+    test_drop_decided_on_reserve(UART_TX_COALESCE);
+    return test_result("uart_tx_test");
+}